@@ -0,0 +1,40 @@
+@:result(251065)
+class BoxCache {
+
+	public static function main() {
+		// boxes small ints, bools and 0.0 like a JSON tree or a Map<String,Dynamic> does
+		// the allocation count printed should stay small, compare with a build without the box cache
+		var values : Array<Dynamic> = [for( i in 0...1000 ) null];
+		#if hl
+		var allocs = hl.Gc.stats().allocationCount;
+		#end
+		var t = haxe.Timer.stamp();
+		for( k in 0...10000 ) {
+			for( i in 0...1000 ) {
+				var v : Dynamic = switch( i & 3 ) {
+				case 0: i;
+				case 1: (i & 4) == 0;
+				case 2: 0.0;
+				default: (i + k) & 1023;
+				}
+				values[i] = v;
+			}
+		}
+		#if sys
+		var msg = Std.int((haxe.Timer.stamp() - t) * 1000) + " ms";
+		#if hl
+		msg += ", " + Std.int(hl.Gc.stats().allocationCount - allocs) + " allocations for 10M boxes";
+		#end
+		Sys.stderr().writeString(msg + "\n");
+		#end
+		var check = 0;
+		for( v in values )
+			switch( Type.typeof(v) ) {
+			case TInt: check += v;
+			case TBool: if( v ) check++;
+			default:
+			}
+		Benchs.result(check);
+	}
+
+}
@@ -0,0 +1,43 @@
+#if macro
+import haxe.macro.Context;
+import haxe.macro.Expr;
+#end
+
+@:result(49603)
+class ColdCode {
+
+	#if macro
+	static function build( count : Int ) : Array<Field> {
+		var fields = Context.getBuildFields();
+		for( i in 0...count ) {
+			var body = macro {
+				var v = x;
+				for( k in 0...$v{i % 7 + 2} ) {
+					v = (v * $v{i} + k) % 10007;
+					v ^= (v << 3) & 0xFFFF;
+				}
+				return v + $v{i};
+			};
+			fields.push({
+				name : "f" + i,
+				access : [APublic, AStatic],
+				kind : FFun({ args : [{ name : "x", type : macro : Int }], ret : macro : Int, expr : body }),
+				pos : Context.currentPos(),
+			});
+		}
+		return fields;
+	}
+	#else
+	public static function main() {
+		// a lot of code of which only a few functions run : measures the JIT startup, compare with HL_JIT_LAZY=1 or HL_JIT_CACHE=dir
+		Benchs.result(ColdFunctions.f0(1) + ColdFunctions.f2500(1) + ColdFunctions.f4999(1) + ColdFunctions.f1(1));
+	}
+	#end
+
+}
+
+#if !macro
+@:keep @:build(ColdCode.build(5000))
+class ColdFunctions {
+}
+#end
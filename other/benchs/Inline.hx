@@ -0,0 +1,36 @@
+@:result(28823852)
+class Inline {
+
+	public static function main() {
+		// getters, setters and one-line helpers called in a hot loop : compare with HL_JIT_INLINE=16
+		var v = new Vec(0, 3);
+		var acc = 0;
+		var t = haxe.Timer.stamp();
+		for( i in 0...20000000 ) {
+			v.setX(v.getX() + 1);
+			acc = Helpers.mix(acc, v.getY() + Helpers.clamp(i & 255, 16, 200));
+		}
+		#if sys
+		Sys.stderr().writeString(Std.int((haxe.Timer.stamp() - t) * 1000) + " ms\n");
+		#end
+		Benchs.result(acc + v.getX());
+	}
+
+}
+
+private class Vec {
+	var x : Int;
+	var y : Int;
+	public function new(x, y) {
+		this.x = x;
+		this.y = y;
+	}
+	public function getX() return x;
+	public function getY() return y;
+	public function setX(v:Int) x = v;
+}
+
+private class Helpers {
+	public static function mix( a : Int, b : Int ) return (a * 31 + b) & 0xFFFFFF;
+	public static function clamp( v : Int, lo : Int, hi : Int ) return v < lo ? lo : v > hi ? hi : v;
+}
@@ -0,0 +1,56 @@
+@:result(ok)
+class MarkHeap {
+
+	var next : MarkHeap;
+	var other : MarkHeap;
+	var v : Int;
+
+	function new(v, next) {
+		this.v = v;
+		this.next = next;
+	}
+
+	public static function main() {
+		// mark time of a major collection on a large heap (256MB by default, pass the size in MB as argument, 4096 for the 4GB case)
+		// compare runs with and without HL_GC_HUGE_PAGES=1 / HL_GC_NUMA=1
+		var mb = 256;
+		#if sys
+		var args = Sys.args();
+		if( args.length > 0 ) mb = Std.parseInt(args[0]);
+		#end
+		var count = Std.int(mb * 1024.0 * 1024.0 / 32);
+		var recent = [for( i in 0...1024 ) null];
+		var head = null;
+		var seed = 1;
+		for( i in 0...count ) {
+			head = new MarkHeap(i, head);
+			seed ^= seed << 13;
+			seed ^= seed >>> 17;
+			seed ^= seed << 5;
+			// cross links so that marking does not only follow the allocation order
+			head.other = recent[seed & 1023];
+			recent[seed & 1023] = head;
+		}
+		var best = 1e9;
+		for( i in 0...5 ) {
+			var t = haxe.Timer.stamp();
+			#if hl
+			hl.Gc.major();
+			#end
+			t = haxe.Timer.stamp() - t;
+			if( t < best ) best = t;
+		}
+		#if sys
+		Sys.stderr().writeString(mb + "MB heap : " + Std.int(best * 1000) + " ms/major\n");
+		#end
+		var n = 0, expect = count - 1;
+		var ok = true;
+		while( head != null ) {
+			if( head.v != expect - n ) ok = false;
+			n++;
+			head = head.next;
+		}
+		Benchs.result(ok && n == count ? "ok" : "error");
+	}
+
+}
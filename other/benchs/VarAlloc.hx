@@ -0,0 +1,38 @@
+@:result(746128088)
+class VarAlloc {
+
+	static var seed = 1;
+
+	static inline function rand( n : Int ) {
+		seed ^= seed << 13;
+		seed ^= seed >>> 17;
+		seed ^= seed << 5;
+		return (seed >>> 8) % n;
+	}
+
+	public static function main() {
+		// the live set grows and gets fragmented at each phase : the time per allocation should stay the same
+		var live = [];
+		var check = 0;
+		for( phase in 0...8 ) {
+			for( i in 0...25000 ) {
+				var b = haxe.io.Bytes.alloc(40 + rand(1500));
+				b.set(0, i);
+				if( rand(2) == 0 ) live.push(b);
+			}
+			var t = haxe.Timer.stamp();
+			for( i in 0...100000 ) {
+				var b = haxe.io.Bytes.alloc(40 + rand(1500));
+				b.set(b.length - 1, i);
+				check += b.get(b.length - 1) + b.length;
+			}
+			#if sys
+			Sys.stderr().writeString("live " + live.length + " : " + Std.int((haxe.Timer.stamp() - t) * 1e9 / 100000) + " ns/alloc\n");
+			#end
+		}
+		for( b in live )
+			check += b.get(0);
+		Benchs.result(check);
+	}
+
+}
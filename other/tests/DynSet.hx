@@ -0,0 +1,30 @@
+class DynPoint {
+	public var x : Int;
+	public var y : Float;
+	public function new() {
+	}
+}
+
+class DynSet {
+
+	static function check( v : Bool, msg : String ) {
+		if( !v ) throw msg;
+	}
+
+	static function main() {
+		// the JIT inline cache for dynamic writes must not keep the value register across the slow path
+		var o : Dynamic = new DynPoint();
+		var v = Std.random(1) + 7;
+		o.y = v; // Int into a Float field : slow path
+		var s = v + 1;
+		check(s == 8, "int register lost after dynamic set");
+		for( i in 0...3 ) {
+			o.x = v; // same type : cached after the first write
+			s = v + i;
+			check(s == 7 + i, "int register lost after cached dynamic set");
+		}
+		check(o.x == 7 && o.y == 7., "dynamic set failed");
+		trace("ok");
+	}
+
+}
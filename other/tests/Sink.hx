@@ -0,0 +1,85 @@
+class SinkPoint {
+	public var x : Int;
+	public var y : Float;
+	public inline function new( x : Int ) {
+		this.x = x;
+	}
+	public function add( v : Int ) {
+		return x + v;
+	}
+}
+
+class Sink {
+
+	static var kept : Array<SinkPoint> = [];
+
+	static function check( v : Bool, msg : String ) {
+		if( !v ) throw msg;
+	}
+
+	static function keep( p : SinkPoint ) {
+		kept.push(p);
+	}
+
+	static function loop( n : Int ) {
+		// each iteration gets a new object : the field written by the previous one must be reset
+		var sum = 0;
+		for( i in 0...n ) {
+			var p = new SinkPoint(i);
+			sum += Std.int(p.y);
+			if( i % 2 == 0 ) p.y = i;
+			sum += p.x + Std.int(p.y);
+		}
+		return sum;
+	}
+
+	static function unbox( i : Int ) {
+		// unboxed to the same kind : the box is never allocated
+		var d : Dynamic = i;
+		var n : Null<Int> = i;
+		var v : Int = d;
+		if( n == null ) return -1;
+		return v + n;
+	}
+
+	static function unboxFloat( i : Int ) : Float {
+		// unboxed to another kind : the box escapes to the runtime conversion
+		var d : Dynamic = i;
+		var f : Float = d;
+		return f;
+	}
+
+	static function closure( p : SinkPoint, v : Int ) {
+		var f = p.add;
+		return f(v) + f(1);
+	}
+
+	static function escapes( n : Int ) {
+		var last = null;
+		for( i in 0...n ) {
+			var p = new SinkPoint(i);
+			var q = p;
+			last = q;
+			keep(new SinkPoint(i * 2));
+		}
+		return last;
+	}
+
+	static function main() {
+		// run enough times for the optimizing tier to compile the functions
+		for( k in 0...1000 ) {
+			check(loop(10) == 65, "sunk object in a loop");
+			check(unbox(k) == k * 2, "sunk box");
+			check(unboxFloat(k) == k, "escaping box");
+			check(closure(new SinkPoint(k), 3) == k * 2 + 4, "sunk closure");
+			kept = [];
+			var p = escapes(10);
+			hl.Gc.major();
+			check(p.x == 9, "object escaping through a move");
+			for( i in 0...10 )
+				check(kept[i].x == i * 2 && kept[i].y == 0, "object escaping through a call");
+		}
+		trace("ok");
+	}
+
+}
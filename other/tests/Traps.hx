@@ -0,0 +1,133 @@
+class TrapError extends haxe.Exception {
+	public var code : Int;
+	public function new( code : Int ) {
+		super("TrapError " + code);
+		this.code = code;
+	}
+}
+
+class Traps {
+
+	static function check( v : Bool, msg : String ) {
+		if( !v ) {
+			// don't throw : the error handler test runs outside of any try
+			Sys.println(msg);
+			Sys.exit(1);
+		}
+	}
+
+	static function fail( code : Int ) : Int {
+		throw new TrapError(code);
+	}
+
+	static function failString( msg : String ) : Int {
+		throw msg;
+	}
+
+	static function nested() {
+		var log = 0;
+		try {
+			try {
+				log += fail(1);
+			} catch( e : TrapError ) {
+				log += e.code;
+				fail(2);
+			}
+		} catch( e : TrapError ) {
+			log += e.code * 10;
+		}
+		try {
+			try {
+				log += 100;
+			} catch( e : TrapError ) {
+				log = -1;
+			}
+			// the inner try is left : the outer one handles the throw
+			fail(3);
+		} catch( e : TrapError ) {
+			log += e.code * 1000;
+		}
+		return log;
+	}
+
+	static function rethrow() {
+		try {
+			fail(4);
+		} catch( e : TrapError ) {
+			throw e;
+		}
+		return 0;
+	}
+
+	static function exited( code : Int ) {
+		// the try is over when fail() throws : this frame has no active handler
+		try {
+			code++;
+		} catch( e : Dynamic ) {
+			return -1;
+		}
+		return fail(code);
+	}
+
+	static function filtered() {
+		// the inner catch doesn't match : the throw reads the type check of both handlers
+		try {
+			try {
+				failString("filtered");
+			} catch( e : TrapError ) {
+				return -1;
+			}
+		} catch( e : String ) {
+			return e == "filtered" ? 1 : -2;
+		}
+		return -3;
+	}
+
+	static function callback( code : Int ) {
+		// the throw goes through the C frames of the native call
+		try {
+			Reflect.callMethod(null, fail, [code]);
+		} catch( e : TrapError ) {
+			return e.code;
+		}
+		return -1;
+	}
+
+	static function run() {
+		check(nested() == 3121, "nested try");
+		var code = 0;
+		try {
+			rethrow();
+		} catch( e : TrapError ) {
+			code = e.code;
+		}
+		check(code == 4, "rethrow from a catch");
+		code = 0;
+		try {
+			exited(4);
+		} catch( e : TrapError ) {
+			code = e.code;
+		}
+		check(code == 5, "throw from a frame without handler");
+		check(filtered() == 1, "typed catch filter");
+		check(callback(6) == 6, "throw through a native call");
+	}
+
+	static function onError( e : Dynamic ) {
+		// called by hl_throw under a C trap, above the JIT frames that threw
+		check(Std.isOfType(e, TrapError) && e.code == 8, "uncaught exception");
+		run();
+		check(callback(9) == 9, "throw through a native call from the error handler");
+		trace("ok");
+		Sys.exit(0);
+	}
+
+	static function main() {
+		for( i in 0...100 )
+			run();
+		hl.Api.setErrorHandler(onError);
+		exited(7);
+		check(false, "error handler not called");
+	}
+
+}
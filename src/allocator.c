@@ -63,8 +63,23 @@ static const int GC_SIZES[GC_PARTITIONS] = {4,8,12,16,20,	8,64,1<<13,0};
 #define GC_ALL_PAGES	(GC_PARTITIONS << PAGE_KIND_BITS)
 #define	GC_ALIGN		(1 << GC_ALIGN_BITS)
 
+/*
+	Pages are swept lazily : after a mark, gc_sweep_pages is the next page of each list that still
+	has to rebuild its free list from the mark bits. Allocations sweep at most GC_SWEEP_BUDGET pages
+	before taking a new one, and the swept pages having free space are queued in gc_free_pages.
+	Var-size pages are instead bucketed by their largest free run : bucket b holds the pages whose
+	largest run is in [2^b,2^(b+1)), so a page that fits a request is found without any search.
+*/
+#define GC_SWEEP_BUDGET	16
+#define GC_RUN_BUCKETS	9
+
 static gc_pheader *gc_pages[GC_ALL_PAGES] = {NULL};
 static gc_pheader *gc_free_pages[GC_ALL_PAGES] = {NULL};
+static gc_pheader *gc_sweep_pages[GC_ALL_PAGES] = {NULL};
+static gc_pheader *gc_sweep_prev[GC_ALL_PAGES] = {NULL};
+static int gc_pages_count[GC_ALL_PAGES] = {0};
+static gc_pheader *gc_run_pages[GC_ALL_PAGES][GC_RUN_BUCKETS] = {{NULL}};
+static int gc_run_mask[GC_ALL_PAGES] = {0};
 
 #define MAX_FL_CACHED 16
 
@@ -125,16 +140,101 @@ static void freelist_append( gc_freelist *fl, int pos, int count ) {
 	p->count = (fl_cursor)count;
 }
 
+static int gc_run_bucket( int count ) {
+	int b = 0;
+	while( b < GC_RUN_BUCKETS - 1 && (count >> (b + 1)) != 0 )
+		b++;
+	return b;
+}
+
+static void gc_run_link( int pid, gc_pheader *ph ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	int b = gc_run_bucket(p->free_run);
+	gc_pheader *head = gc_run_pages[pid][b];
+	p->free_bucket = (unsigned char)b;
+	p->prev_free = NULL;
+	p->next_free = head;
+	if( head ) head->alloc.prev_free = ph;
+	gc_run_pages[pid][b] = ph;
+	gc_run_mask[pid] |= 1 << b;
+}
+
+static void gc_run_unlink( int pid, gc_pheader *ph ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	int b = p->free_bucket;
+	if( p->prev_free )
+		p->prev_free->alloc.next_free = p->next_free;
+	else if( (gc_run_pages[pid][b] = p->next_free) == NULL )
+		gc_run_mask[pid] &= ~(1 << b);
+	if( p->next_free )
+		p->next_free->alloc.prev_free = p->prev_free;
+}
+
+static void gc_run_update( int pid, gc_pheader *ph ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	gc_freelist *fl = &p->free;
+	int k, max = 0;
+	for(k=fl->current;k<fl->count;k++) {
+		gc_fl *c = GET_FL(fl,k);
+		if( c->count > max ) {
+			max = c->count;
+			p->free_pos = (fl_cursor)k;
+		}
+	}
+	p->free_run = (fl_cursor)max;
+	if( max ) gc_run_link(pid, ph);
+}
+
+/*
+	Returns a free run of at least nblocks (<= free_run) or NULL if the page has to be reclassified.
+	free_pos is the first run having free_run blocks : runs only shrink while allocating, so once it
+	gets used, the next candidate can only be after it and the page is rescanned only when the
+	largest run size decreases.
+*/
+static gc_fl *gc_run_fit( gc_pheader *ph, int nblocks ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	gc_freelist *fl = &p->free;
+	gc_fl *c;
+	// the lowest run first, to keep allocations in address order
+	if( fl->current < fl->count && (c = GET_FL(fl,fl->current))->count >= nblocks )
+		return c;
+	while( p->free_pos < fl->count ) {
+		c = GET_FL(fl,p->free_pos);
+		if( c->count >= nblocks )
+			return c;
+		if( c->count >= p->free_run )
+			return NULL;
+		p->free_pos++;
+	}
+	return NULL;
+}
+
+// returns a var page having a free run of at least nblocks, or NULL
+static gc_pheader *gc_run_find( int pid, int nblocks ) {
+	int b = gc_run_bucket(nblocks);
+	gc_pheader *ph = gc_run_pages[pid][b];
+	if( ph && ph->alloc.free_run >= nblocks )
+		return ph;
+	int mask = gc_run_mask[pid] & ~((2 << b) - 1);
+	return mask ? gc_run_pages[pid][TRAILING_ZEROES(mask)] : NULL;
+}
+
+// makes a page having some free space available to allocations
+static void gc_page_available( int pid, gc_pheader *ph ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	if( p->sizes ) {
+		gc_run_update(pid, ph);
+		return;
+	}
+	p->next_free = gc_free_pages[pid];
+	gc_free_pages[pid] = ph;
+}
+
 static gc_pheader *gc_allocator_new_page( int pid, int block, int size, int kind, bool varsize ) {
 	// increase size based on previously allocated pages
 	if( block < 256 ) {
-		int num_pages = 0;
+		int num_pages = gc_pages_count[pid];
 		int count = 1;
-		gc_pheader *ph = gc_pages[pid];
-		while( ph ) {
-			num_pages++;
-			ph = ph->next_page;
-		}
 		while( num_pages > 8 && (size<<1) / block <= GC_PAGE_SIZE ) {
 			size <<= 1;
 			count <<= 1;
@@ -160,6 +260,7 @@ static gc_pheader *gc_allocator_new_page( int pid, int block, int size, int kind
 		p->size_bits = 0;
 	p->max_blocks = max_blocks;
 	p->sizes = NULL;
+	p->compact = 0;
 	if( p->max_blocks > GC_PAGE_SIZE )
 		hl_fatal("Too many blocks for this page");
 	if( varsize ) {
@@ -179,10 +280,17 @@ static gc_pheader *gc_allocator_new_page( int pid, int block, int size, int kind
 	p->first_block = start_pos / block;
 	alloc_freelist(&p->free,fl_bits);
 	freelist_append(&p->free,p->first_block, p->max_blocks - p->first_block);
-	p->need_flush = false;
+	// a black page gets its free list rebuilt once the mark is done
+	p->need_flush = gc_mark_running;
 
+	// the page is inserted before the ones that are still to be swept
+	if( gc_sweep_pages[pid] && !gc_sweep_prev[pid] )
+		gc_sweep_prev[pid] = ph;
 	ph->next_page = gc_pages[pid];
 	gc_pages[pid] = ph;
+	gc_pages_count[pid]++;
+	gc_page_available(pid, ph);
+	gc_publish_page(ph);
 
 	return ph;
 }
@@ -232,6 +340,16 @@ static void flush_free_list( gc_pheader *ph ) {
 		}
 		bid += count;
 	}
+	if( gc_flags & GC_GENERATIONAL ) {
+		// free blocks might have been marked (conservative or black allocation) : a block must be unmarked
+		// when it's allocated, or the next minor collection would take it for an old one
+		int k;
+		for(k=0;k<new_fl.count;k++) {
+			gc_fl *fl = GET_FL(&new_fl,k);
+			for(bid=fl->pos;bid<fl->pos+fl->count;bid++)
+				bmp[bid>>3] &= ~(1<<(bid&7));
+		}
+	}
 	p->free = new_fl;
 	p->need_flush = false;
 #ifdef __GC_DEBUG
@@ -276,88 +394,148 @@ static void flush_free_list( gc_pheader *ph ) {
 	free_freelist(&old_fl);
 }
 
-static void *gc_alloc_fixed( int part, int kind ) {
+static bool gc_page_is_empty( gc_allocator_page_data *p ) {
+	gc_freelist *fl = &p->free;
+	return fl->current == 0 && fl->count == 1 && fl->data->pos == p->first_block && fl->data->count == p->max_blocks - p->first_block;
+}
+
+static void gc_allocator_free_page( int pid, gc_pheader *ph, gc_pheader *prev ) {
+	if( prev )
+		prev->next_page = ph->next_page;
+	else
+		gc_pages[pid] = ph->next_page;
+	gc_pages_count[pid]--;
+	free_freelist(&ph->alloc.free);
+	free(ph->alloc.finalizers);
+	gc_free_page(ph, ph->alloc.max_blocks);
+}
+
+static gc_pheader *gc_sweep_page( int pid, int *budget ) {
+	gc_pheader *ph;
+	while( *budget > 0 && (ph = gc_sweep_pages[pid]) != NULL ) {
+		gc_allocator_page_data *p = &ph->alloc;
+		(*budget)--;
+		gc_sweep_pages[pid] = ph->next_page;
+		// while a concurrent mark is running, bmp is not complete : keep the previous free list
+		if( !gc_mark_running ) {
+			if( p->need_flush )
+				flush_free_list(ph);
+			if( gc_page_is_empty(p) ) {
+				gc_allocator_free_page(pid, ph, gc_sweep_prev[pid]);
+				continue;
+			}
+		}
+		gc_sweep_prev[pid] = ph;
+		if( p->free.current < p->free.count ) {
+			gc_page_available(pid, ph);
+			return ph;
+		}
+	}
+	return NULL;
+}
+
+static void gc_sweep_reset() {
+	int pid;
+	for(pid=0;pid<GC_ALL_PAGES;pid++) {
+		gc_free_pages[pid] = NULL;
+		gc_sweep_pages[pid] = gc_pages[pid];
+		gc_sweep_prev[pid] = NULL;
+	}
+	memset(gc_run_pages,0,sizeof(gc_run_pages));
+	memset(gc_run_mask,0,sizeof(gc_run_mask));
+}
+
+static void *gc_alloc_fixed( int part, int kind, int *count ) {
 	int pid = (part << PAGE_KIND_BITS) | kind;
 	gc_pheader *ph = gc_free_pages[pid];
 	gc_allocator_page_data *p = NULL;
 	int bid = -1;
-	while( ph ) {
+	int n = *count;
+	int budget = GC_SWEEP_BUDGET;
+	while( true ) {
+		if( ph == NULL ) {
+			ph = gc_sweep_page(pid, &budget);
+			if( ph == NULL )
+				ph = gc_allocator_new_page(pid, GC_SIZES[part], GC_PAGE_SIZE, kind, false);
+		}
 		p = &ph->alloc;
-		if( p->need_flush )
-			flush_free_list(ph);
 		gc_freelist *fl = &p->free;
 		if( fl->current < fl->count ) {
 			gc_fl *c = GET_FL(fl,fl->current);
-			bid = c->pos++;
-			c->count--;
+			if( n > c->count ) n = c->count;
+			bid = c->pos;
+			c->pos += n;
+			c->count -= n;
 #			ifdef GC_DEBUG
 			if( c->count < 0 ) hl_fatal("assert");
 #			endif
 			if( !c->count ) fl->current++;
 			break;
 		}
-		ph = ph->next_page;
-	}
-	if( ph == NULL ) {
-		ph = gc_allocator_new_page(pid, GC_SIZES[part], GC_PAGE_SIZE, kind, false);
-		p = &ph->alloc;
-		bid = p->free.data->pos++;
-		p->free.data->count--;
+		// full until it gets swept again
+		ph = gc_free_pages[pid] = p->next_free;
 	}
 	unsigned char *ptr = ph->base + bid * p->block_size;
 #	ifdef GC_DEBUG
 	{
 		int i;
-		if( bid < p->first_block || bid >= p->max_blocks )
+		if( bid < p->first_block || bid + n > p->max_blocks )
 			hl_fatal("assert");
-		for(i=0;i<p->block_size;i++)
+		for(i=0;i<p->block_size*n;i++)
 			if( ptr[i] != 0xDD )
 				hl_fatal("assert");
 	}
 #	endif
-	gc_free_pages[pid] = ph;
+	if( gc_mark_running ) gc_alloc_black(ph, ptr, n * p->block_size, bid, n);
+	*count = n;
 	return ptr;
 }
 
+static void gc_add_finalizer( gc_pheader *ph, int bid ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	if( p->fin_count == p->fin_max ) {
+		int nmax = p->fin_max ? p->fin_max << 1 : 8;
+		fl_cursor *fin = (fl_cursor*)malloc(sizeof(fl_cursor) * nmax);
+		if( fin == NULL ) out_of_memory("finalizers");
+		memcpy(fin, p->finalizers, sizeof(fl_cursor) * p->fin_count);
+		free(p->finalizers);
+		p->finalizers = fin;
+		p->fin_max = nmax;
+	}
+	p->finalizers[p->fin_count++] = (fl_cursor)bid;
+}
+
 static void *gc_alloc_var( int part, int size, int kind ) {
 	int pid = (part << PAGE_KIND_BITS) | kind;
-	gc_pheader *ph = gc_free_pages[pid];
+	gc_pheader *ph;
 	gc_allocator_page_data *p = NULL;
+	gc_freelist *fl;
+	gc_fl *c;
 	unsigned char *ptr;
 	fl_cursor nblocks = (fl_cursor)(size >> GC_SBITS[part]);
 	int bid = -1;
-	while( ph ) {
-		p = &ph->alloc;
-		if( p->need_flush )
-			flush_free_list(ph);
-		gc_freelist *fl = &p->free;
-		int k;
-		for(k=fl->current;k<fl->count;k++) {
-			gc_fl *c = GET_FL(fl,k);
-			if( c->count >= nblocks ) {
-				bid = c->pos;
-				c->pos += nblocks;
-				c->count -= nblocks;
-#				ifdef GC_DEBUG
-				if( c->count < 0 ) hl_fatal("assert");
-#				endif
-				if( c->count == 0 ) fl->current++;
-				goto alloc_var;
-			}
+	int budget = GC_SWEEP_BUDGET;
+	while( true ) {
+		ph = gc_run_find(pid, nblocks);
+		if( ph == NULL ) {
+			if( gc_sweep_page(pid, &budget) ) continue;
+			int psize = GC_PAGE_SIZE;
+			while( psize < size + 1024 )
+				psize <<= 1;
+			ph = gc_allocator_new_page(pid, GC_SIZES[part], psize, kind, true);
 		}
-		ph = ph->next_page;
-	}
-	if( ph == NULL ) {
-		int psize = GC_PAGE_SIZE;
-		while( psize < size + 1024 )
-			psize <<= 1;
-		ph = gc_allocator_new_page(pid, GC_SIZES[part], psize, kind, true);
-		p = &ph->alloc;
-		bid = p->first_block;
-		p->free.data->pos += nblocks;
-		p->free.data->count -= nblocks;
+		if( (c = gc_run_fit(ph, nblocks)) != NULL )
+			break;
+		gc_run_unlink(pid, ph);
+		gc_run_update(pid, ph);
 	}
-alloc_var:
+	p = &ph->alloc;
+	fl = &p->free;
+	bid = c->pos;
+	c->pos += nblocks;
+	c->count -= nblocks;
+	while( fl->current < fl->count && GET_FL(fl,fl->current)->count == 0 )
+		fl->current++;
 	ptr = ph->base + bid * p->block_size;
 #	ifdef GC_DEBUG
 	{
@@ -369,7 +547,10 @@ alloc_var:
 				hl_fatal("assert");
 	}
 #	endif
-	if( ph->bmp ) {
+	// in generational mode, unmarked blocks are the young ones that the next minor collection will trace
+	if( gc_mark_running )
+		gc_alloc_black(ph, ptr, size, bid, 1);
+	else if( ph->bmp && !(gc_flags & GC_GENERATIONAL) ) {
 #		ifdef GC_DEBUG
 		int i;
 		for(i=0;i<nblocks;i++) {
@@ -381,7 +562,7 @@ alloc_var:
 	}
 	if( nblocks > 1 ) MZERO(p->sizes + bid, nblocks);
 	p->sizes[bid] = (unsigned char)nblocks;
-	gc_free_pages[pid] = ph;
+	if( kind == MEM_KIND_FINALIZER ) gc_add_finalizer(ph, bid);
 	return ptr;
 }
 
@@ -392,12 +573,15 @@ static void *gc_allocator_alloc( int *size, int page_kind ) {
 		sz += (-sz) & (GC_PAGE_SIZE - 1);
 		*size = sz;
 		gc_pheader *ph = gc_allocator_new_page((GC_LARGE_PART << PAGE_KIND_BITS) | page_kind,sz,sz,page_kind,false);
+		if( gc_mark_running ) gc_alloc_black(ph, ph->base, sz, 0, 1);
+		if( page_kind == MEM_KIND_FINALIZER ) gc_add_finalizer(ph, 0);
 		return ph->base;
 	}
 	if( sz <= GC_SIZES[GC_FIXED_PARTS-1] && page_kind != MEM_KIND_FINALIZER ) {
 		int part = (sz >> GC_ALIGN_BITS) - 1;
+		int count = 1;
 		*size = GC_SIZES[part];
-		return gc_alloc_fixed(part, page_kind);
+		return gc_alloc_fixed(part, page_kind, &count);
 	}
 	int p;
 	for(p=GC_FIXED_PARTS;p<GC_PARTITIONS;p++) {
@@ -412,6 +596,16 @@ static void *gc_allocator_alloc( int *size, int page_kind ) {
 	return NULL;
 }
 
+static void *gc_allocator_alloc_run( int *size, int page_kind, int *count ) {
+	int sz = *size;
+	sz += (-sz) & (GC_ALIGN - 1);
+	if( sz > GC_SIZES[GC_FIXED_PARTS-1] || page_kind == MEM_KIND_FINALIZER )
+		return NULL;
+	int part = (sz >> GC_ALIGN_BITS) - 1;
+	*size = GC_SIZES[part];
+	return gc_alloc_fixed(part, page_kind, count);
+}
+
 static bool is_zero( void *ptr, int size ) {
 	static char ZEROMEM[256] = {0};
 	unsigned char *p = (unsigned char*)ptr;
@@ -423,24 +617,18 @@ static bool is_zero( void *ptr, int size ) {
 	return memcmp(p,ZEROMEM,size) == 0;
 }
 
-static void gc_flush_empty_pages() {
-	int i;
-	for(i=0;i<GC_ALL_PAGES;i++) {
-		gc_pheader *ph = gc_pages[i];
+static void gc_sweep_large() {
+	int kind;
+	// large blocks are never allocated from a swept page : release them now
+	for(kind=0;kind<1<<PAGE_KIND_BITS;kind++) {
+		int pid = (GC_LARGE_PART << PAGE_KIND_BITS) | kind;
+		gc_pheader *ph = gc_pages[pid];
 		gc_pheader *prev = NULL;
 		while( ph ) {
-			gc_allocator_page_data *p = &ph->alloc;
 			gc_pheader *next = ph->next_page;
-			if( ph->bmp && is_zero(ph->bmp+(p->first_block>>3),((p->max_blocks+7)>>3) - (p->first_block>>3)) ) {
-				if( prev )
-					prev->next_page = next;
-				else
-					gc_pages[i] = next;
-				if( gc_free_pages[i] == ph )
-					gc_free_pages[i] = next;
-				free_freelist(&p->free);
-				gc_free_page(ph, p->max_blocks);
-			} else
+			if( (ph->bmp[0] & 1) == 0 )
+				gc_allocator_free_page(pid, ph, prev);
+			else
 				prev = ph;
 			ph = next;
 		}
@@ -453,7 +641,7 @@ static int64 gc_allocator_private_memory() {
 
 static int gc_free_memory( gc_pheader *ph ) {
 	gc_allocator_page_data *p = &ph->alloc;
-	if( p->need_flush )
+	if( p->need_flush && !gc_mark_running )
 		flush_free_list(ph);
 	gc_freelist *fl = &p->free;
 	int k;
@@ -498,44 +686,66 @@ static void gc_clear_unmarked_mem() {
 }
 #endif
 
-static void gc_call_finalizers(){
-	int i;
-	for(i=MEM_KIND_FINALIZER;i<GC_ALL_PAGES;i+=1<<PAGE_KIND_BITS) {
-		gc_pheader *ph = gc_pages[i];
+/*
+	Finalizers are not called while the world is stopped : the dead finalizable blocks are queued
+	and marked again so they survive until their finalizer has run, then get swept by the next
+	collection. Only the page index of not yet finalized blocks is visited.
+*/
+static void gc_queue_finalizers() {
+	int pid;
+	for(pid=MEM_KIND_FINALIZER;pid<GC_ALL_PAGES;pid+=1<<PAGE_KIND_BITS) {
+		gc_pheader *ph = gc_pages[pid];
 		while( ph ) {
-			int bid;
 			gc_allocator_page_data *p = &ph->alloc;
-			for(bid=p->first_block;bid<p->max_blocks;bid++) {
-				int size = p->sizes[bid];
-				if( !size ) continue;
-				if( (ph->bmp[bid>>3] & (1<<(bid&7))) == 0 ) {
-					unsigned char *ptr = ph->base + bid * p->block_size;
-					void *finalizer = *(void**)ptr;
-					p->sizes[bid] = 0;
-					if( finalizer )
-						((void(*)(void *))finalizer)(ptr);
-#					ifdef GC_DEBUG
-					memset(ptr,0xDD,size*p->block_size);
-#					endif
+			int i, count = 0;
+			for(i=0;i<p->fin_count;i++) {
+				int bid = p->finalizers[i];
+				if( ph->bmp[bid>>3] & (1<<(bid&7)) )
+					p->finalizers[count++] = (fl_cursor)bid;
+				else {
+					ph->bmp[bid>>3] |= 1<<(bid&7);
+					gc_finalize_push(ph->base + bid * p->block_size);
 				}
 			}
+			p->fin_count = count;
 			ph = ph->next_page;
 		}
 	}
 }
 
-static void gc_allocator_before_mark( unsigned char *mark_cur ) {
+static void gc_allocator_release_unswept() {
+	int pid;
+	// the pages that were not swept since the previous mark are released if nothing was alive
+	for(pid=0;pid<GC_ALL_PAGES;pid++) {
+		gc_pheader *ph = gc_sweep_pages[pid];
+		gc_pheader *prev = gc_sweep_prev[pid];
+		while( ph ) {
+			gc_allocator_page_data *p = &ph->alloc;
+			gc_pheader *next = ph->next_page;
+			if( ph->bmp && is_zero(ph->bmp+(p->first_block>>3),((p->max_blocks+7)>>3) - (p->first_block>>3)) ) {
+				gc_allocator_free_page(pid, ph, prev);
+				if( gc_sweep_pages[pid] == ph ) gc_sweep_pages[pid] = next;
+			} else
+				prev = ph;
+			ph = next;
+		}
+	}
+}
+
+static void gc_allocator_before_mark( unsigned char *mark_cur, bool keep ) {
 	int pid;
 	for(pid=0;pid<GC_ALL_PAGES;pid++) {
 		gc_pheader *p = gc_pages[pid];
-		gc_free_pages[pid] = p;
 		while( p ) {
+			int bytes = (p->alloc.max_blocks + 7) >> 3;
+			if( keep && p->bmp ) memcpy(mark_cur, p->bmp, bytes);
 			p->bmp = mark_cur;
 			p->alloc.need_flush = true;
-			mark_cur += (p->alloc.max_blocks + 7) >> 3;
+			mark_cur += bytes;
 			p = p->next_page;
 		}
 	}
+	gc_sweep_reset();
 }
 
 #define gc_allocator_fast_block_size(page,block) \
@@ -560,6 +770,9 @@ static int gc_allocator_get_block_id( gc_pheader *page, void *block ) {
 		if( bid * page->alloc.block_size != offset )
 			return -1;
 	}
+	// trailing bytes of the page that can't hold a whole block (a region end might point there)
+	if( bid >= page->alloc.max_blocks )
+		return -1;
 	if( page->alloc.sizes && page->alloc.sizes[bid] == 0 )
 		return -1;
 	return bid;
@@ -569,6 +782,7 @@ static int gc_allocator_get_block_id( gc_pheader *page, void *block ) {
 static int gc_allocator_get_block_interior( gc_pheader *page, void **block ) {
 	int offset = (int)((unsigned char*)*block - page->base);
 	int bid = offset / page->alloc.block_size;
+	if( bid >= page->alloc.max_blocks ) return -1;
 	if( page->alloc.sizes ) {
 		if( bid < page->alloc.first_block ) return -1;
 		while( page->alloc.sizes[bid] == 0 ) {
@@ -581,12 +795,143 @@ static int gc_allocator_get_block_interior( gc_pheader *page, void **block ) {
 }
 #endif
 
+/*
+	Compaction : after a full mark, the var-size pages having less than a given share of their
+	blocks alive are flagged. The GC pins the ones that are referenced conservatively, then the
+	live blocks of the others are copied to the remaining pages and the first word of each old
+	block is replaced by its new address, until the references are updated and the evacuated
+	pages are released.
+*/
+#define GC_COMPACT_CANDIDATE	1
+#define GC_COMPACT_MOVED		2
+
+static gc_pheader *gc_evacuated_pages = NULL;
+
+static int gc_allocator_compact_select( int percent, double *fragmentation ) {
+	int pid, count = 0;
+	int64 total = 0, total_live = 0;
+	for(pid=GC_FIXED_PARTS<<PAGE_KIND_BITS;pid<GC_LARGE_PART<<PAGE_KIND_BITS;pid++) {
+		gc_pheader *ph;
+		for(ph=gc_pages[pid];ph;ph=ph->next_page) {
+			gc_allocator_page_data *p = &ph->alloc;
+			int64 live = 0, size = (int64)(p->max_blocks - p->first_block) * p->block_size;
+			int bid = p->first_block;
+			p->compact = 0;
+			if( !ph->bmp ) continue;
+			while( bid < p->max_blocks ) {
+				int n = p->sizes[bid];
+				if( n == 0 ) {
+					bid++;
+					continue;
+				}
+				if( ph->bmp[bid>>3] & (1<<(bid&7)) )
+					live += n * p->block_size;
+				bid += n;
+			}
+			total += size;
+			total_live += live;
+			// finalizers are indexed by block : keep these pages
+			if( live > 0 && live * 100 < size * percent && ph->page_kind != MEM_KIND_FINALIZER ) {
+				p->compact = GC_COMPACT_CANDIDATE;
+				count++;
+			}
+		}
+	}
+	*fragmentation = total ? 1. - (double)total_live / (double)total : 0.;
+	return count;
+}
+
+static void gc_allocator_pin( gc_pheader *ph ) {
+	ph->alloc.compact = 0;
+}
+
+static int64 gc_allocator_compact() {
+	int pid;
+	int64 moved = 0;
+	gc_pheader *ph, *pages = NULL;
+	// detach the pages first, so the copies are not allocated there
+	for(pid=GC_FIXED_PARTS<<PAGE_KIND_BITS;pid<GC_LARGE_PART<<PAGE_KIND_BITS;pid++) {
+		gc_pheader *prev = NULL;
+		ph = gc_pages[pid];
+		while( ph ) {
+			gc_pheader *next = ph->next_page;
+			if( ph->alloc.compact ) {
+				if( prev )
+					prev->next_page = next;
+				else
+					gc_pages[pid] = next;
+				gc_pages_count[pid]--;
+				ph->alloc.compact = GC_COMPACT_MOVED;
+				ph->next_page = pages;
+				pages = ph;
+			} else
+				prev = ph;
+			ph = next;
+		}
+	}
+	gc_sweep_reset();
+	for(ph=pages;ph;ph=ph->next_page) {
+		gc_allocator_page_data *p = &ph->alloc;
+		int bid = p->first_block;
+		while( bid < p->max_blocks ) {
+			int n = p->sizes[bid];
+			if( n == 0 ) {
+				bid++;
+				continue;
+			}
+			if( ph->bmp[bid>>3] & (1<<(bid&7)) ) {
+				unsigned char *ptr = ph->base + bid * p->block_size;
+				int bsize = n * p->block_size;
+				int size = bsize;
+				unsigned char *copy = (unsigned char*)gc_allocator_alloc(&size, ph->page_kind);
+				gc_pheader *cp;
+				int cid;
+				if( copy == NULL ) hl_fatal("assert");
+				memcpy(copy, ptr, bsize);
+				if( size > bsize ) MZERO(copy + bsize, size - bsize);
+				// the copy is an old block : the next minor collection must not take it for a young one
+				cp = GC_GET_PAGE(copy);
+				cid = gc_allocator_get_block_id(cp, copy);
+				if( cp->bmp ) cp->bmp[cid>>3] |= 1<<(cid&7);
+				*(void**)ptr = copy;
+				moved += bsize;
+			}
+			bid += n;
+		}
+	}
+	gc_evacuated_pages = pages;
+	return moved;
+}
+
+static void *gc_allocator_forward( gc_pheader *ph, void *ptr ) {
+	void *block = ptr;
+	int bid;
+	if( ph->alloc.compact != GC_COMPACT_MOVED ) return NULL;
+	bid = gc_allocator_get_block_interior(ph, &block);
+	if( bid < 0 || (ph->bmp[bid>>3] & (1<<(bid&7))) == 0 ) return NULL;
+	return *(unsigned char**)block + ((unsigned char*)ptr - (unsigned char*)block);
+}
+
+static int64 gc_allocator_compact_end() {
+	int64 released = 0;
+	while( gc_evacuated_pages ) {
+		gc_pheader *ph = gc_evacuated_pages;
+		gc_evacuated_pages = ph->next_page;
+		released += ph->page_size;
+		free_freelist(&ph->alloc.free);
+		free(ph->alloc.finalizers);
+		gc_free_page(ph, ph->alloc.max_blocks);
+	}
+	return released;
+}
+
 static void gc_allocator_after_mark() {
-	gc_call_finalizers();
+	gc_queue_finalizers();
 #	ifdef GC_DEBUG
 	gc_clear_unmarked_mem();
 #	endif
-	gc_flush_empty_pages();
+	gc_sweep_large();
+	gc_sweep_reset();
 }
 
 static void gc_get_stats( int *page_count, int *private_data ) {
@@ -616,6 +961,28 @@ static void gc_iter_pages( gc_page_iterator iter ) {
 	}
 }
 
+static void gc_iter_live_range( gc_pheader *ph, int start, int end, gc_block_iterator iter ) {
+	gc_allocator_page_data *p = &ph->alloc;
+	int bid = start / p->block_size;
+	int last = (end + p->block_size - 1) / p->block_size;
+	if( last > p->max_blocks ) last = p->max_blocks;
+	if( bid >= last ) return;
+	// the first block might start before the range
+	if( p->sizes )
+		while( bid > p->first_block && p->sizes[bid] == 0 ) bid--;
+	if( bid < p->first_block ) bid = p->first_block;
+	while( bid < last ) {
+		int nblocks = p->sizes ? p->sizes[bid] : 1;
+		if( nblocks == 0 ) {
+			bid++;
+			continue;
+		}
+		if( ph->bmp[bid>>3] & (1<<(bid&7)) )
+			iter(ph->base + bid * p->block_size, nblocks * p->block_size);
+		bid += nblocks;
+	}
+}
+
 static void gc_iter_live_blocks( gc_pheader *ph, gc_block_iterator iter ) {
 	int i;
 	gc_allocator_page_data *p = &ph->alloc;
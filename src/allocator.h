@@ -23,6 +23,16 @@ typedef struct {
 	int max_blocks;
 	// mutable
 	gc_freelist free;
+	gc_pheader *next_free;
+	gc_pheader *prev_free;
+	fl_cursor free_run;
+	fl_cursor free_pos;
+	unsigned char free_bucket;
+	unsigned char compact;
+	// blocks of a finalizer page that have not been finalized yet
+	fl_cursor *finalizers;
+	int fin_count;
+	int fin_max;
 	unsigned char *sizes;
 	char sizes_ref[SIZES_PADDING];
 } gc_allocator_page_data;
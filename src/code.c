@@ -422,6 +422,17 @@ static int *hl_read_debug_infos( hl_reader *r, int nops ) {
 	return debug;
 }
 
+static uint64 code_digest( const unsigned char *data, int size ) {
+	// FNV-1a
+	uint64 h = 0xCBF29CE484222325ULL;
+	int i;
+	for(i=0;i<size;i++) {
+		h ^= data[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
 hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 	hl_reader _r = { data, size, 0, 0, NULL };	
 	hl_reader *r = &_r;
@@ -529,6 +540,7 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 			k->fields[j] = UINDEX();
 		CHK_ERROR();
 	}
+	c->digest = code_digest(data,size);
 	return c;
 }
 
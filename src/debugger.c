@@ -117,6 +117,14 @@ static void hl_debug_loop( hl_module *m ) {
 
 h_bool hl_module_debug( hl_module *m, int port, h_bool wait ) {
 	hl_socket *s;
+	// breakpoints are set in the baseline code : don't replace it
+	m->jit_threshold = 0;
+	if( m->jit_reserved ) {
+		// the debugger needs the code of all the functions
+		int i;
+		for(i=0;i<m->code->nfunctions;i++)
+			hl_module_compile(m, i);
+	}
 	hl_socket_init();
 	s = hl_socket_new(false);
 	if( s == NULL ) return false;
@@ -25,6 +25,12 @@
 #else
 #	include <sys/types.h>
 #	include <sys/mman.h>
+#	include <time.h>
+#endif
+#ifdef HL_LINUX
+#	include <sched.h>
+#	include <unistd.h>
+#	include <sys/syscall.h>
 #endif
 
 #if defined(HL_VCC)
@@ -84,13 +90,18 @@ static int_val gc_hash( void *ptr ) {
 #define GC_INTERIOR_POINTERS
 #define GC_PRECISE
 
+#if defined(HL_64) && (defined(HL_GCC) || defined(HL_CLANG)) && !defined(HL_CONSOLE)
+#	define GC_STACK_MAPS
+#endif
+
 #ifndef HL_THREADS
 #	define GC_MAX_MARK_THREADS 1
 #else
 #	ifndef GC_MAX_MARK_THREADS
-#	define GC_MAX_MARK_THREADS 4
+#	define GC_MAX_MARK_THREADS 64
 #	endif
 #endif
+#define GC_DEFAULT_MARK_THREADS	(GC_MAX_MARK_THREADS < 4 ? GC_MAX_MARK_THREADS : 4)
 
 #define out_of_memory(reason)		hl_fatal("Out of Memory (" reason ")")
 
@@ -118,10 +129,17 @@ int gc_allocator_get_block_id( gc_pheader *page, void *block );
 // Same as get_block_id but handles interior pointers and modify the block value
 int gc_allocator_get_block_id_interior( gc_pheader *page, void **block );
 
+// A page returned by gc_alloc_page is not in the page map until gc_publish_page is called :
+// the page data read by the functions above must be set before, since a concurrent mark can read it
+// as soon as the page is published
+
 // Called before marking starts: should update each page "bmp" with mark_bits
-void gc_allocator_before_mark( unsigned char *mark_bits );
+// If keep is set, the page previous marks should be copied into the new mark bits
+// While gc_mark_running is set, allocation should keep using the current free lists and
+// report each new block (or run of count fixed blocks) to gc_alloc_black
+void gc_allocator_before_mark( unsigned char *mark_bits, bool keep );
 
-// Called when marking ends: should call finalizers, sweep unused blocks and free empty pages
+// Called when marking ends: should queue finalizers (gc_finalize_push), sweep unused blocks and free empty pages
 void gc_allocator_after_mark();
 
 // Allocate a block with given size using the specified page kind.
@@ -130,11 +148,31 @@ void gc_allocator_after_mark();
 // Sets size to -1 if allocation refused (required size is invalid)
 void *gc_allocator_alloc( int *size, int page_kind );
 
+// Allocate a contiguous run of up to *count blocks of the same size, used for thread-local regions.
+// Returns NULL if blocks of this size/kind can't be allocated by runs
+// Sets size to the block size and count to the number of blocks in the run
+void *gc_allocator_alloc_run( int *size, int page_kind, int *count );
+
 // returns the number of pages allocated and private data size (global)
 void gc_get_stats( int *page_count, int *private_data);
 void gc_iter_pages( gc_page_iterator i );
 void gc_iter_live_blocks( gc_pheader *p, gc_block_iterator i );
 
+// iterate over the live blocks overlapping the [start,end[ bytes of the page
+void gc_iter_live_range( gc_pheader *p, int start, int end, gc_block_iterator i );
+
+// Compaction, called after a full mark while the world is stopped.
+// Flags the pages that have less than percent% of live blocks, returns their count and the free share of these page lists
+int gc_allocator_compact_select( int percent, double *fragmentation );
+// The page is referenced conservatively and must not be evacuated
+void gc_allocator_pin( gc_pheader *page );
+// Copies the live blocks of the flagged pages elsewhere, returns the bytes moved
+int64 gc_allocator_compact();
+// Returns the new address of a pointer into an evacuated block, or NULL
+void *gc_allocator_forward( gc_pheader *page, void *ptr );
+// Releases the evacuated pages once the references are updated, returns their size
+int64 gc_allocator_compact_end();
+
 #else
 #	include "allocator.h"
 #endif
@@ -143,8 +181,10 @@ struct _gc_pheader {
 	// const
 	unsigned char *base;
 	unsigned char *bmp;
+	unsigned char *cards;
 	int page_size;
 	int page_kind;
+	int numa_node;
 	gc_allocator_page_data alloc;
 	gc_pheader *next_page;
 #ifdef GC_DEBUG
@@ -163,14 +203,23 @@ struct _gc_pheader {
 #define GC_NO_THREADS	4
 #define GC_FORCE_MAJOR	8
 #define GC_PROFILE_MEM  16
+#define GC_GENERATIONAL	32
+#define GC_CONCURRENT	64
+#define GC_FINALIZER_THREAD	128
+#define GC_HUGE_PAGES	256
 
 static int gc_flags = 0;
+static bool gc_mark_running = false;
 static gc_pheader *gc_level1_null[1<<GC_LEVEL1_BITS] = {NULL};
 static gc_pheader **hl_gc_page_map[1<<GC_LEVEL0_BITS] = {NULL};
 static gc_pheader *gc_free_pheaders = NULL;
 
 static gc_pheader *gc_alloc_page( int size, int kind, int block_count );
+static void gc_publish_page( gc_pheader *p );
 static void gc_free_page( gc_pheader *page, int block_count );
+static void gc_region_release( hl_thread_info *t );
+static void gc_alloc_black( gc_pheader *page, void *ptr, int size, int bid, int count );
+static void gc_finalize_push( void *ptr );
 
 #ifndef GC_EXTERN_API
 #include "allocator.c"
@@ -178,7 +227,19 @@ static void gc_free_page( gc_pheader *page, int block_count );
 
 static hl_threads_info gc_threads;
 
+#if defined(HL_VCC)
+#	define MEMORY_FENCE()	MemoryBarrier()
+#else
+#	define MEMORY_FENCE()	__sync_synchronize()
+#endif
+
+#if defined(HL_LINUX) && defined(HL_64) && defined(HL_THREADS) && !defined(GC_DEBUG)
+// static TLS : the JIT code reads it at a fixed offset from the FS base, see hl_gc_thread_offset
+#	define GC_INLINE_ALLOC
+static __thread hl_thread_info *current_thread __attribute__((tls_model("initial-exec")));
+#else
 HL_THREAD_STATIC_VAR hl_thread_info *current_thread;
+#endif
 
 static struct {
 	int64 total_requested;
@@ -188,26 +249,56 @@ static struct {
 	int64 pages_total_memory;
 	int64 allocation_count;
 	int64 free_memory;
+	int64 pages_freed;
 	int pages_count;
 	int pages_allocated;
 	int pages_blocks;
+	int64 major_memory;
+	int64 live_memory;
 	int mark_bytes;
-	int mark_time;
+	int64 mark_time;
 	int mark_count;
-	int alloc_time; // only measured if gc_profile active
+	int minor_count;
+	int64 alloc_time; // only measured if gc_profile active
 } gc_stats = {0};
 
 static struct {
 	int64 total_allocated;
 	int64 allocation_count;
-	int alloc_time;
+	int64 alloc_time;
+	int64 pages_freed;
+	int64 finalize_time;
+	int64 finalize_total;
 } last_profile;
 
-#ifdef HL_WIN
-#	define TIMESTAMP() ((int)GetTickCount())
-#else
-#	define TIMESTAMP() 0
-#endif
+// monotonic time in nanoseconds
+static int64 gc_timestamp() {
+#	ifdef HL_WIN
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER t;
+	if( !freq.QuadPart ) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (t.QuadPart / freq.QuadPart) * 1000000000 + (t.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#	elif defined(HL_CONSOLE)
+	return 0;
+#	else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64)t.tv_sec * 1000000000 + t.tv_nsec;
+#	endif
+}
+
+#define TIMESTAMP() gc_timestamp()
+
+/*
+	Telemetry : each collection fills gc_event with its phase timings, which is then copied to
+	gc_last_event (see hl_gc_last_event) and written as a JSON line to the HL_GC_TRACE file.
+*/
+static hl_gc_event gc_event;
+static hl_gc_event gc_last_event;
+static FILE *gc_trace = NULL;
+static int64 gc_finalize_time = 0;
+static int64 gc_finalize_total = 0;
 
 // -------------------------  ROOTS ----------------------------------------------------------
 
@@ -222,6 +313,9 @@ HL_API hl_thread_info *hl_get_thread() {
 static void gc_save_context(hl_thread_info *t, void *prev_stack ) {
 	void *stack_cur = &t;
 	setjmp(t->gc_regs);
+#	ifdef GC_STACK_MAPS
+	t->stack_frame = __builtin_frame_address(0);
+#	endif
 	// some compilers (such as clang) might push/pop some callee registers in call
 	// to gc_save_context (or before) which might hold a gc value !
 	// let's capture them immediately in extra per-thread data
@@ -241,7 +335,24 @@ static void gc_save_context(hl_thread_info *t, void *prev_stack ) {
 
 #ifndef HL_THREADS
 #	define gc_global_lock(_)
+#	define gc_blocking_notify()
 #else
+/*
+	Stopping the world : the collector sets stopping_world then sleeps on gc_stopped until each
+	thread has gc_blocking > 0. A thread entering the blocking state wakes it up, either from an
+	allocation, an hl_blocking call or a safepoint poll emitted by the JIT in loops and function
+	entries. Both sides fence between their store and their load so one of them sees the other.
+*/
+static hl_condition *gc_stopped = NULL;
+
+static void gc_blocking_notify() {
+	MEMORY_FENCE();
+	if( !gc_threads.stopping_world ) return;
+	hl_condition_acquire(gc_stopped);
+	hl_condition_signal(gc_stopped);
+	hl_condition_release(gc_stopped);
+}
+
 static void gc_global_lock( bool lock ) {
 	hl_thread_info *t = current_thread;
 	bool mt = (gc_flags & GC_NO_THREADS) == 0;
@@ -250,7 +361,7 @@ static void gc_global_lock( bool lock ) {
 		if( !t )
 			hl_fatal("Can't lock GC in unregistered thread");
 		if( mt ) gc_save_context(t,&lock);
-		t->gc_blocking++;
+		if( t->gc_blocking++ == 0 && mt ) gc_blocking_notify();
 		if( mt ) hl_mutex_acquire(gc_threads.global_lock);
 	} else {
 		t->gc_blocking--;
@@ -280,6 +391,110 @@ HL_PRIM void hl_add_root( void *r ) {
 	gc_global_lock(false);
 }
 
+/*
+	Stack maps : the JIT registers, for each call site, which words of the caller
+	locals hold a pointer. Frames are found by following the frame pointer chain
+	and a JIT frame is only trusted if its frame pointer matches the recorded call
+	depth, everything else (native frames, outgoing arguments, traps) is still
+	scanned conservatively.
+*/
+#ifdef GC_STACK_MAPS
+typedef struct {
+	unsigned char *code;
+	int code_size;
+	int count;
+	hl_stack_map *maps;
+	unsigned int *bits;
+} gc_stack_region;
+
+static gc_stack_region *gc_stack_regions = NULL;
+static int gc_stack_regions_count = 0;
+static int gc_stack_regions_max = 0;
+
+static void gc_remove_stack_maps( void *code ) {
+	int i;
+	if( gc_stack_regions_count == 0 ) return;
+	gc_global_lock(true);
+	for(i=0;i<gc_stack_regions_count;i++)
+		if( gc_stack_regions[i].code == (unsigned char*)code ) {
+			free(gc_stack_regions[i].maps);
+			free(gc_stack_regions[i].bits);
+			gc_stack_regions_count--;
+			memmove(gc_stack_regions + i, gc_stack_regions + i + 1, (gc_stack_regions_count - i) * sizeof(gc_stack_region));
+			break;
+		}
+	gc_global_lock(false);
+}
+
+static hl_stack_map *gc_find_stack_map( void *ret, unsigned int **bits ) {
+	int min = 0, max = gc_stack_regions_count;
+	unsigned char *addr = (unsigned char*)ret;
+	gc_stack_region *r = NULL;
+	int pos;
+	while( min < max ) {
+		int mid = (min + max) >> 1;
+		gc_stack_region *m = gc_stack_regions + mid;
+		if( addr < m->code )
+			max = mid;
+		else if( addr >= m->code + m->code_size )
+			min = mid + 1;
+		else {
+			r = m;
+			break;
+		}
+	}
+	if( !r ) return NULL;
+	// maps are emitted in code order
+	pos = (int)(addr - r->code);
+	min = 0;
+	max = r->count;
+	while( min < max ) {
+		int mid = (min + max) >> 1;
+		hl_stack_map *m = r->maps + mid;
+		if( pos < m->ret )
+			max = mid;
+		else if( pos > m->ret )
+			min = mid + 1;
+		else {
+			*bits = r->bits;
+			return m;
+		}
+	}
+	return NULL;
+}
+#endif
+
+HL_PRIM void hl_gc_add_stack_maps( void *code, int code_size, hl_stack_map *maps, int count, unsigned int *bits, int nbits ) {
+#	ifdef GC_STACK_MAPS
+	gc_stack_region *r;
+	int pos;
+	if( count == 0 ) return;
+	gc_global_lock(true);
+	if( gc_stack_regions_count == gc_stack_regions_max ) {
+		int nmax = gc_stack_regions_max ? (gc_stack_regions_max << 1) : 8;
+		gc_stack_region *regs = (gc_stack_region*)malloc(sizeof(gc_stack_region) * nmax);
+		memcpy(regs,gc_stack_regions,sizeof(gc_stack_region) * gc_stack_regions_count);
+		free(gc_stack_regions);
+		gc_stack_regions = regs;
+		gc_stack_regions_max = nmax;
+	}
+	// keep sorted by code address
+	pos = gc_stack_regions_count;
+	while( pos > 0 && gc_stack_regions[pos-1].code > (unsigned char*)code ) pos--;
+	memmove(gc_stack_regions + pos + 1, gc_stack_regions + pos, (gc_stack_regions_count - pos) * sizeof(gc_stack_region));
+	r = gc_stack_regions + pos;
+	r->code = (unsigned char*)code;
+	r->code_size = code_size;
+	r->count = count;
+	r->maps = (hl_stack_map*)malloc(sizeof(hl_stack_map) * count);
+	r->bits = (unsigned int*)malloc(sizeof(int) * ((nbits + 31) >> 5));
+	memcpy(r->maps,maps,sizeof(hl_stack_map) * count);
+	memcpy(r->bits,bits,sizeof(int) * ((nbits + 31) >> 5));
+	gc_stack_regions_count++;
+	gc_global_lock(false);
+#	endif
+}
+
 HL_PRIM void hl_remove_root( void *v ) {
 	int i;
 	gc_global_lock(true);
@@ -336,6 +551,7 @@ HL_API void hl_unregister_thread() {
 	hl_remove_root(&t->exc_value);
 	hl_remove_root(&t->exc_handler);
 	gc_global_lock(true);
+	gc_region_release(t);
 	for(i=0;i<gc_threads.count;i++)
 		if( gc_threads.threads[i] == t ) {
 			memmove(gc_threads.threads + i, gc_threads.threads + i + 1, sizeof(void*) * (gc_threads.count - i - 1));
@@ -357,10 +573,14 @@ static void gc_stop_world( bool b ) {
 	if( b ) {
 		int i;
 		gc_threads.stopping_world = true;
+		MEMORY_FENCE();
+		hl_condition_acquire(gc_stopped);
 		for(i=0;i<gc_threads.count;i++) {
 			hl_thread_info *t = gc_threads.threads[i];
-			while( t->gc_blocking == 0 ) {}; // spinwait
+			while( t->gc_blocking == 0 )
+				hl_condition_wait(gc_stopped);
 		}
+		hl_condition_release(gc_stopped);
 	} else {
 		// releasing global lock will release all threads
 		gc_threads.stopping_world = false;
@@ -392,7 +612,84 @@ static void *gc_will_collide( void *p, int size ) {
 }
 
 static void gc_free_page_memory( void *ptr, int page_size );
+static void gc_release_page_memory( void *ptr, int page_size );
+static bool gc_retain_page( void *base, int size );
+static void *gc_retained_alloc( int size );
+static int64 gc_decommit_idle( bool all );
+static int gc_decommit_delay = -1;
+static int64 gc_heap_limit = 0;
+static int64 gc_retained_memory = 0;
+static hl_mutex *gc_release_lock = NULL;
+static hl_semaphore *gc_release_ready = NULL;
+static void **gc_finalize_queue = NULL;
+static int gc_finalize_count = 0;
+static int gc_finalize_max = 0;
+static hl_mutex *gc_finalize_lock = NULL;
+static hl_semaphore *gc_finalize_ready = NULL;
+static void gc_run_finalizers();
+
+static void gc_finalize_pending() {
+	if( gc_finalize_count && gc_finalize_ready == NULL )
+		gc_run_finalizers();
+}
 static void *gc_alloc_page_memory( int size );
+static int gc_arena_node( void *ptr );
+static void gc_numa_init();
+static void gc_numa_run_on( int node );
+static int gc_numa_nodes = 0;
+
+// pages allocated during a concurrent mark are all black : their bmp is kept until the next mark
+static unsigned char **gc_black_bmps = NULL;
+static int gc_black_count = 0;
+static int gc_black_max = 0;
+
+static unsigned char *gc_alloc_black_bmp( int block_count ) {
+	int bytes = (block_count + 7) >> 3;
+	unsigned char *bmp = (unsigned char*)malloc(bytes);
+	if( bmp == NULL ) out_of_memory("markbits");
+	memset(bmp, 0xFF, bytes);
+	if( gc_black_count == gc_black_max ) {
+		int nmax = gc_black_max ? (gc_black_max << 1) : 16;
+		unsigned char **all = (unsigned char**)malloc(sizeof(void*) * nmax);
+		memcpy(all, gc_black_bmps, sizeof(void*) * gc_black_count);
+		free(gc_black_bmps);
+		gc_black_bmps = all;
+		gc_black_max = nmax;
+	}
+	gc_black_bmps[gc_black_count++] = bmp;
+	return bmp;
+}
+
+// -------------------------  CARDS ----------------------------------------------------------
+
+/*
+	In generational or concurrent mode, each page has one card byte per 2^GC_CARD_BITS bytes of memory.
+	The JIT and the runtime call hl_gc_write_barrier after storing a pointer into a GC block,
+	which dirties the card of the written address. A minor collection only keeps the marks of
+	the previous collection and rescans the live blocks overlapping dirty cards, so it only
+	has to trace the blocks allocated since then. A concurrent mark uses them the same way to find
+	what was modified while it was tracing.
+*/
+
+#define GC_CARD_BITS	9
+
+static bool gc_cards_enabled = false;
+static int gc_nursery_size = 16 << 20;
+static int64 gc_marked_bytes = 0;
+static int64 gc_marked_objects = 0;
+
+static void gc_alloc_cards( gc_pheader *p, int size ) {
+	int ncards = p->page_size >> GC_CARD_BITS;
+	p->cards = (unsigned char*)malloc(ncards);
+	if( p->cards == NULL ) out_of_memory("cards");
+	MZERO(p->cards,ncards);
+}
+
+HL_API void hl_gc_write_barrier( void *ptr ) {
+	gc_pheader *page = GC_GET_PAGE(ptr);
+	if( page && page->cards && INPAGE(ptr,page) )
+		page->cards[((unsigned char*)ptr - page->base) >> GC_CARD_BITS] = 1;
+}
 
 static gc_pheader *gc_alloc_page( int size, int kind, int block_count ) {
 	unsigned char *base = (unsigned char*)gc_alloc_page_memory(size);
@@ -451,7 +748,9 @@ static gc_pheader *gc_alloc_page( int size, int kind, int block_count ) {
 		hl_fatal("Page memory is not correctly aligned");
 	p->page_size = size;
 	p->page_kind = kind;
-	p->bmp = NULL;
+	p->numa_node = gc_arena_node(base);
+	p->bmp = gc_mark_running ? gc_alloc_black_bmp(block_count) : NULL;
+	if( gc_cards_enabled ) gc_alloc_cards(p, 0);
 
 	// update stats
 	gc_stats.pages_count++;
@@ -459,20 +758,24 @@ static gc_pheader *gc_alloc_page( int size, int kind, int block_count ) {
 	gc_stats.pages_blocks += block_count;
 	gc_stats.pages_total_memory += size;
 	gc_stats.mark_bytes += (block_count + 7) >> 3;
+	return p;
+}
 
-	// register page in page map
+// register the page in the page map, once the allocator has set its data
+static void gc_publish_page( gc_pheader *p ) {
 	int i;
-	for(i=0;i<size>>GC_MASK_BITS;i++) {
+	// the mark threads might read the page as soon as it is found in the map
+	if( gc_mark_running ) MEMORY_FENCE();
+	for(i=0;i<p->page_size>>GC_MASK_BITS;i++) {
 		void *ptr = p->base + (i<<GC_MASK_BITS);
 		if( GC_GET_LEVEL1(ptr) == gc_level1_null ) {
 			gc_pheader **level = (gc_pheader**)malloc(sizeof(void*) * (1<<GC_LEVEL1_BITS));
 			MZERO(level,sizeof(void*) * (1<<GC_LEVEL1_BITS));
+			if( gc_mark_running ) MEMORY_FENCE();
 			GC_GET_LEVEL1(ptr) = level;
 		}
 		GC_GET_PAGE(ptr) = p;
 	}
-
-	return p;
 }
 
 static void gc_free_page( gc_pheader *ph, int block_count ) {
@@ -482,29 +785,106 @@ static void gc_free_page( gc_pheader *ph, int block_count ) {
 		GC_GET_PAGE(ptr) = NULL;
 	}
 	gc_stats.pages_count--;
+	gc_stats.pages_freed++;
 	gc_stats.pages_blocks -= block_count;
 	gc_stats.pages_total_memory -= ph->page_size;
 	gc_stats.mark_bytes -= (block_count + 7) >> 3;
-	gc_free_page_memory(ph->base,ph->page_size);
+	free(ph->cards);
+	gc_release_page_memory(ph->base,ph->page_size);
 	ph->next_page = gc_free_pheaders;
 	gc_free_pheaders = ph;
 }
 
 static void gc_check_mark();
 
+// -------------------------  THREAD REGIONS ----------------------------------------------------------
+
+/*
+	Each thread owns one allocation region per (page kind, small size class). A region is a run
+	of free blocks reserved from a fixed-size page, so allocating from it is a pointer bump that
+	does not need the global lock. Regions are only refilled under the lock, and are released
+	before each mark so the unused blocks are swept back into the page freelists.
+*/
+
+#define GC_REGION_CLASSES	HL_GC_REGION_WORDS
+#define GC_REGION_BYTES		4096
+#define GC_REGION_INDEX(kind,size)	((kind) * GC_REGION_CLASSES + ((size) / HL_WSIZE) - 1)
+
+static void gc_region_release( hl_thread_info *t ) {
+	int i;
+	for(i=0;i<HL_GC_REGIONS;i++) {
+		hl_gc_region *r = t->gc_regions + i;
+		if( r->cur < r->end ) {
+			int bsize = ((i % GC_REGION_CLASSES) + 1) * HL_WSIZE;
+			int left = (int)(r->end - r->cur);
+			gc_stats.total_allocated -= left;
+			gc_stats.total_requested -= left;
+			gc_stats.allocation_count -= left / bsize;
+		}
+		r->cur = NULL;
+		r->end = NULL;
+	}
+}
+
+static void *gc_region_alloc( int size, int kind, int *allocated ) {
+	hl_thread_info *t = current_thread;
+	int rsize = (size + HL_WSIZE - 1) & ~(HL_WSIZE - 1);
+	// the JIT code bumps the regions without tracking : don't refill them while we track
+	if( !t || rsize > GC_REGION_CLASSES * HL_WSIZE || kind == MEM_KIND_FINALIZER || (gc_flags & GC_FORCE_MAJOR) || hl_is_tracking(HL_TRACK_ALLOC) )
+		return NULL;
+	hl_gc_region *r = t->gc_regions + GC_REGION_INDEX(kind,rsize);
+	unsigned char *ptr = r->cur;
+	*allocated = rsize;
+	// a blocking thread might run concurrently with the collector : it needs to go through the lock
+	if( r->end - ptr >= rsize && t->gc_blocking == 0 && !gc_threads.stopping_world ) {
+		r->cur = ptr + rsize;
+		return ptr;
+	}
+	gc_global_lock(true);
+	gc_check_mark();
+	if( r->end - r->cur < rsize ) {
+		int bsize = rsize;
+		int count = GC_REGION_BYTES / rsize;
+		ptr = (unsigned char*)gc_allocator_alloc_run(&bsize, kind, &count);
+		if( ptr == NULL ) {
+			gc_global_lock(false);
+			return NULL;
+		}
+#		ifdef GC_DEBUG
+		if( bsize != rsize ) hl_fatal("assert");
+#		endif
+		r->cur = ptr;
+		r->end = ptr + count * rsize;
+		gc_stats.allocation_count += count;
+		gc_stats.total_requested += count * rsize;
+		gc_stats.total_allocated += count * rsize;
+	}
+	ptr = r->cur;
+	r->cur += rsize;
+	gc_global_lock(false);
+	return ptr;
+}
+
+// -------------------------  ALLOCATION ----------------------------------------------------------
+
 void *hl_gc_alloc_gen( hl_type *t, int size, int flags ) {
 	void *ptr;
-	int time = 0;
+	int64 time = 0;
 	int allocated = 0;
 	if( size == 0 )
 		return NULL;
 	if( size < 0 )
 		hl_error("Invalid allocation size");
-	gc_global_lock(true);
-	gc_check_mark();
 #	ifdef GC_MEMCHK
 	size += HL_WSIZE;
 #	endif
+	// finalizers queued by a previous collection run before any block is reserved :
+	// they can allocate and collect, which must not see a block that is not initialized yet
+	gc_finalize_pending();
+	ptr = gc_region_alloc(size, flags & PAGE_KIND_MASK, &allocated);
+	if( ptr ) goto init_block;
+	gc_global_lock(true);
+	gc_check_mark();
 	if( gc_flags & GC_PROFILE ) time = TIMESTAMP();
 	{
 		allocated = size;
@@ -546,6 +926,8 @@ void *hl_gc_alloc_gen( hl_type *t, int size, int flags ) {
 		gc_stats.total_allocated += allocated;
 	}
 	if( gc_flags & GC_PROFILE ) gc_stats.alloc_time += TIMESTAMP() - time;
+	gc_global_lock(false);
+init_block:
 #	ifdef GC_DEBUG
 	memset(ptr,0xCD,allocated);
 #	endif
@@ -556,7 +938,6 @@ void *hl_gc_alloc_gen( hl_type *t, int size, int flags ) {
 #	ifdef GC_MEMCHK
 	memset((char*)ptr+(allocated - HL_WSIZE),0xEE,HL_WSIZE);
 #	endif
-	gc_global_lock(false);
 	hl_track_call(HL_TRACK_ALLOC, on_alloc(t,size,flags,ptr));
 	return ptr;
 }
@@ -569,21 +950,48 @@ typedef struct {
 	int size;
 } gc_mstack;
 
+/*
+	Each mark thread traces from its private mark stack. When some threads are starving, it moves
+	its oldest entries (the roots of the largest unexplored subgraphs) into its bounded Chase-Lev
+	deque. A thread out of work pops its own deque then steals from the top of the others, and the
+	mark ends once all the threads are idle, which can only happen when all the deques are empty.
+*/
+
+#define GC_DEQUE_BITS	12
+#define GC_DEQUE_MASK	((1 << GC_DEQUE_BITS) - 1)
+#define GC_SHARE_PERIOD	256
+#define GC_STEAL_MAX	64
+
+typedef struct {
+	volatile int_val top;
+	volatile int_val bottom;
+	void *items[1 << GC_DEQUE_BITS];
+} gc_deque;
+
 typedef struct {
 	gc_mstack stack;
+	gc_deque *deque;
 	hl_semaphore *ready;
 	int mark_count;
+	int64 marked_bytes;
+	int64 marked_objects;
+	int64 mark_time;
 	hl_thread *tid;
 } gc_mthread;
 
 static float gc_mark_threshold = 0.2f;
 static int mark_size = 0;
 static unsigned char *mark_data = NULL;
+static int mark_size_prev = 0;
+static unsigned char *mark_data_prev = NULL;
 static gc_mstack global_mark_stack = {0};
-static int gc_mark_threads = GC_MAX_MARK_THREADS;
+static int gc_mark_threads = GC_DEFAULT_MARK_THREADS;
 static gc_mthread mark_threads[GC_MAX_MARK_THREADS] = {0};
-static unsigned char mark_threads_active = 0;
+static int mark_threads_active = 0;
+static int mark_threads_idle = 0;
+static int mark_threads_parked = 0;
 static hl_semaphore *mark_threads_done;
+static hl_semaphore *mark_threads_wake;
 
 #define GC_STACK_BEGIN(st) register void **__current_stack = (st)->cur; gc_mstack *__current_mstack = st;
 #define GC_STACK_END() __current_mstack->cur = __current_stack;
@@ -621,85 +1029,237 @@ HL_PRIM void **hl_gc_mark_grow( gc_mstack *stack ) {
 	return stack->cur;
 }
 
-static bool atomic_bit_unset( unsigned char *addr, unsigned char bitmask ) {
+static bool atomic_bit_set( unsigned char *addr, unsigned char bitmask ) {
 	if( GC_MAX_MARK_THREADS <= 1 ) {
 		unsigned char v = *addr;
-		bool b = (v & bitmask) != 0;
-		if( b ) *addr = v & ~bitmask;
+		bool b = (v & bitmask) == 0;
+		if( b ) *addr = v | bitmask;
 		return b;
 	}
 #	if defined(HL_VCC)
-	return ((unsigned)InterlockedAnd8((char*)addr,(char)~bitmask) & bitmask) != 0;
+	return ((unsigned)InterlockedOr8((char*)addr,(char)bitmask) & bitmask) == 0;
 #	elif defined(HL_CLANG) || defined(HL_GCC)
-	return (__sync_fetch_and_and(addr,~bitmask) & bitmask) != 0;
+	return (__sync_fetch_and_or(addr,bitmask) & bitmask) == 0;
 #	else
 	hl_fatal("Not implemented");
 	return false;
 #	endif
 }
 
-static bool atomic_bit_set( unsigned char *addr, unsigned char bitmask ) {
-	if( GC_MAX_MARK_THREADS <= 1 ) {
-		unsigned char v = *addr;
-		bool b = (v & bitmask) == 0;
-		if( b ) *addr = v | bitmask;
-		return b;
-	}
+static int atomic_add( int *addr, int delta ) {
 #	if defined(HL_VCC)
-	return ((unsigned)InterlockedOr8((char*)addr,(char)bitmask) & bitmask) == 0;
+	return InterlockedExchangeAdd((long volatile*)addr,delta) + delta;
 #	elif defined(HL_CLANG) || defined(HL_GCC)
-	return (__sync_fetch_and_or(addr,bitmask) & bitmask) == 0;
+	return __sync_add_and_fetch(addr,delta);
+#	else
+	hl_fatal("Not implemented");
+	return 0;
+#	endif
+}
+
+static bool atomic_cas( volatile int_val *addr, int_val old, int_val v ) {
+#	if defined(HL_VCC) && defined(HL_64)
+	return InterlockedCompareExchange64((__int64 volatile*)addr,v,old) == old;
+#	elif defined(HL_VCC)
+	return InterlockedCompareExchange((long volatile*)addr,v,old) == old;
+#	elif defined(HL_CLANG) || defined(HL_GCC)
+	return __sync_bool_compare_and_swap(addr,old,v);
 #	else
 	hl_fatal("Not implemented");
 	return false;
 #	endif
 }
 
-static void gc_dispatch_mark( gc_mstack *st, bool all ) {
-	int nthreads = 0;
+static void gc_alloc_black( gc_pheader *page, void *ptr, int size, int bid, int count ) {
 	int i;
-	if( mark_threads_active == (1<<gc_mark_threads) - 1 )
-		return;
-	for(i=0;i<gc_mark_threads;i++)
-		if( (mark_threads_active&(1<<i)) == 0 )
-			nthreads++;
-	if( nthreads == 0 )
-		return;
-	int count = all ? (GC_STACK_COUNT(st) + nthreads - 1) / nthreads : GC_STACK_COUNT(st) / (nthreads + 1);
-	if( count == 0 )
+	// the mark threads might be setting bits of the same bytes
+	for(i=bid;i<bid+count;i++)
+		atomic_bit_set(&page->bmp[i>>3],1<<(i&7));
+	if( page->cards ) {
+		int start = (int)((unsigned char*)ptr - page->base);
+		memset(page->cards + (start >> GC_CARD_BITS), 1, ((start + size - 1) >> GC_CARD_BITS) - (start >> GC_CARD_BITS) + 1);
+	}
+}
+
+static int gc_deque_push( gc_deque *d, void **items, int count ) {
+	int_val b = d->bottom;
+	int i, avail = (int)(GC_DEQUE_MASK + 1 - (b - d->top));
+	if( count > avail ) count = avail;
+	for(i=0;i<count;i++)
+		d->items[(b + i) & GC_DEQUE_MASK] = items[i];
+	// publish the whole batch at once
+	MEMORY_FENCE();
+	d->bottom = b + count;
+	return count;
+}
+
+static void *gc_deque_pop( gc_deque *d ) {
+	int_val b = d->bottom - 1;
+	int_val t;
+	void *v;
+	d->bottom = b;
+	MEMORY_FENCE();
+	t = d->top;
+	if( t > b ) {
+		d->bottom = b + 1;
+		return NULL;
+	}
+	v = d->items[b & GC_DEQUE_MASK];
+	if( t == b ) {
+		// last item : a thief might be taking it
+		if( !atomic_cas(&d->top, t, t + 1) )
+			v = NULL;
+		d->bottom = b + 1;
+	}
+	return v;
+}
+
+static void *gc_deque_steal( gc_deque *d ) {
+	int_val t = d->top;
+	MEMORY_FENCE();
+	int_val b = d->bottom;
+	if( t >= b )
+		return NULL;
+	void *v = d->items[t & GC_DEQUE_MASK];
+	if( !atomic_cas(&d->top, t, t + 1) )
+		return NULL;
+	return v;
+}
+
+static void gc_mark_wake( int count ) {
+	while( count-- > 0 )
+		hl_semaphore_release(mark_threads_wake);
+}
+
+static void gc_share_mark( gc_mthread *t ) {
+	gc_mstack *st = &t->stack;
+	int count = GC_STACK_COUNT(st) >> 1;
+	// keep small stacks : waking a parked thread costs more than marking them
+	if( count < GC_STEAL_MAX || t->deque->top < t->deque->bottom )
 		return;
+	// share the oldest half of the stack, it is more likely to lead to large subgraphs
+	count = gc_deque_push(t->deque, st->end - st->size + 1, count);
+	st->cur -= count;
+	memmove(st->end - st->size + 1, st->end - st->size + 1 + count, GC_STACK_COUNT(st) * sizeof(void*));
+	// each thief takes up to GC_STEAL_MAX blocks
+	count = count / GC_STEAL_MAX + 1;
+	gc_mark_wake(count < mark_threads_parked ? count : mark_threads_parked);
+}
+
+static bool gc_steal_mark( gc_mthread *t ) {
+	int index = (int)(t - mark_threads);
+	int i, count = 0;
+	void *v;
+	// take back what was not stolen yet
+	while( count < GC_STEAL_MAX && (v = gc_deque_pop(t->deque)) != NULL ) {
+		if( t->stack.cur == t->stack.end )
+			hl_gc_mark_grow(&t->stack);
+		*t->stack.cur++ = v;
+		count++;
+	}
+	if( count )
+		return true;
+	for(i=1;i<gc_mark_threads && !count;i++) {
+		gc_deque *d = mark_threads[(index + i) % gc_mark_threads].deque;
+		// take up to half of the victim queue so we don't come back for each small block
+		int max = (int)((d->bottom - d->top + 1) >> 1);
+		if( max > GC_STEAL_MAX ) max = GC_STEAL_MAX;
+		while( count < max && (v = gc_deque_steal(d)) != NULL ) {
+			if( t->stack.cur == t->stack.end )
+				hl_gc_mark_grow(&t->stack);
+			*t->stack.cur++ = v;
+			count++;
+		}
+	}
+	return count > 0;
+}
+
+static bool gc_mark_has_work() {
+	int i;
 	for(i=0;i<gc_mark_threads;i++) {
-		gc_mthread *t = &mark_threads[i];
-		if( !atomic_bit_set(&mark_threads_active,1<<i) )
+		gc_deque *d = mark_threads[i].deque;
+		if( d->top < d->bottom )
+			return true;
+	}
+	return false;
+}
+
+static bool gc_mark_terminate() {
+	int spins = 0;
+	if( atomic_add(&mark_threads_idle, 1) == gc_mark_threads ) {
+		// we are the last one : the parked threads need to leave as well
+		gc_mark_wake(mark_threads_parked);
+		return true;
+	}
+	while( mark_threads_idle < gc_mark_threads ) {
+		if( gc_mark_has_work() ) {
+			atomic_add(&mark_threads_idle, -1);
+			return false;
+		}
+		if( ++spins < 16 ) {
+			hl_thread_yield();
 			continue;
+		}
+		// sleep until some work is shared or the mark ends (checked again after we are counted as parked)
+		atomic_add(&mark_threads_parked, 1);
+		if( mark_threads_idle < gc_mark_threads && !gc_mark_has_work() )
+			hl_semaphore_acquire(mark_threads_wake);
+		atomic_add(&mark_threads_parked, -1);
+		spins = 0;
+	}
+	return true;
+}
+
+static void gc_dispatch_mark( gc_mstack *st ) {
+	int i;
+	// nothing was pushed yet (no roots)
+	if( st->size == 0 ) hl_gc_mark_grow(st);
+	int count = (GC_STACK_COUNT(st) + gc_mark_threads - 1) / gc_mark_threads;
+	mark_threads_idle = 0;
+	mark_threads_active = gc_mark_threads;
+	if( gc_numa_nodes > 1 ) {
+		// mark thread i runs on node i % gc_numa_nodes : start it with the blocks of its node
+		int next[GC_MAX_MARK_THREADS] = {0};
+		int rr = 0;
+		while( GC_STACK_COUNT(st) > 0 ) {
+			void *b = *--st->cur;
+			int node = GC_GET_PAGE(b)->numa_node;
+			if( node < 0 || node >= gc_mark_threads ) node = rr++ % gc_mark_threads;
+			int tid = node + gc_numa_nodes * next[node];
+			if( tid >= gc_mark_threads ) {
+				tid = node;
+				next[node] = 0;
+			}
+			next[node]++;
+			gc_mstack *ts = &mark_threads[tid].stack;
+			if( ts->cur == ts->end )
+				hl_gc_mark_grow(ts);
+			*ts->cur++ = b;
+		}
+	}
+	for(i=0;i<gc_mark_threads;i++) {
+		gc_mthread *t = &mark_threads[i];
 		int push = GC_STACK_COUNT(st);
 		if( push > count ) push = count;
-		while( t->stack.size <= push )
+		while( t->stack.size <= push + GC_STACK_COUNT(&t->stack) )
 			hl_gc_mark_grow(&t->stack);
-		if( GC_STACK_COUNT(&t->stack) != 0 )
+		if( t->deque->top != t->deque->bottom )
 			hl_fatal("assert");
 		st->cur -= push;
 		memcpy(t->stack.cur, st->cur, push * sizeof(void*));
 		t->stack.cur += push;
-		if( !all )
-			hl_semaphore_release(t->ready);
-	}
-	if( all ) {
-		if( nthreads != gc_mark_threads ) hl_fatal("assert");
-		for(i=0;i<gc_mark_threads;i++) {
-			gc_mthread *t = &mark_threads[i];
-			hl_semaphore_release(t->ready);
-		}
+		t->deque->top = t->deque->bottom = 0;
 	}
+	for(i=0;i<gc_mark_threads;i++)
+		hl_semaphore_release(mark_threads[i].ready);
 }
 
-#define REGULAR_BITS 16
-
-static int gc_flush_mark( gc_mstack *stack ) {
+static int gc_flush_mark( gc_mstack *stack, gc_mthread *self ) {
 	GC_STACK_BEGIN(stack);
 	if( !__current_stack ) return 0;
 	int count = 0;
-	int regular_mask = 1 << REGULAR_BITS;
+	int64 marked = 0;
+	int objects = 0;
 	while( true ) {
 		void **block = (void**)*--__current_stack;
 		gc_pheader *page = GC_GET_PAGE(block);
@@ -713,10 +1273,9 @@ static int gc_flush_mark( gc_mstack *stack ) {
 			__current_stack++;
 			break;
 		}
-		if( (count++ & (1 << REGULAR_BITS)) != regular_mask && GC_MAX_MARK_THREADS > 1 && gc_mark_threads > 1 ) {
-			regular_mask = regular_mask ? 0 : 1 << REGULAR_BITS;
+		if( (count++ & (GC_SHARE_PERIOD - 1)) == 0 && self && mark_threads_parked ) {
 			GC_STACK_END();
-			gc_dispatch_mark(stack,false);
+			gc_share_mark(self);
 			GC_STACK_RESUME();
 		}
 		int size = gc_allocator_fast_block_size(page, block);
@@ -761,12 +1320,21 @@ static int gc_flush_mark( gc_mstack *stack ) {
 			if( !page || !INPAGE(p,page) ) continue;
 			int bid = gc_allocator_get_block_id(page,p);
 			if( bid >= 0 && atomic_bit_set(&page->bmp[bid>>3],1<<(bid&7)) ) {
+				marked += gc_allocator_fast_block_size(page, p);
+				objects++;
 				if( MEM_HAS_PTR(page->page_kind) ) DRAM_PREFETCH(p);
 				GC_PUSH_GEN(p,page);
 			}
 		}
 	}
 	GC_STACK_END();
+	if( self ) {
+		self->marked_bytes += marked;
+		self->marked_objects += objects;
+	} else {
+		gc_marked_bytes += marked;
+		gc_marked_objects += objects;
+	}
 	return count;
 }
 
@@ -782,30 +1350,47 @@ static void gc_mark_stack( void *start, void *end ) {
 #		else
 		int bid = gc_allocator_get_block_id(page, p);
 #		endif
-		if( bid >= 0 && (page->bmp[bid>>3] & (1<<(bid&7))) == 0 ) {
+		if( bid < 0 ) continue;
+		// native code can store into a block it holds without a barrier after it got promoted
+		if( page->cards ) page->cards[((unsigned char*)p - page->base) >> GC_CARD_BITS] = 1;
+		if( (page->bmp[bid>>3] & (1<<(bid&7))) == 0 ) {
 			page->bmp[bid>>3] |= 1<<(bid&7);
+			gc_marked_bytes += gc_allocator_fast_block_size(page, p);
+			gc_marked_objects++;
 			GC_PUSH_GEN(p,page);
 		}
 	}
 	GC_STACK_END();
 }
 
-static void gc_mark() {
+static void gc_push_live_block( void *block, int size ) {
 	GC_STACK_BEGIN(&global_mark_stack);
-	int mark_bytes = gc_stats.mark_bytes;
-	int i;
-	// prepare mark bits
-	if( mark_bytes > mark_size ) {
-		gc_free_page_memory(mark_data, mark_size);
-		if( mark_size == 0 ) mark_size = GC_PAGE_SIZE;
-		while( mark_size < mark_bytes )
-			mark_size <<= 1;
-		mark_data = gc_alloc_page_memory(mark_size);
-		if( mark_data == NULL ) out_of_memory("markbits");
+	gc_pheader *page = GC_GET_PAGE(block);
+	GC_PUSH_GEN(block,page);
+	GC_STACK_END();
+}
+
+static void gc_mark_cards( gc_pheader *page, int size ) {
+	unsigned char *cards = page->cards;
+	int i, ncards;
+	if( !cards ) return;
+	ncards = page->page_size >> GC_CARD_BITS;
+	for(i=0;i<ncards;i++) {
+		if( !cards[i] ) continue;
+		int start = i;
+		while( i + 1 < ncards && cards[i+1] ) i++;
+		gc_iter_live_range(page, start << GC_CARD_BITS, (i + 1) << GC_CARD_BITS, gc_push_live_block);
 	}
-	MZERO(mark_data,mark_bytes);
-	gc_allocator_before_mark(mark_data);
-	// push roots
+	MZERO(cards,ncards);
+}
+
+static void gc_clear_cards( gc_pheader *page, int size ) {
+	if( page->cards ) MZERO(page->cards, page->page_size >> GC_CARD_BITS);
+}
+
+static void gc_push_roots() {
+	GC_STACK_BEGIN(&global_mark_stack);
+	int i;
 	for(i=0;i<gc_roots_count;i++) {
 		void *p = *gc_roots[i];
 		gc_pheader *page;
@@ -818,41 +1403,443 @@ static void gc_mark() {
 			GC_PUSH_GEN(p,page);
 		}
 	}
-
 	GC_STACK_END();
+	// blocks waiting for their finalizer
+	gc_mark_stack(gc_finalize_queue, gc_finalize_queue + gc_finalize_count);
+}
+
+static void gc_mark_thread_stack( hl_thread_info *t ) {
+	void **cur = (void**)t->stack_cur;
+	void **top = (void**)t->stack_top;
+#	ifdef GC_STACK_MAPS
+	void **fp = (void**)t->stack_frame;
+	while( gc_stack_regions_count && fp >= cur && fp + 2 <= top && ((int_val)fp & (sizeof(void*) - 1)) == 0 ) {
+		void **next = (void**)fp[0];
+		unsigned int *bits;
+		hl_stack_map *m;
+		if( next <= fp || next > top ) break;
+		m = gc_find_stack_map(fp[1], &bits);
+		if( m && (char*)next == (char*)(fp + 2) + m->depth && m->depth >= m->locals ) {
+			void **locals = (void**)((char*)next - m->locals);
+			int i, n = m->locals / sizeof(void*);
+			gc_mark_stack(cur, locals);
+			for(i=0;i<n;i++) {
+				int start = i;
+				while( i < n ) {
+					int b = m->bits + i;
+					if( !(bits[b >> 5] & (1u << (b & 31))) ) break;
+					i++;
+				}
+				if( i > start ) gc_mark_stack(locals + start, locals + i);
+			}
+			cur = next;
+		}
+		fp = next;
+	}
+#	endif
+	gc_mark_stack(cur, top);
+}
 
-	// scan threads stacks & registers
+static void **gc_regs_end( hl_thread_info *t ) {
+	// the registers saved by setjmp, without the last word of the jmp_buf
+	return (void**)((char*)&t->gc_regs + sizeof(t->gc_regs)) - 1;
+}
+
+static void gc_push_threads() {
+	int i;
 	for(i=0;i<gc_threads.count;i++) {
 		hl_thread_info *t = gc_threads.threads[i];
-		gc_mark_stack(t->stack_cur,t->stack_top);
-		gc_mark_stack(&t->gc_regs,(void**)&t->gc_regs + (sizeof(jmp_buf) / sizeof(void*) - 1));
+		gc_mark_thread_stack(t);
+		gc_mark_stack(&t->gc_regs,gc_regs_end(t));
 		gc_mark_stack(&t->extra_stack_data,(void**)&t->extra_stack_data + t->extra_stack_size);
 	}
+}
+
+static void gc_mark_begin( bool minor ) {
+	int mark_bytes;
+	int i;
+	int64 t = TIMESTAMP();
+	// before the bits get cleared
+	gc_allocator_release_unswept();
+	mark_bytes = gc_stats.mark_bytes;
+	if( minor ) {
+		// pages bmp still hold the previous marks (the old generation) : copy them from the other buffer
+		unsigned char *tmp = mark_data;
+		int tsize = mark_size;
+		mark_data = mark_data_prev;
+		mark_size = mark_size_prev;
+		mark_data_prev = tmp;
+		mark_size_prev = tsize;
+	}
+	// prepare mark bits
+	if( mark_bytes > mark_size ) {
+		gc_free_page_memory(mark_data, mark_size);
+		if( mark_size == 0 ) mark_size = GC_PAGE_SIZE;
+		while( mark_size < mark_bytes )
+			mark_size <<= 1;
+		mark_data = gc_alloc_page_memory(mark_size);
+		if( mark_data == NULL ) out_of_memory("markbits");
+	}
+	MZERO(mark_data,mark_bytes);
+	gc_marked_bytes = 0;
+	gc_marked_objects = 0;
+	for(i=0;i<gc_mark_threads;i++) {
+		gc_mthread *mt = &mark_threads[i];
+		mt->marked_bytes = 0;
+		mt->marked_objects = 0;
+		mt->mark_time = 0;
+	}
+	for(i=0;i<gc_threads.count;i++)
+		gc_region_release(gc_threads.threads[i]);
+	gc_allocator_before_mark(mark_data, minor);
+	for(i=0;i<gc_black_count;i++)
+		free(gc_black_bmps[i]);
+	gc_black_count = 0;
+	gc_event.flush += TIMESTAMP() - t;
+	t = TIMESTAMP();
+	gc_push_roots();
+
+	// old blocks are already marked : rescan the ones that were written since last collection
+	if( minor )
+		gc_iter_pages(gc_mark_cards);
+	else if( gc_cards_enabled )
+		gc_iter_pages(gc_clear_cards);
+
+	// scan threads stacks & registers
+	gc_push_threads();
+	gc_event.roots += TIMESTAMP() - t;
+}
+
+static void gc_mark_wait() {
+	int i;
+	while( mark_threads_active )
+		hl_semaphore_acquire(mark_threads_done);
+	for(i=0;i<gc_mark_threads;i++) {
+		gc_mthread *t = &mark_threads[i];
+		if( GC_STACK_COUNT(&t->stack) > 0 )
+			hl_fatal("assert");
+	}
+}
 
+static void gc_mark_flush() {
 	gc_mstack *st = &global_mark_stack;
+	int64 t = TIMESTAMP();
 	if( gc_mark_threads <= 1 )
-		gc_flush_mark(st);
+		gc_flush_mark(st, NULL);
 	else {
-		gc_dispatch_mark(st, true);
+		gc_dispatch_mark(st);
 		if( GC_STACK_COUNT(st) > 0 )
 			hl_fatal("assert");
 		// wait threads to finish
-		while( mark_threads_active )
-			hl_semaphore_acquire(mark_threads_done);
-		for(i=0;i<gc_mark_threads;i++) {
-			gc_mthread *t = &mark_threads[i];
-			if( GC_STACK_COUNT(&t->stack) > 0 )
-				hl_fatal("assert");
-		}
+		gc_mark_wait();
 	}
-	gc_allocator_after_mark();
+	gc_event.mark += TIMESTAMP() - t;
 }
 
-static void count_free_memory( gc_pheader *page, int size ) {
-	gc_stats.free_memory += gc_free_memory(page);
-}
+/*
+	Compaction (HL_GC_COMPACT=<percent> or hl_gc_set_compact) : after a full collection, the
+	var-size pages having less than this share of live blocks are evacuated, mostly-copying in
+	the Bartlett style. Only the precise references get updated : the roots and the heap fields
+	described by the type mark bits. A page referenced from a thread stack, the saved registers
+	or a block scanned conservatively is pinned and stays where it is.
+*/
+
+static int gc_compact_percent = 0;
+static struct {
+	double fragmentation;
+	int64 moved;
+	int64 released;
+	int count;
+} gc_compact_stats = {0};
 
-static void gc_major() {
+static void gc_compact_pin_range( void **start, void **end ) {
+	while( start < end ) {
+		void *p = *start++;
+		gc_pheader *page = GC_GET_PAGE(p);
+		if( page && INPAGE(p,page) ) gc_allocator_pin(page);
+	}
+}
+
+static void gc_compact_pin_block( void *block, int size ) {
+	gc_pheader *page = GC_GET_PAGE(block);
+	if( page->page_kind == MEM_KIND_DYNAMIC ) {
+		hl_type *t = *(hl_type**)block;
+		if( t && t->mark_bits && t->kind != HFUN ) {
+			// virtual fields point inside the proxied object, or inside the virtual itself
+			if( t->kind == HVIRTUAL ) gc_compact_pin_range(hl_vfields(block), hl_vfields(block) + t->virt->nfields);
+			return;
+		}
+	}
+	gc_compact_pin_range((void**)block, (void**)block + size / HL_WSIZE);
+}
+
+static void gc_compact_pin_page( gc_pheader *page, int size ) {
+	if( MEM_HAS_PTR(page->page_kind) ) gc_iter_live_blocks(page, gc_compact_pin_block);
+}
+
+static bool gc_compact_fix( void **slot ) {
+	void *p = *slot;
+	gc_pheader *page = GC_GET_PAGE(p);
+	if( !page || !INPAGE(p,page) ) return false;
+	p = gc_allocator_forward(page, p);
+	if( !p ) return false;
+	*slot = p;
+	return true;
+}
+
+static void gc_compact_fix_block( void *block, int size ) {
+	void **b = (void**)block;
+	hl_type *t = *(hl_type**)block;
+	unsigned int *mark_bits;
+	int pos = 0, nwords = size / HL_WSIZE;
+	if( !t || !t->mark_bits || t->kind == HFUN ) return;
+	mark_bits = t->mark_bits;
+	if( t->kind == HENUM ) {
+		mark_bits += ((venum*)block)->index;
+		b += 2;
+		nwords -= 2;
+	} else {
+		b++;
+		pos++;
+	}
+	while( pos < nwords ) {
+		// same as a store : the field might now point to a young block
+		if( (mark_bits[pos >> 5] & (1 << (pos&31))) && *b && gc_compact_fix(b) )
+			hl_gc_write_barrier(b);
+		pos++;
+		b++;
+	}
+}
+
+static void gc_compact_fix_page( gc_pheader *page, int size ) {
+	if( page->page_kind == MEM_KIND_DYNAMIC ) gc_iter_live_blocks(page, gc_compact_fix_block);
+}
+
+static void gc_compact() {
+	int i;
+	int64 moved, released;
+	if( !gc_allocator_compact_select(gc_compact_percent, &gc_compact_stats.fragmentation) )
+		return;
+	for(i=0;i<gc_threads.count;i++) {
+		hl_thread_info *t = gc_threads.threads[i];
+		gc_compact_pin_range((void**)t->stack_cur, (void**)t->stack_top);
+		gc_compact_pin_range((void**)&t->gc_regs, gc_regs_end(t));
+		gc_compact_pin_range(t->extra_stack_data, t->extra_stack_data + t->extra_stack_size);
+	}
+	gc_iter_pages(gc_compact_pin_page);
+	moved = gc_allocator_compact();
+	if( moved ) {
+		for(i=0;i<gc_roots_count;i++)
+			if( *gc_roots[i] ) gc_compact_fix(gc_roots[i]);
+		gc_iter_pages(gc_compact_fix_page);
+	}
+	released = gc_allocator_compact_end();
+	gc_compact_stats.moved += moved;
+	gc_compact_stats.released += released;
+	if( moved ) gc_compact_stats.count++;
+	if( gc_flags & GC_PROFILE )
+		printf("GC-COMPACT %.1f%% fragmented, moved %dKB, released %dKB\n", gc_compact_stats.fragmentation * 100., (int)(moved >> 10), (int)(released >> 10));
+}
+
+static void gc_after_mark( bool minor ) {
+	int64 t = TIMESTAMP();
+	gc_allocator_after_mark();
+	if( !minor && gc_compact_percent > 0 ) gc_compact();
+	gc_event.flush += TIMESTAMP() - t;
+}
+
+/*
+	Concurrent marking : the world is only stopped to push the roots and the threads stacks, then
+	the mark threads trace the heap while the mutators keep running. Blocks allocated meanwhile are
+	black (marked and never swept by this cycle) and the free lists are not rebuilt before the mark
+	ends. Stores done during the trace go through hl_gc_write_barrier, so the final remark pause only
+	has to rescan the roots, the stacks and the blocks overlapping dirty cards (which include all the
+	blocks allocated during the trace, since native code initializes them without barrier).
+
+	What the mark threads read while the mutators allocate :
+	- the page map and the page headers (base, size, kind, bmp and the allocator block_size,
+	  size_bits, first_block, max_blocks and sizes pointer) : no page is freed or compacted while
+	  gc_mark_running is set, and a new page is only published in the map by gc_publish_page once
+	  these are set, after a fence. Block pointers into it are stored after the global lock release.
+	- the bmp bits : set with atomic_bit_set by both the mark threads and gc_alloc_black.
+	- the sizes entries of var-size pages : allocation only rewrites the ones of free blocks. A stale
+	  conservative pointer might still reach such a block while it is reallocated, the mark then scans
+	  it with an old or zero size, which stays inside the page and only retains garbage.
+	The free lists, cards and sweep state are not read by the mark threads.
+*/
+
+static void gc_region_unmark( hl_thread_info *t ) {
+	int i;
+	for(i=0;i<HL_GC_REGIONS;i++) {
+		hl_gc_region *r = t->gc_regions + i;
+		int bsize = ((i % GC_REGION_CLASSES) + 1) * HL_WSIZE;
+		unsigned char *ptr;
+		for(ptr=r->cur;ptr<r->end;ptr+=bsize) {
+			gc_pheader *page = GC_GET_PAGE(ptr);
+			int bid = gc_allocator_get_block_id(page, ptr);
+			page->bmp[bid>>3] &= ~(1<<(bid&7));
+		}
+	}
+	gc_region_release(t);
+}
+
+static void gc_mark_remark() {
+	int i;
+	gc_mark_wait();
+	int64 t = TIMESTAMP();
+	gc_push_roots();
+	gc_iter_pages(gc_mark_cards);
+	gc_push_threads();
+	gc_event.roots += TIMESTAMP() - t;
+	gc_mark_flush();
+	// regions reserved during the trace are black : unmark their unused blocks so they get swept
+	for(i=0;i<gc_threads.count;i++)
+		gc_region_unmark(gc_threads.threads[i]);
+	gc_mark_running = false;
+	gc_after_mark(false);
+}
+
+static void gc_mark( bool minor ) {
+	if( gc_mark_running ) gc_mark_remark();
+	gc_mark_begin(minor);
+	gc_mark_flush();
+	gc_after_mark(minor);
+}
+
+static bool gc_concurrent_enabled() {
+	return (gc_flags & (GC_CONCURRENT|GC_NO_THREADS|GC_FORCE_MAJOR)) == GC_CONCURRENT && gc_cards_enabled && gc_mark_threads > 1;
+}
+
+static void count_free_memory( gc_pheader *page, int size ) {
+	gc_stats.free_memory += gc_free_memory(page);
+}
+
+/*
+	Pacer : with a GOGC value (HL_GC_GOGC or hl_gc_set_pacer), a major collection is triggered once
+	the bytes allocated since the previous one reach GOGC% of the bytes it found alive, instead of
+	a fixed share of the whole heap. This share is increased while the time spent in collection
+	pauses is above the CPU target, and the nursery is resized so that minor collections stay
+	below the pause target. The soft heap limit (HL_GC_HEAP_LIMIT) still applies on top of it.
+*/
+
+#define GC_PACER_MIN_TRIGGER	(4 << 20)
+#define GC_PACER_MAX_SCALE		8.
+
+static int gc_pacer_gogc = 0; // 0 : use gc_mark_threshold
+static int64 gc_pacer_pause = 0; // max pause in us
+static double gc_pacer_cpu = 0.; // max share of the time spent in pauses
+static double gc_pacer_scale = 1.;
+static int64 gc_pacer_trigger = GC_PACER_MIN_TRIGGER;
+static int64 gc_pacer_last = 0;
+static int64 gc_pacer_minor_pause = 0; // minor pause before the last nursery shrink
+
+static void gc_pacer_update( bool minor, int64 pause ) {
+	int64 now = TIMESTAMP() / 1000;
+	int64 live = gc_marked_bytes;
+	int i;
+	for(i=0;i<gc_mark_threads;i++)
+		live += mark_threads[i].marked_bytes;
+	gc_stats.live_memory = minor ? gc_stats.live_memory + live : live;
+	if( gc_pacer_gogc <= 0 ) return;
+	if( gc_pacer_cpu > 0 && gc_pacer_last > 0 && now > gc_pacer_last ) {
+		double share = (double)pause / (double)(now - gc_pacer_last);
+		if( share > gc_pacer_cpu )
+			gc_pacer_scale *= 1.25;
+		else if( share < gc_pacer_cpu * 0.5 )
+			gc_pacer_scale *= 0.8;
+		if( gc_pacer_scale > GC_PACER_MAX_SCALE ) gc_pacer_scale = GC_PACER_MAX_SCALE;
+		if( gc_pacer_scale < 1. ) gc_pacer_scale = 1.;
+	}
+	if( minor && gc_pacer_pause > 0 ) {
+		if( pause > gc_pacer_pause ) {
+			// scanning the roots and the cards does not depend on the nursery : only shrink while it helps
+			if( gc_nursery_size > (1 << 20) && (gc_pacer_minor_pause == 0 || pause < gc_pacer_minor_pause - (gc_pacer_minor_pause >> 3)) ) {
+				gc_pacer_minor_pause = pause;
+				gc_nursery_size -= gc_nursery_size >> 2;
+			}
+		} else if( pause < (gc_pacer_pause >> 1) && gc_nursery_size < (256 << 20) ) {
+			gc_pacer_minor_pause = 0;
+			gc_nursery_size += gc_nursery_size >> 2;
+		}
+	}
+	gc_pacer_trigger = (int64)((double)gc_stats.live_memory * gc_pacer_gogc / 100. * gc_pacer_scale);
+	if( gc_pacer_trigger < GC_PACER_MIN_TRIGGER ) gc_pacer_trigger = GC_PACER_MIN_TRIGGER;
+	gc_pacer_last = TIMESTAMP() / 1000;
+}
+
+// bytes that can be allocated before the next major collection
+static int64 gc_major_budget() {
+	if( gc_pacer_gogc > 0 ) return gc_pacer_trigger;
+	return (int64)(gc_stats.pages_total_memory * gc_mark_threshold);
+}
+
+static void gc_event_end( bool minor, bool concurrent ) {
+	int i;
+	hl_gc_event *e = &gc_event;
+	e->time = TIMESTAMP();
+	e->kind = minor ? 1 : (concurrent ? 2 : 0);
+	e->mark_threads = gc_mark_threads;
+	e->marked_bytes = gc_marked_bytes;
+	e->marked_objects = gc_marked_objects;
+	if( gc_mark_threads <= 1 )
+		e->thread_mark[0] = e->mark;
+	for(i=0;i<gc_mark_threads;i++) {
+		gc_mthread *t = &mark_threads[i];
+		e->marked_bytes += t->marked_bytes;
+		e->marked_objects += t->marked_objects;
+		if( i < HL_GC_EVENT_THREADS && gc_mark_threads > 1 ) e->thread_mark[i] = t->mark_time;
+	}
+	e->pages_freed = (int)(gc_stats.pages_freed - last_profile.pages_freed);
+	e->finalizers = gc_finalize_time - last_profile.finalize_time;
+	e->finalized = (int)(gc_finalize_total - last_profile.finalize_total);
+	e->heap_memory = gc_stats.pages_total_memory;
+	last_profile.pages_freed = gc_stats.pages_freed;
+	last_profile.finalize_time = gc_finalize_time;
+	last_profile.finalize_total = gc_finalize_total;
+	gc_last_event = *e;
+	if( gc_trace ) {
+		static const char *kinds[] = { "major", "minor", "concurrent" };
+		fprintf(gc_trace, "{\"time\":%lld,\"kind\":\"%s\",\"pause\":%lld,\"stop_world\":%lld,\"roots\":%lld,\"mark\":%lld,\"thread_mark\":[",
+			e->time, kinds[e->kind], e->pause, e->stop_world, e->roots, e->mark);
+		for(i=0;i<e->mark_threads && i<HL_GC_EVENT_THREADS;i++)
+			fprintf(gc_trace, i ? ",%lld" : "%lld", e->thread_mark[i]);
+		fprintf(gc_trace, "],\"flush\":%lld,\"finalizers\":%lld,\"finalized\":%d,\"marked_bytes\":%lld,\"marked_objects\":%lld,\"pages_freed\":%d,\"heap\":%lld}\n",
+			e->flush, e->finalizers, e->finalized, e->marked_bytes, e->marked_objects, e->pages_freed, e->heap_memory);
+		fflush(gc_trace);
+	}
+	memset(e, 0, sizeof(hl_gc_event));
+}
+
+static void gc_collect_end( bool minor, bool concurrent, int64 dt ) {
+	gc_event_end(minor, concurrent);
+	gc_stats.mark_count++;
+	gc_stats.mark_time += dt;
+	if( !minor )
+		gc_stats.major_memory = gc_stats.pages_total_memory;
+	else {
+		gc_stats.minor_count++;
+		// the old generation has grown too much since the last full collection
+		if( gc_stats.pages_total_memory > gc_stats.major_memory + gc_major_budget() )
+			gc_stats.major_memory = 0;
+	}
+	if( gc_flags & GC_PROFILE ) {
+		printf("GC-PROFILE %d%s\n\tmark-time %.3g\n\talloc-time %.3g\n\ttotal-mark-time %.3g\n\ttotal-alloc-time %.3g\n\tallocated %d (%dKB)\n",
+			gc_stats.mark_count,
+			minor ? " minor" : (concurrent ? " concurrent" : ""),
+			dt/1e9,
+			(gc_stats.alloc_time - last_profile.alloc_time)/1e9,
+			gc_stats.mark_time/1e9,
+			gc_stats.alloc_time/1e9,
+			(int)(gc_stats.allocation_count - last_profile.allocation_count),
+			(int)((gc_stats.total_allocated - last_profile.total_allocated)>>10)
+		);
+		last_profile.allocation_count = gc_stats.allocation_count;
+		last_profile.alloc_time = gc_stats.alloc_time;
+		last_profile.total_allocated = gc_stats.total_allocated;
+	}
+}
+
+static void gc_collect( bool minor ) {
 
 	if( gc_flags & GC_PROFILE_MEM ) {
 		double gc_mem = gc_stats.mark_bytes;
@@ -862,6 +1849,7 @@ static void gc_major() {
 		for(i=0;i<gc_mark_threads;i++) {
 			gc_mthread *t = &mark_threads[i];
 			gc_mem += t->stack.size * sizeof(void*);
+			if( t->deque ) gc_mem += sizeof(gc_deque);
 		}
 		int pages = gc_stats.pages_count;
 		gc_pheader *p = gc_free_pheaders;
@@ -883,35 +1871,53 @@ static void gc_major() {
 		printf("GC-PROFILE-MEM %.2fMB total, %.2f%% free %.2f%% gc\n", gc_mem / (1024.0 * 1024.0), (gc_stats.free_memory * 100.0 / gc_mem), (gc_mem - gc_stats.pages_total_memory) * 100.0 / gc_mem);
 	}
 
-	int time = TIMESTAMP(), dt;
+	int64 time = TIMESTAMP();
 	gc_stats.last_mark = gc_stats.total_allocated;
 	gc_stats.last_mark_allocs = gc_stats.allocation_count;
 	gc_stop_world(true);
-	gc_mark();
+	gc_event.stop_world += TIMESTAMP() - time;
+	gc_mark(minor);
 	gc_stop_world(false);
-	dt = TIMESTAMP() - time;
-	gc_stats.mark_count++;
-	gc_stats.mark_time += dt;
-	if( gc_flags & GC_PROFILE ) {
-		printf("GC-PROFILE %d\n\tmark-time %.3g\n\talloc-time %.3g\n\ttotal-mark-time %.3g\n\ttotal-alloc-time %.3g\n\tallocated %d (%dKB)\n",
-			gc_stats.mark_count,
-			dt/1000.,
-			(gc_stats.alloc_time - last_profile.alloc_time)/1000.,
-			gc_stats.mark_time/1000.,
-			gc_stats.alloc_time/1000.,
-			(int)(gc_stats.allocation_count - last_profile.allocation_count),
-			(int)((gc_stats.total_allocated - last_profile.total_allocated)>>10)
-		);
-		last_profile.allocation_count = gc_stats.allocation_count;
-		last_profile.alloc_time = gc_stats.alloc_time;
-		last_profile.total_allocated = gc_stats.total_allocated;
-	}
+	gc_event.pause += TIMESTAMP() - time;
+	gc_pacer_update(minor, gc_event.pause / 1000);
+	gc_collect_end(minor, false, gc_event.pause);
+}
+
+static void gc_concurrent_start() {
+	int64 time = TIMESTAMP();
+	gc_stats.last_mark = gc_stats.total_allocated;
+	gc_stats.last_mark_allocs = gc_stats.allocation_count;
+	gc_stop_world(true);
+	gc_event.stop_world += TIMESTAMP() - time;
+	gc_mark_running = true;
+	gc_mark_begin(false);
+	gc_dispatch_mark(&global_mark_stack);
+	gc_stop_world(false);
+	gc_event.pause += TIMESTAMP() - time;
+}
+
+static void gc_concurrent_end() {
+	int64 time = TIMESTAMP();
+	gc_stop_world(true);
+	gc_event.stop_world += TIMESTAMP() - time;
+	gc_mark_remark();
+	gc_stop_world(false);
+	gc_event.pause += TIMESTAMP() - time;
+	gc_pacer_update(false, gc_event.pause / 1000);
+	gc_collect_end(false, true, gc_event.pause);
+}
+
+static void gc_major() {
+	gc_collect(false);
 }
 
 HL_API void hl_gc_major() {
 	gc_global_lock(true);
 	gc_major();
+	// don't wait for the sweep to give back the empty pages
+	gc_allocator_release_unswept();
 	gc_global_lock(false);
+	gc_finalize_pending();
 }
 
 HL_API bool hl_is_gc_ptr( void *ptr ) {
@@ -935,18 +1941,293 @@ static bool gc_is_active = true;
 static void gc_check_mark() {
 	int64 m = gc_stats.total_allocated - gc_stats.last_mark;
 	int64 b = gc_stats.allocation_count - gc_stats.last_mark_allocs;
-	if( (m > gc_stats.pages_total_memory * gc_mark_threshold || b > gc_stats.pages_blocks * gc_mark_threshold || (gc_flags & GC_FORCE_MAJOR)) && gc_is_active )
-		gc_major();
+	int64 budget = gc_major_budget();
+	bool major = m > budget || (gc_pacer_gogc <= 0 && b > gc_stats.pages_blocks * gc_mark_threshold);
+	if( gc_heap_limit > 0 && !major ) {
+		// soft limit : collect sooner as the heap gets close to it, but not more than 8x as often
+		int64 room = gc_heap_limit - gc_stats.pages_total_memory - gc_retained_memory;
+		int64 min_room = budget >> 3;
+		if( room < m && gc_retained_memory ) {
+			gc_decommit_idle(true);
+			room = gc_heap_limit - gc_stats.pages_total_memory;
+		}
+		major = m > (room > min_room ? room : min_room);
+	}
+	if( gc_mark_running ) {
+		// remark when the mark threads are done, or wait for them if we already allocated too much
+		if( !mark_threads_active || major )
+			gc_concurrent_end();
+		return;
+	}
+	if( gc_cards_enabled && (gc_flags & (GC_GENERATIONAL|GC_FORCE_MAJOR)) == GC_GENERATIONAL ) {
+		if( (m > gc_nursery_size || major) && gc_is_active ) {
+			// major_memory is reset when the next collection needs to be a full one
+			if( gc_stats.major_memory == 0 && gc_concurrent_enabled() )
+				gc_concurrent_start();
+			else
+				gc_collect(gc_stats.major_memory > 0);
+		}
+		return;
+	}
+	if( (major || (gc_flags & GC_FORCE_MAJOR)) && gc_is_active ) {
+		if( gc_concurrent_enabled() )
+			gc_concurrent_start();
+		else
+			gc_major();
+	}
+}
+
+/*
+	Unmapping memory can stall the caller (TLB shootdowns), so the pages released by the sweep are
+	given back to the system by a background thread. They are already removed from the page map.
+	The thread is only started the first time it has something to do.
+*/
+
+#define GC_RELEASE_MAX	256
+
+typedef struct {
+	void *base;
+	int size;
+} gc_release_entry;
+
+static gc_release_entry gc_release_queue[GC_RELEASE_MAX];
+static int gc_release_count = 0;
+static bool gc_release_started = false;
+
+static void release_thread_main( void *param );
+
+// called with gc_release_lock held
+static void gc_release_wake() {
+	if( !gc_release_started ) {
+		gc_release_started = true;
+		hl_thread_start(release_thread_main, NULL, false);
+	}
+	hl_semaphore_release(gc_release_ready);
+}
+
+static void gc_release_page_memory( void *base, int size ) {
+	if( gc_retain_page(base, size) )
+		return;
+	if( gc_release_lock && !(gc_flags & GC_NO_THREADS) ) {
+		bool queued = false;
+		hl_mutex_acquire(gc_release_lock);
+		if( gc_release_count < GC_RELEASE_MAX ) {
+			gc_release_queue[gc_release_count].base = base;
+			gc_release_queue[gc_release_count].size = size;
+			if( gc_release_count++ == 0 ) gc_release_wake();
+			queued = true;
+		}
+		hl_mutex_release(gc_release_lock);
+		if( queued ) return;
+	}
+	gc_free_page_memory(base, size);
+}
+
+/*
+	With a decommit delay (HL_GC_DECOMMIT_MS or hl_gc_set_decommit_delay), released pages are
+	retained instead of being unmapped : they are reused first by gc_alloc_page, and the ones that
+	stayed unused for the delay are decommitted by the release thread so the RSS follows the live
+	set after a spike. Decommitted pages keep their address range and are reused as well.
+*/
+
+typedef struct _gc_retained gc_retained;
+struct _gc_retained {
+	void *base;
+	int size;
+	int64 time;
+	gc_retained *next;
+};
+
+static gc_retained *gc_retained_pages = NULL; // most recent first
+static gc_retained *gc_decommitted_pages = NULL;
+
+static bool gc_retain_page( void *base, int size ) {
+#	ifdef HL_CONSOLE
+	return false;
+#	else
+	if( gc_decommit_delay < 0 || !gc_release_lock ) return false;
+	gc_retained *r = (gc_retained*)malloc(sizeof(gc_retained));
+	if( r == NULL ) return false;
+	r->base = base;
+	r->size = size;
+	r->time = TIMESTAMP() / 1000000;
+	hl_mutex_acquire(gc_release_lock);
+	r->next = gc_retained_pages;
+	gc_retained_pages = r;
+	gc_retained_memory += size;
+	// wake up the release thread so it starts counting the delay
+	if( r->next == NULL && gc_release_count == 0 ) gc_release_wake();
+	hl_mutex_release(gc_release_lock);
+	return true;
+#	endif
+}
+
+static void *gc_retained_take( gc_retained **list, int size ) {
+	gc_retained *r = *list;
+	while( r ) {
+		if( r->size == size ) {
+			void *base = r->base;
+			*list = r->next;
+			free(r);
+			return base;
+		}
+		list = &r->next;
+		r = *list;
+	}
+	return NULL;
+}
+
+static void *gc_retained_alloc( int size ) {
+	void *ptr;
+	if( !gc_retained_pages && !gc_decommitted_pages ) return NULL;
+	hl_mutex_acquire(gc_release_lock);
+	ptr = gc_retained_take(&gc_retained_pages, size);
+	if( ptr )
+		gc_retained_memory -= size;
+	else {
+		ptr = gc_retained_take(&gc_decommitted_pages, size);
+#		ifdef HL_WIN
+		if( ptr && !VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) )
+			ptr = NULL;
+#		endif
+	}
+	hl_mutex_release(gc_release_lock);
+	return ptr;
+}
+
+// decommit the pages retained for more than the delay (or all of them), returns the next deadline
+static int64 gc_decommit_idle( bool all ) {
+	int64 now = TIMESTAMP() / 1000000;
+	int64 next = -1;
+	gc_retained **prev = &gc_retained_pages;
+	gc_retained *r;
+	hl_mutex_acquire(gc_release_lock);
+	while( (r = *prev) != NULL ) {
+		if( !all && now - r->time < gc_decommit_delay ) {
+			if( next < 0 || r->time < next ) next = r->time;
+			prev = &r->next;
+			continue;
+		}
+#		ifdef HL_WIN
+		VirtualFree(r->base, r->size, MEM_DECOMMIT);
+#		elif !defined(HL_CONSOLE)
+		madvise(r->base, r->size, MADV_DONTNEED);
+#		endif
+		gc_retained_memory -= r->size;
+		*prev = r->next;
+		r->next = gc_decommitted_pages;
+		gc_decommitted_pages = r;
+	}
+	hl_mutex_release(gc_release_lock);
+	return next < 0 ? -1 : next + gc_decommit_delay;
+}
+
+static void release_thread_main( void *param ) {
+	gc_release_entry pending[GC_RELEASE_MAX];
+	vdynamic timeout;
+	timeout.t = &hlt_f64;
+	while( true ) {
+		int i, count;
+		int64 deadline = gc_decommit_delay >= 0 ? gc_decommit_idle(false) : -1;
+		if( deadline < 0 )
+			hl_semaphore_acquire(gc_release_ready);
+		else {
+			timeout.v.d = (deadline - TIMESTAMP() / 1000000 + 1) / 1000.;
+			if( !hl_semaphore_try_acquire(gc_release_ready, &timeout) )
+				continue;
+		}
+		hl_mutex_acquire(gc_release_lock);
+		count = gc_release_count;
+		memcpy(pending, gc_release_queue, count * sizeof(gc_release_entry));
+		gc_release_count = 0;
+		hl_mutex_release(gc_release_lock);
+		for(i=0;i<count;i++)
+			gc_free_page_memory(pending[i].base, pending[i].size);
+	}
+}
+
+/*
+	Dead finalizable blocks are queued by the sweep while the world is stopped. Their finalizers
+	are then called by the next allocation before it reserves its block (or by hl_gc_major), or by
+	a dedicated thread with HL_GC_FINALIZER_THREAD. The queue is a root until then.
+*/
+
+#define GC_FINALIZE_BATCH	64
+
+static void finalizer_thread_main( void *param );
+
+static void gc_finalize_push( void *ptr ) {
+	hl_mutex_acquire(gc_finalize_lock);
+	if( gc_finalize_count == gc_finalize_max ) {
+		int nmax = gc_finalize_max ? gc_finalize_max << 1 : 256;
+		void **q = (void**)malloc(sizeof(void*) * nmax);
+		if( q == NULL ) out_of_memory("finalizers");
+		memcpy(q, gc_finalize_queue, sizeof(void*) * gc_finalize_count);
+		free(gc_finalize_queue);
+		gc_finalize_queue = q;
+		gc_finalize_max = nmax;
+	}
+	gc_finalize_queue[gc_finalize_count++] = ptr;
+#	ifdef HL_THREADS
+	if( gc_finalize_count == 1 && gc_finalize_ready ) {
+		// started on first use : a registered thread must not exist before the main one
+		static bool started = false;
+		if( !started ) {
+			started = true;
+			hl_thread_start(finalizer_thread_main, NULL, false);
+		}
+		hl_semaphore_release(gc_finalize_ready);
+	}
+#	endif
+	hl_mutex_release(gc_finalize_lock);
+}
+
+static void gc_run_finalizers() {
+	// the batch being finalized is kept alive by the stack scan
+	void *batch[GC_FINALIZE_BATCH];
+	int64 t = 0;
+	while( true ) {
+		int i, count;
+		hl_mutex_acquire(gc_finalize_lock);
+		if( t ) gc_finalize_time += TIMESTAMP() - t;
+		count = gc_finalize_count < GC_FINALIZE_BATCH ? gc_finalize_count : GC_FINALIZE_BATCH;
+		gc_finalize_total += count;
+		gc_finalize_count -= count;
+		memcpy(batch, gc_finalize_queue + gc_finalize_count, count * sizeof(void*));
+		hl_mutex_release(gc_finalize_lock);
+		if( count == 0 ) break;
+		t = TIMESTAMP();
+		for(i=0;i<count;i++) {
+			void *finalizer = *(void**)batch[i];
+			if( finalizer )
+				((void(*)(void *))finalizer)(batch[i]);
+		}
+	}
+}
+
+static void finalizer_thread_main( void *param ) {
+	int top;
+	hl_register_thread(&top);
+	while( true ) {
+		hl_blocking(true);
+		hl_semaphore_acquire(gc_finalize_ready);
+		hl_blocking(false);
+		gc_run_finalizers();
+	}
 }
 
 static void mark_thread_main( void *param ) {
 	int index = (int)(int_val)param;
 	gc_mthread *inf = &mark_threads[index];
+	if( gc_numa_nodes > 1 ) gc_numa_run_on(index % gc_numa_nodes);
 	while( true ) {
 		hl_semaphore_acquire(inf->ready);
-		inf->mark_count += gc_flush_mark(&inf->stack);
-		if( !atomic_bit_unset(&mark_threads_active, 1 << index) ) hl_fatal("assert");
-		if( mark_threads_active == 0 ) hl_semaphore_release(mark_threads_done);
+		int64 t = TIMESTAMP();
+		do {
+			inf->mark_count += gc_flush_mark(&inf->stack, inf);
+		} while( gc_steal_mark(inf) || !gc_mark_terminate() );
+		inf->mark_time += TIMESTAMP() - t;
+		if( atomic_add(&mark_threads_active, -1) == 0 ) hl_semaphore_release(mark_threads_done);
 	}
 }
 
@@ -971,27 +2252,71 @@ static void hl_gc_init() {
 		gc_flags |= GC_PROFILE_MEM;
 	if( getenv("HL_DUMP_MEMORY") )
 		gc_flags |= GC_DUMP_MEM;
+	if( getenv("HL_GC_GENERATIONAL") )
+		gc_flags |= GC_GENERATIONAL;
+	if( getenv("HL_GC_CONCURRENT") )
+		gc_flags |= GC_CONCURRENT;
+	if( getenv("HL_GC_FINALIZER_THREAD") )
+		gc_flags |= GC_FINALIZER_THREAD;
+	if( getenv("HL_GC_HUGE_PAGES") )
+		gc_flags |= GC_HUGE_PAGES;
+	if( getenv("HL_GC_NUMA") )
+		gc_numa_init();
+	char *decommit = getenv("HL_GC_DECOMMIT_MS");
+	if( decommit ) gc_decommit_delay = atoi(decommit);
+	char *limit = getenv("HL_GC_HEAP_LIMIT");
+	if( limit ) gc_heap_limit = (int64)(atof(limit) * 1024 * 1024);
+	char *trace = getenv("HL_GC_TRACE");
+	if( trace ) gc_trace = strcmp(trace,"-") == 0 ? stderr : fopen(trace,"a");
+	char *gogc = getenv("HL_GC_GOGC");
+	if( gogc ) gc_pacer_gogc = atoi(gogc);
+	char *pause = getenv("HL_GC_PAUSE_TARGET");
+	if( pause ) gc_pacer_pause = (int64)(atof(pause) * 1000);
+	char *cpu = getenv("HL_GC_CPU_TARGET");
+	if( cpu ) gc_pacer_cpu = atof(cpu) / 100.;
+	char *compact = getenv("HL_GC_COMPACT");
+	if( compact ) gc_compact_percent = atoi(compact);
+	char *nursery = getenv("HL_GC_NURSERY");
+	if( nursery ) {
+		gc_nursery_size = atoi(nursery) << 10;
+		if( gc_nursery_size < GC_PAGE_SIZE ) gc_nursery_size = GC_PAGE_SIZE;
+	}
 #	endif
 	gc_stats.mark_bytes = 4; // prevent reading out of bmp
 	memset(&gc_threads,0,sizeof(gc_threads));
 	gc_threads.global_lock = hl_mutex_alloc(false);
 	gc_threads.exclusive_lock = hl_mutex_alloc(false);
+	hl_add_root(&gc_finalize_lock);
+	gc_finalize_lock = hl_mutex_alloc(false);
 #	ifdef HL_THREADS
 	hl_add_root(&gc_threads.global_lock);
 	hl_add_root(&gc_threads.exclusive_lock);
+	hl_add_root(&gc_stopped);
+	gc_stopped = hl_condition_alloc();
 	hl_add_root(&mark_threads_done);
 	mark_threads_done = hl_semaphore_alloc(0);
+	hl_add_root(&mark_threads_wake);
+	mark_threads_wake = hl_semaphore_alloc(0);
 	char *nthreads = getenv("HL_GC_THREADS");
 	if( nthreads ) {
 		gc_mark_threads = atoi(nthreads);
 		if( gc_mark_threads < 1 ) gc_mark_threads = 1;
 		if( gc_mark_threads > GC_MAX_MARK_THREADS ) gc_mark_threads = GC_MAX_MARK_THREADS;
 	}
+	hl_add_root(&gc_finalize_ready);
+	if( gc_flags & GC_FINALIZER_THREAD ) gc_finalize_ready = hl_semaphore_alloc(0);
+	hl_add_root(&gc_release_lock);
+	hl_add_root(&gc_release_ready);
+	gc_release_lock = hl_mutex_alloc(false);
+	gc_release_ready = hl_semaphore_alloc(0);
 	if( gc_mark_threads > 1 ) {
 		for(int i=0;i<gc_mark_threads;i++) {
 			gc_mthread *t = &mark_threads[i];
 			hl_add_root(&t->ready);
 			t->ready = hl_semaphore_alloc(0);
+			t->deque = (gc_deque*)malloc(sizeof(gc_deque));
+			if( t->deque == NULL ) out_of_memory("markqueue");
+			t->deque->top = t->deque->bottom = 0;
 			t->tid = hl_thread_start(mark_thread_main, (void*)(int_val)i, false);
 		}
 	}
@@ -1026,7 +2351,7 @@ HL_API void hl_blocking( bool b ) {
 		if( t->gc_blocking == 0 )
 			gc_save_context(t,&b);
 #		endif
-		t->gc_blocking++;
+		if( t->gc_blocking++ == 0 ) gc_blocking_notify();
 	} else if( t->gc_blocking == 0 )
 		hl_error("Unblocked thread");
 	else {
@@ -1040,9 +2365,11 @@ HL_API void hl_blocking( bool b ) {
 
 void hl_cache_free();
 void hl_cache_init();
+static void gc_init_boxes();
 
 void hl_global_init() {
 	hl_gc_init();
+	gc_init_boxes();
 	hl_cache_init();
 }
 
@@ -1135,6 +2462,9 @@ retry_jit_alloc:
 }
 
 HL_PRIM void hl_free_executable_memory( void *c, int size ) {
+#ifdef GC_STACK_MAPS
+	gc_remove_stack_maps(c);
+#endif
 #if defined(HL_WIN)
 	VirtualFree(c,0,MEM_RELEASE);
 #elif !defined(HL_CONSOLE)
@@ -1155,9 +2485,231 @@ struct _pextra {
 };
 static pextra *extra_pages = NULL;
 #define EXTRA_SIZE (GC_PAGE_SIZE + (4<<10))
+
+/*
+	With GC_HUGE_PAGES, pages are carved from large arenas backed by huge pages : MAP_HUGETLB if the
+	system has reserved some, transparent huge pages otherwise. This saves most of the TLB misses
+	of the mark on large heaps. With HL_GC_NUMA, arenas are spread over the nodes round-robin and
+	each mark thread runs on one node. Released pages go back to their arena free list, where they
+	are merged with their neighbours : the huge pages that become entirely free are given back to the
+	system, and an arena is unmapped once it is empty unless it is the only one.
+*/
+#define GC_ARENA_SIZE		(64 << 20)
+#define GC_HUGE_PAGE_SIZE	(2 << 20)
+#define GC_MPOL_PREFERRED	1
+
+typedef struct _gc_arena_chunk gc_arena_chunk;
+struct _gc_arena_chunk {
+	unsigned char *ptr;
+	int size;
+	gc_arena_chunk *next;
+};
+
+typedef struct _gc_arena gc_arena;
+struct _gc_arena {
+	unsigned char *base;
+	gc_arena_chunk *chunks; // free chunks, sorted by address
+	int largest; // size of the largest free chunk
+	int used;
+	int node;
+	gc_arena *next;
+};
+
+static gc_arena *gc_arenas = NULL;
+static int gc_arena_count = 0;
+
+static gc_arena_chunk *gc_arena_chunk_new( unsigned char *ptr, int size, gc_arena_chunk *next ) {
+	gc_arena_chunk *c = (gc_arena_chunk*)malloc(sizeof(gc_arena_chunk));
+	if( c == NULL ) out_of_memory("arena");
+	c->ptr = ptr;
+	c->size = size;
+	c->next = next;
+	return c;
+}
+
+static gc_arena *gc_arena_new() {
+	unsigned char *base = MAP_FAILED;
+#	ifdef MAP_HUGETLB
+	if( gc_flags & GC_HUGE_PAGES )
+		base = (unsigned char*)mmap(NULL,GC_ARENA_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+#	endif
+	if( base == MAP_FAILED ) {
+		// align on a huge page so the kernel can back the arena with transparent ones
+		unsigned char *ptr = (unsigned char*)mmap(NULL,GC_ARENA_SIZE + GC_HUGE_PAGE_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if( ptr == MAP_FAILED )
+			return NULL;
+		base = (unsigned char*)(((int_val)ptr + GC_HUGE_PAGE_SIZE - 1) & ~(int_val)(GC_HUGE_PAGE_SIZE - 1));
+		if( base > ptr ) munmap(ptr, base - ptr);
+		if( ptr + GC_HUGE_PAGE_SIZE > base ) munmap(base + GC_ARENA_SIZE, ptr + GC_HUGE_PAGE_SIZE - base);
+#		ifdef MADV_HUGEPAGE
+		if( gc_flags & GC_HUGE_PAGES ) madvise(base, GC_ARENA_SIZE, MADV_HUGEPAGE);
+#		endif
+	}
+	gc_arena *a = (gc_arena*)malloc(sizeof(gc_arena));
+	if( a == NULL ) out_of_memory("arena");
+	a->base = base;
+	a->chunks = gc_arena_chunk_new(base, GC_ARENA_SIZE, NULL);
+	a->largest = GC_ARENA_SIZE;
+	a->used = 0;
+	a->node = -1;
+#	ifdef HL_LINUX
+	if( gc_numa_nodes > 1 ) {
+		unsigned long mask = 1UL << (gc_arena_count % gc_numa_nodes);
+		a->node = gc_arena_count % gc_numa_nodes;
+		syscall(SYS_mbind, base, (unsigned long)GC_ARENA_SIZE, GC_MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+	}
+#	endif
+	gc_arena_count++;
+	a->next = gc_arenas;
+	gc_arenas = a;
+	return a;
+}
+
+static void gc_arena_update_largest( gc_arena *a ) {
+	gc_arena_chunk *c;
+	a->largest = 0;
+	for(c=a->chunks;c;c=c->next)
+		if( c->size > a->largest ) a->largest = c->size;
+}
+
+static void *gc_arena_alloc( int size ) {
+	gc_arena *a;
+	unsigned char *ptr = NULL;
+	if( gc_release_lock ) hl_mutex_acquire(gc_release_lock);
+	for(a=gc_arenas;a;a=a->next)
+		if( a->largest >= size ) break;
+	if( a == NULL ) a = gc_arena_new();
+	if( a ) {
+		gc_arena_chunk *c, **prev = &a->chunks;
+		bool largest;
+		while( (c = *prev)->size < size )
+			prev = &c->next;
+		largest = c->size == a->largest;
+		ptr = c->ptr;
+		c->ptr += size;
+		c->size -= size;
+		if( c->size == 0 ) {
+			*prev = c->next;
+			free(c);
+		}
+		if( largest ) gc_arena_update_largest(a);
+		a->used += size;
+	}
+	if( gc_release_lock ) hl_mutex_release(gc_release_lock);
+	return ptr;
+}
+
+static bool gc_arena_release( void *ptr, int size ) {
+	unsigned char *p = (unsigned char*)ptr;
+	gc_arena *a, **aprev = &gc_arenas;
+	gc_arena_chunk *c, *prev = NULL;
+	if( gc_release_lock ) hl_mutex_acquire(gc_release_lock);
+	for(a=gc_arenas;a;aprev=&a->next,a=a->next)
+		if( p >= a->base && p < a->base + GC_ARENA_SIZE )
+			break;
+	if( a == NULL ) {
+		if( gc_release_lock ) hl_mutex_release(gc_release_lock);
+		return false;
+	}
+	a->used -= size;
+	if( a->used == 0 && (a != gc_arenas || a->next) ) {
+		*aprev = a->next;
+		while( a->chunks ) {
+			c = a->chunks;
+			a->chunks = c->next;
+			free(c);
+		}
+		munmap(a->base, GC_ARENA_SIZE);
+		free(a);
+		if( gc_release_lock ) hl_mutex_release(gc_release_lock);
+		return true;
+	}
+	// insert by address and merge with the neighbours
+	for(c=a->chunks;c && c->ptr < p;prev=c,c=c->next) {
+	}
+	if( prev && prev->ptr + prev->size == p ) {
+		prev->size += size;
+		if( c && p + size == c->ptr ) {
+			prev->size += c->size;
+			prev->next = c->next;
+			free(c);
+		}
+		c = prev;
+	} else if( c && p + size == c->ptr ) {
+		c->ptr = p;
+		c->size += size;
+	} else {
+		c = gc_arena_chunk_new(p, size, c);
+		if( prev ) prev->next = c; else a->chunks = c;
+	}
+	if( c->size > a->largest ) a->largest = c->size;
+	// give back the huge pages that are now entirely free
+	{
+		unsigned char *start = (unsigned char*)(((int_val)c->ptr + GC_HUGE_PAGE_SIZE - 1) & ~(int_val)(GC_HUGE_PAGE_SIZE - 1));
+		unsigned char *end = (unsigned char*)((int_val)(c->ptr + c->size) & ~(int_val)(GC_HUGE_PAGE_SIZE - 1));
+		unsigned char *from = (unsigned char*)((int_val)p & ~(int_val)(GC_HUGE_PAGE_SIZE - 1));
+		unsigned char *to = (unsigned char*)(((int_val)(p + size) + GC_HUGE_PAGE_SIZE - 1) & ~(int_val)(GC_HUGE_PAGE_SIZE - 1));
+		if( start < from ) start = from;
+		if( end > to ) end = to;
+		if( start < end ) madvise(start, end - start, MADV_DONTNEED);
+	}
+	if( gc_release_lock ) hl_mutex_release(gc_release_lock);
+	return true;
+}
 #endif
 
+static int gc_arena_node( void *ptr ) {
+#	if !defined(HL_WIN) && !defined(HL_CONSOLE)
+	gc_arena *a;
+	if( gc_numa_nodes <= 1 ) return -1;
+	for(a=gc_arenas;a;a=a->next)
+		if( (unsigned char*)ptr >= a->base && (unsigned char*)ptr < a->base + GC_ARENA_SIZE )
+			return a->node;
+#	endif
+	return -1;
+}
+
+static void gc_numa_init() {
+#	ifdef HL_LINUX
+	char path[64];
+	while( gc_numa_nodes < 64 ) {
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", gc_numa_nodes);
+		FILE *f = fopen(path, "r");
+		if( !f ) break;
+		fclose(f);
+		gc_numa_nodes++;
+	}
+#	endif
+}
+
+// binds the current thread to the cpus of a NUMA node
+static void gc_numa_run_on( int node ) {
+#	ifdef HL_LINUX
+	char path[64];
+	int from, to;
+	cpu_set_t set;
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(path, "r");
+	if( !f ) return;
+	CPU_ZERO(&set);
+	// format is "0-3,8-11"
+	while( fscanf(f, "%d", &from) == 1 ) {
+		to = from;
+		if( fscanf(f, "-%d", &to) < 0 ) to = from;
+		while( from <= to ) {
+			CPU_SET(from, &set);
+			from++;
+		}
+		if( fgetc(f) != ',' ) break;
+	}
+	fclose(f);
+	sched_setaffinity(0, sizeof(set), &set);
+#	endif
+}
+
 static void *gc_alloc_page_memory( int size ) {
+	void *retained = gc_retained_alloc(size);
+	if( retained ) return retained;
 #if defined(HL_WIN)
 #	if defined(GC_DEBUG) && defined(HL_64)
 #		define STATIC_ADDRESS
@@ -1182,6 +2734,13 @@ static void *gc_alloc_page_memory( int size ) {
 #else
 	static int recursions = 0;
 	int i = 0;
+	if( ((gc_flags & GC_HUGE_PAGES) || gc_numa_nodes > 1) && size <= (GC_ARENA_SIZE >> 2) ) {
+		void *ptr = gc_arena_alloc(size);
+		if( ptr && !gc_will_collide(ptr,size) )
+			return ptr;
+		if( ptr ) gc_arena_release(ptr, size);
+		// fallback to mmap
+	}
 	while( gc_will_collide(base_addr,size) ) {
 		base_addr = (char*)base_addr + GC_PAGE_SIZE;
 		i++;
@@ -1201,8 +2760,10 @@ static void *gc_alloc_page_memory( int size ) {
 			pextra *inf = (pextra*)(offset > (EXTRA_SIZE>>1) ? ((char*)ptr + EXTRA_SIZE - sizeof(pextra)) : (char*)ptr);
 			inf->page_ptr = aligned;
 			inf->base_ptr = ptr;
+			if( gc_release_lock ) hl_mutex_acquire(gc_release_lock);
 			inf->next = extra_pages;
 			extra_pages = inf;
+			if( gc_release_lock ) hl_mutex_release(gc_release_lock);
 			return aligned;
 		}
 		void *tmp;
@@ -1232,20 +2793,27 @@ static void gc_free_page_memory( void *ptr, int size ) {
 #elif defined(HL_CONSOLE)
 	sys_free_align(ptr,size);
 #else
-	pextra *e = extra_pages, *prev = NULL;
+	pextra *e, *prev = NULL;
+	if( gc_arenas && gc_arena_release(ptr, size) )
+		return;
+	if( gc_release_lock ) hl_mutex_acquire(gc_release_lock);
+	e = extra_pages;
 	while( e ) {
 		if( e->page_ptr == ptr ) {
 			if( prev )
 				prev->next = e->next;
 			else
 				extra_pages = e->next;
-			munmap(e->base_ptr, size + EXTRA_SIZE);
-			return;
+			break;
 		}
 		prev = e;
 		e = e->next;
 	}
-	munmap(ptr,size);
+	if( gc_release_lock ) hl_mutex_release(gc_release_lock);
+	if( e )
+		munmap(e->base_ptr, size + EXTRA_SIZE);
+	else
+		munmap(ptr,size);
 #endif
 }
 
@@ -1268,6 +2836,68 @@ vdynamic *hl_alloc_dynbool( bool b ) {
 	return (vdynamic*)(b ? &vdyn_true : &vdyn_false);
 }
 
+// preallocated boxes, shared by all threads : they must never be written
+#define BOX_UI16_MAX	(HL_BOX_INT_MAX < 0xFFFF ? HL_BOX_INT_MAX : 0xFFFF)
+static hl_type hlt_box_ui8 = { HUI8 };
+static hl_type hlt_box_ui16 = { HUI16 };
+static vdynamic vdyn_ints[HL_BOX_INT_MAX - HL_BOX_INT_MIN + 1];
+static vdynamic vdyn_ui8[256];
+static vdynamic vdyn_ui16[BOX_UI16_MAX + 1];
+static const vdynamic vdyn_f64_zero = { &hlt_f64, DYN_PAD {0} };
+static const vdynamic vdyn_f32_zero = { &hlt_f32, DYN_PAD {0} };
+
+static void gc_init_boxes() {
+	int i;
+	for(i=HL_BOX_INT_MIN;i<=HL_BOX_INT_MAX;i++) {
+		vdyn_ints[i - HL_BOX_INT_MIN].t = &hlt_i32;
+		vdyn_ints[i - HL_BOX_INT_MIN].v.i = i;
+	}
+	for(i=0;i<256;i++) {
+		vdyn_ui8[i].t = &hlt_box_ui8;
+		vdyn_ui8[i].v.i = i;
+	}
+	for(i=0;i<=BOX_UI16_MAX;i++) {
+		vdyn_ui16[i].t = &hlt_box_ui16;
+		vdyn_ui16[i].v.i = i;
+	}
+}
+
+HL_API vdynamic *hl_dyn_boxes( hl_type *t, int *min, int *max ) {
+	// the box of *min, the following ones up to *max are contiguous
+	switch( t->kind ) {
+	case HI32:
+		*min = HL_BOX_INT_MIN;
+		*max = HL_BOX_INT_MAX;
+		return vdyn_ints;
+	case HUI8:
+		*min = 0;
+		*max = 255;
+		return vdyn_ui8;
+	case HUI16:
+		*min = 0;
+		*max = BOX_UI16_MAX;
+		return vdyn_ui16;
+	case HF32:
+		*min = *max = 0; // +0.0 only
+		return (vdynamic*)&vdyn_f32_zero;
+	case HF64:
+		*min = *max = 0;
+		return (vdynamic*)&vdyn_f64_zero;
+	default:
+		return NULL;
+	}
+}
+
+HL_API vdynamic *hl_alloc_dynint( hl_type *t, int v ) {
+	int min, max;
+	vdynamic *d = hl_dyn_boxes(t,&min,&max);
+	if( d && v >= min && v <= max )
+		return d + (v - min);
+	d = hl_alloc_dynamic(t);
+	d->v.i = v;
+	return d;
+}
+
 
 vdynamic *hl_alloc_obj( hl_type *t ) {
 	vobj *o;
@@ -1313,6 +2943,12 @@ HL_API void hl_gc_stats( double *total_allocated, double *allocation_count, doub
 	*current_memory = (double)gc_stats.pages_total_memory;
 }
 
+HL_API void hl_gc_compact_stats( double *fragmentation, double *moved, double *released ) {
+	*fragmentation = gc_compact_stats.fragmentation;
+	*moved = (double)gc_compact_stats.moved;
+	*released = (double)gc_compact_stats.released;
+}
+
 HL_API void hl_gc_enable( bool b ) {
 	gc_is_active = b;
 }
@@ -1321,10 +2957,92 @@ HL_API int hl_gc_get_flags() {
 	return gc_flags;
 }
 
+HL_API void hl_gc_safepoint() {
+	// called by the JIT code when it sees stopping_world : park until the collection is done
+	if( !current_thread ) return;
+	gc_global_lock(true);
+	gc_global_lock(false);
+}
+
+HL_API void hl_gc_stop_world( bool stop ) {
+	// the other threads are parked at a safepoint or blocking until the world is released : lets the JIT patch code they could be running
+	if( stop ) {
+		gc_global_lock(true);
+		gc_stop_world(true);
+	} else {
+		gc_stop_world(false);
+		gc_global_lock(false);
+	}
+}
+
+HL_API void hl_gc_release_regions() {
+	// the JIT code bumps the thread regions without tracking : empty them when the allocation tracking starts
+	int i;
+	gc_global_lock(true);
+	gc_stop_world(true);
+	for(i=0;i<gc_threads.count;i++)
+		gc_region_release(gc_threads.threads[i]);
+	gc_stop_world(false);
+	gc_global_lock(false);
+}
+
+HL_API bool hl_gc_use_write_barrier() {
+	if( !(gc_flags & (GC_GENERATIONAL|GC_CONCURRENT)) )
+		return false;
+	if( !gc_cards_enabled ) {
+		gc_global_lock(true);
+		gc_iter_pages(gc_alloc_cards);
+		gc_cards_enabled = true;
+		gc_stats.major_memory = 0; // the next collection needs to be a full one
+		gc_global_lock(false);
+	}
+	return true;
+}
+
+HL_API int hl_gc_thread_offset() {
+	// JIT inline allocation : where hl_thread_info is found from the FS base, 0 if not supported
+#	ifdef GC_INLINE_ALLOC
+	char *tp;
+	__asm__("mov %%fs:0, %0" : "=r"(tp));
+	return (int)((char*)&current_thread - tp);
+#	else
+	return 0;
+#	endif
+}
+
 HL_API void hl_gc_set_flags( int f ) {
 	gc_flags = f;
 }
 
+HL_API void hl_gc_last_event( hl_gc_event *e ) {
+	gc_global_lock(true);
+	*e = gc_last_event;
+	gc_global_lock(false);
+}
+
+HL_API void hl_gc_set_decommit_delay( int ms ) {
+	// negative : pages are released as soon as they are empty
+	gc_decommit_delay = ms;
+	if( ms < 0 && gc_retained_pages ) gc_decommit_idle(true);
+}
+
+HL_API void hl_gc_set_heap_limit( double bytes ) {
+	gc_heap_limit = (int64)bytes;
+}
+
+HL_API void hl_gc_set_pacer( int gogc, double max_pause_ms, double cpu_percent ) {
+	// gogc <= 0 : go back to the fixed threshold
+	gc_pacer_gogc = gogc;
+	gc_pacer_pause = (int64)(max_pause_ms * 1000);
+	gc_pacer_cpu = cpu_percent / 100.;
+	gc_pacer_scale = 1.;
+}
+
+HL_API void hl_gc_set_compact( int percent ) {
+	// 0 : never move blocks
+	gc_compact_percent = percent;
+}
+
 HL_API void hl_set_thread_flags( int flags, int mask ) {
 	hl_thread_info *t = hl_get_thread();
 	t->flags = (t->flags & ~mask) | flags;
@@ -1383,7 +3101,7 @@ HL_API void hl_gc_dump_memory( const char *filename ) {
 	int i;
 	gc_global_lock(true);
 	gc_stop_world(true);
-	gc_mark();
+	gc_mark(false);
 	fdump = fopen(filename,"wb");
 
 	// header
@@ -1471,7 +3189,7 @@ HL_API int hl_gc_get_live_objects( hl_type *t, varray *arr ) {
 	if( !hl_is_dynamic(t) ) return -1;
 	gc_global_lock(true);
 	gc_stop_world(true);
-	gc_mark();
+	gc_mark(false);
 
 	live_obj.t = t;
 	live_obj.count = 0;
@@ -1502,10 +3220,15 @@ DEFINE_PRIM(_VOID, gc_major, _NO_ARG);
 DEFINE_PRIM(_VOID, gc_enable, _BOOL);
 DEFINE_PRIM(_VOID, gc_profile, _BOOL);
 DEFINE_PRIM(_VOID, gc_stats, _REF(_F64) _REF(_F64) _REF(_F64));
+DEFINE_PRIM(_VOID, gc_compact_stats, _REF(_F64) _REF(_F64) _REF(_F64));
 DEFINE_PRIM(_VOID, gc_dump_memory, _BYTES);
 DEFINE_PRIM(_I32, gc_get_live_objects, _TYPE _ARR);
 DEFINE_PRIM(_I32, gc_get_flags, _NO_ARG);
 DEFINE_PRIM(_VOID, gc_set_flags, _I32);
+DEFINE_PRIM(_VOID, gc_set_decommit_delay, _I32);
+DEFINE_PRIM(_VOID, gc_set_heap_limit, _F64);
+DEFINE_PRIM(_VOID, gc_set_pacer, _I32 _F64 _F64);
+DEFINE_PRIM(_VOID, gc_set_compact, _I32);
 DEFINE_PRIM(_DYN, debug_call, _I32 _DYN);
 DEFINE_PRIM(_VOID, blocking, _BOOL);
 DEFINE_PRIM(_VOID, set_thread_flags, _I32 _I32);
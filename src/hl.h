@@ -593,6 +593,8 @@ HL_API bool hl_safe_cast( hl_type *t, hl_type *to );
 HL_API varray *hl_alloc_array( hl_type *t, int size );
 HL_API vdynamic *hl_alloc_dynamic( hl_type *t );
 HL_API vdynamic *hl_alloc_dynbool( bool b );
+HL_API vdynamic *hl_alloc_dynint( hl_type *t, int v );
+HL_API vdynamic *hl_dyn_boxes( hl_type *t, int *min, int *max );
 HL_API vdynamic *hl_alloc_obj( hl_type *t );
 HL_API venum *hl_alloc_enum( hl_type *t, int index );
 HL_API vvirtual *hl_alloc_virtual( hl_type *t );
@@ -629,6 +631,23 @@ HL_API void hl_init_virtual( hl_type *vt, hl_module_context *ctx );
 HL_API hl_field_lookup *hl_lookup_find( hl_field_lookup *l, int size, int hash );
 HL_API hl_field_lookup *hl_lookup_insert( hl_field_lookup *l, int size, int hash, hl_type *t, int index );
 
+#define HL_FIELD_CACHE_SIZE	4
+
+typedef struct {
+	hl_type *t;
+	int_val offset; // > 0 : field offset in the object, < 0 : offset of the field address in the virtual
+} hl_field_cache_entry;
+
+typedef struct {
+	hl_field_cache_entry entries[HL_FIELD_CACHE_SIZE];
+	hl_type *t;
+	int hfield;
+	int count;
+	bool set;
+} hl_field_cache;
+
+HL_API void *hl_dyn_cache_field( vdynamic *d, hl_field_cache *c );
+
 HL_API int hl_dyn_geti( vdynamic *d, int hfield, hl_type *t );
 HL_API int64 hl_dyn_geti64( vdynamic *d, int hfield );
 HL_API void *hl_dyn_getp( vdynamic *d, int hfield, hl_type *t );
@@ -753,6 +772,35 @@ HL_API void hl_remove_root( void *ptr );
 HL_API void hl_gc_major( void );
 HL_API bool hl_is_gc_ptr( void *ptr );
 HL_API int hl_gc_get_memsize( void *ptr );
+HL_API bool hl_gc_use_write_barrier( void );
+HL_API void hl_gc_write_barrier( void *ptr );
+HL_API void hl_gc_safepoint( void );
+HL_API int hl_gc_thread_offset( void );
+HL_API void hl_gc_stop_world( bool stop );
+HL_API void hl_gc_release_regions( void );
+
+#define HL_GC_EVENT_THREADS	16
+
+// timings of a collection, in nanoseconds
+typedef struct {
+	int64 time;
+	int kind; // 0 = major, 1 = minor, 2 = concurrent major
+	int mark_threads;
+	int64 pause;
+	int64 stop_world;
+	int64 roots;
+	int64 mark;
+	int64 thread_mark[HL_GC_EVENT_THREADS];
+	int64 flush;
+	int64 finalizers; // run since the previous collection
+	int finalized;
+	int pages_freed; // since the previous collection
+	int64 marked_bytes;
+	int64 marked_objects;
+	int64 heap_memory;
+} hl_gc_event;
+
+HL_API void hl_gc_last_event( hl_gc_event *e );
 
 HL_API void hl_blocking( bool b );
 HL_API bool hl_is_blocking( void );
@@ -777,6 +825,16 @@ HL_API void hl_global_lock( bool lock );
 HL_API void *hl_alloc_executable_memory( int size );
 HL_API void hl_free_executable_memory( void *ptr, int size );
 
+// pointer slots of a JIT frame at a call site
+typedef struct {
+	int ret; // return address, relative to the code start
+	int depth; // bytes between the callee frame and the caller frame pointer
+	int locals; // size of the locals area, below the caller frame pointer
+	int bits; // first bit of the locals bitmap, one per word
+} hl_stack_map;
+
+HL_API void hl_gc_add_stack_maps( void *code, int code_size, hl_stack_map *maps, int count, unsigned int *bits, int nbits );
+
 // ----------------------- BUFFER --------------------------------------------------
 
 typedef struct hl_buffer hl_buffer;
@@ -893,6 +951,14 @@ struct _hl_trap_ctx {
 #define hl_trap(ctx,r,label) { hl_thread_info *__tinf = hl_get_thread(); ctx.tcheck = NULL; ctx.prev = __tinf->trap_current; __tinf->trap_current = &ctx; if( setjmp(ctx.buf) ) { r = __tinf->exc_value; goto label; } }
 #define hl_endtrap(ctx)	hl_get_thread()->trap_current = ctx.prev
 
+// registered by the JIT functions having a try block, instead of a setjmp per try
+typedef struct _hl_jit_frame hl_jit_frame;
+struct _hl_jit_frame {
+	hl_jit_frame *prev;
+	void *handler; // landing pad of the current try, NULL if none : the word before it is the tcheck global address
+	void *regs[5]; // callee saved registers at the function entry
+};
+
 #define HL_EXC_MAX_STACK	0x100
 #define HL_EXC_RETHROW		1
 #define HL_EXC_CATCH_ALL	2
@@ -909,6 +975,20 @@ struct _hl_trap_ctx {
 #define HL_TRACK_MASK		(HL_TRACK_ALLOC | HL_TRACK_CAST | HL_TRACK_DYNFIELD | HL_TRACK_DYNCALL)
 
 #define HL_MAX_EXTRA_STACK 64
+// i32 and ui16 values boxed without allocation, ui8 ones always are
+#ifndef HL_BOX_INT_MIN
+#	define HL_BOX_INT_MIN	(-128)
+#endif
+#ifndef HL_BOX_INT_MAX
+#	define HL_BOX_INT_MAX	1023
+#endif
+#define HL_GC_REGIONS 16
+#define HL_GC_REGION_WORDS 5 // size classes (1 to 5 words) allocated from a thread region, per page kind
+
+typedef struct {
+	unsigned char *cur;
+	unsigned char *end;
+} hl_gc_region;
 
 typedef struct {
 	int thread_id;
@@ -929,6 +1009,10 @@ typedef struct {
 	void *exc_stack_trace[HL_EXC_MAX_STACK];
 	void *extra_stack_data[HL_MAX_EXTRA_STACK];
 	int extra_stack_size;
+	// thread-local allocation regions, owned by the GC
+	hl_gc_region gc_regions[HL_GC_REGIONS];
+	void *stack_frame;
+	hl_jit_frame *jit_frames;
 	#ifdef HL_MAC
 	thread_t mach_thread_id;
 	pthread_t pthread_id;
@@ -93,18 +93,39 @@ typedef struct {
 	hl_native*	natives;
 	hl_function*functions;
 	hl_constant*constants;
+	uint64		digest; // hash of the bytecode, identifies it in the JIT cache
 	hl_alloc	alloc;
 	hl_alloc	falloc;
 } hl_code;
 
+typedef struct {
+	int start; // code of the inlined function, relative to the start of its caller
+	int end;
+	int fidx;
+	int offsets; // index of the offsets of its opcodes in the table following the inlined calls
+} hl_debug_inline;
+
 typedef struct {
 	void *offsets;
 	int start;
 	bool large;
+	int ninlines;
+	hl_debug_inline *inlines; // the calls inlined by the JIT, in code order
 } hl_debug_infos;
 
 typedef struct jit_ctx jit_ctx;
 
+typedef struct {
+	hl_debug_infos debug;
+	int fidx;
+} hl_jit_block;
+
+typedef struct {
+	int count; // decremented by the baseline code at each call and loop iteration
+	int tier;
+	void **sites; // per opcode data collected by the baseline code
+} hl_jit_profile;
+
 
 typedef struct {
 	hl_code *code;
@@ -127,6 +148,14 @@ typedef struct {
 	hl_code_hash *hash;
 	hl_debug_infos *jit_debug;
 	jit_ctx *jit_ctx;
+	hl_jit_profile *jit_profile;
+	int jit_threshold;
+	int jit_reserved; // lazy mode : size of the code region, the functions are compiled on their first call
+	int jit_stubs; // lazy mode : end of the stubs in the code, the functions are appended after
+	hl_jit_block *jit_blocks; // lazy mode : the compiled functions, in code order
+	int jit_blocks_count;
+	int jit_inline; // max size in opcodes of the functions inlined in their callers, 0 if disabled
+	char *jit_cache; // path of the JIT cache file, the addresses in the code are recorded when set
 	hl_module_context ctx;
 } hl_module;
 
@@ -147,6 +176,8 @@ hl_module *hl_module_alloc( hl_code *code );
 int hl_module_init( hl_module *m, h_bool hot_reload );
 h_bool hl_module_patch( hl_module *m, hl_code *code );
 void hl_module_free( hl_module *m );
+void hl_module_tier_up( hl_module *m, int fid );
+void *hl_module_compile( hl_module *m, int fid );
 h_bool hl_module_debug( hl_module *m, int port, h_bool wait );
 
 void hl_profile_setup( int sample_count );
@@ -156,6 +187,11 @@ jit_ctx *hl_jit_alloc();
 void hl_jit_free( jit_ctx *ctx, h_bool can_reset );
 void hl_jit_reset( jit_ctx *ctx, hl_module *m );
 void hl_jit_init( jit_ctx *ctx, hl_module *m );
+void hl_jit_init_part( jit_ctx *ctx, hl_module *m );
+int hl_jit_merge( jit_ctx *ctx, jit_ctx *part );
 int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f );
+int hl_jit_lazy_stub( jit_ctx *ctx, hl_module *m, hl_function *f );
 void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **debug, hl_module *previous );
+void hl_jit_save( jit_ctx *ctx, hl_module *m );
+h_bool hl_jit_load( hl_module *m );
 void hl_jit_patch_method( void *old_fun, void **new_fun_table );
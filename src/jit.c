@@ -22,8 +22,8 @@
 #ifdef _MSC_VER
 #pragma warning(disable:4820)
 #endif
-#include <math.h>
 #include <hlmodule.h>
+#include <math.h>
 
 #ifdef __arm__
 #	error "JIT does not support ARM processors, only x86 and x86-64 are supported, please use HashLink/C native compilation instead"
@@ -101,6 +101,7 @@ typedef enum {
 	MULSS,
 	DIVSS,
 	XORPD,
+	MOVAPD,
 	CVTSI2SD,
 	CVTSI2SS,
 	CVTSD2SI,
@@ -154,6 +155,8 @@ typedef enum {
 #else
 #	define W64(wv)	W(wv)
 #endif
+// a constant made by pref : its position is recorded for the cache
+#define W64REF(r,wv)	do { if( (r)->id == (int)JIT_REF ) add_ref(ctx,(r)->lock & 15,(r)->lock >> 4); W64(wv); } while(0)
 
 static const int SIB_MULT[] = {-1, 0, 1, -1, 2, -1, -1, -1, 3};
 
@@ -190,6 +193,45 @@ struct jlist {
 	jlist *next;
 };
 
+typedef enum {
+	REF_PTR,		// resolved into one of the kinds below when saving
+	REF_STRING,		// index of the string constant
+	REF_BYTES,		// index of the bytes constant
+	REF_CLOSURE,	// static closure, index in the saved closures
+	REF_CACHE,		// dynamic field cache, index in the saved caches
+	REF_HASH,		// field name to register, not in the code
+	REF_CODE,		// offset in the module code
+	REF_TYPE,		// offset in the module types
+	REF_GLOBAL,		// offset in the module globals
+	REF_MODULE,
+	REF_IMAGE,		// offset from the anchor of a native image
+} ref_kind;
+
+typedef struct {
+	int op;			// the OTrap
+	int prev;		// enclosing try, -1 if none
+	int pos;		// landing pad
+	void *check;	// global holding the caught class, NULL if unknown
+} jit_trap;
+
+typedef struct {
+	int fid;		// the inlined function
+	int *ops;		// position of each of its opcodes in the compiled function, followed by the end of its copy
+} jit_inline;
+
+typedef struct {
+	int site;		// inlined call, -1 for the opcodes of the function itself
+	int pos;		// position of the opcode in the bytecode of its function
+} jit_origin;
+
+typedef struct jref jref;
+struct jref {
+	int pos;
+	int kind;
+	int index;
+	jref *next;
+};
+
 typedef struct vreg vreg;
 
 typedef enum {
@@ -258,6 +300,7 @@ static const int RCPU_SCRATCH_REGS[] = { Eax, Ecx, Edx };
 
 #define ID2(a,b)	((a) | ((b)<<8))
 #define R(id)		(ctx->vregs + (id))
+#define SUNK(id)	(ctx->sink && ctx->sink[id].base)
 #define ASSERT(i)	{ printf("JIT ERROR %d (jit.c line %d)\n",i,(int)__LINE__); jit_exit(); }
 #define IS_FLOAT(r)	((r)->t->kind == HF64 || (r)->t->kind == HF32)
 #define RLOCK(r)		if( (r)->lock < ctx->currentPos ) (r)->lock = ctx->currentPos
@@ -272,6 +315,12 @@ static const int RCPU_SCRATCH_REGS[] = { Eax, Ecx, Edx };
 static preg _unused = { RUNUSED, 0, 0, NULL };
 static preg *UNUSED = &_unused;
 
+typedef struct {
+	int base; // first vreg holding the value of a sunk allocation, 0 if it escapes
+	int count;
+	int findex; // OInstanceClosure : the function OCallClosure will call directly
+} sink_reg;
+
 struct jit_ctx {
 	union {
 		unsigned char *b;
@@ -285,6 +334,9 @@ struct jit_ctx {
 	vreg *savedRegs[REG_COUNT];
 	int savedLocks[REG_COUNT];
 	int *opsPos;
+	vreg ***labelRegs; // registers known at each jump target, NULL if we discard them
+	int *loopEnd;
+	bool *loopRegs;
 	int maxRegs;
 	int maxOps;
 	int bufSize;
@@ -295,17 +347,48 @@ struct jit_ctx {
 	int nativeArgsCount;
 	unsigned char *startBuf;
 	hl_module *m;
-	hl_function *f;
+	hl_function *f; // the compiled function : a copy of the bytecode if some calls were inlined
+	int fid;
 	jlist *jumps;
 	jlist *calls;
 	jlist *switchs;
+	jlist *coderefs; // rip relative accesses to the start of the code
+	jref *refs; // addresses in the code, recorded for the cache
 	hl_alloc falloc; // cleared per-function
 	hl_alloc galloc;
 	vclosure *closure_list;
 	hl_debug_infos *debug;
+	hl_stack_map *stackMaps;
+	int stackMapsCount;
+	int stackMapsMax;
+	unsigned int *stackBits;
+	int stackBitsCount;
+	int stackBitsMax;
+	int frameBits;
+	int trapDepth;
+	int callRet;
 	int c2hl;
 	int hl2c;
 	int longjump;
+	int lazy;
+	bool gc_barrier;
+	bool *gc_poll;
+	int gc_thread; // TLS offset of the current hl_thread_info, 0 if allocations and traps can't use it
+	hl_jit_profile *profile; // NULL if the module isn't tiered
+	bool baseline; // first tier : counts calls and loop iterations, collects the profile
+	sink_reg *sink; // per register, NULL if no allocation was sunk
+	hl_type **sinkTypes; // types of the vregs after the scratch one
+	jit_trap *traps; // per OTrap, NULL if the function uses setjmp traps
+	jlist *trapRefs; // LEA of the landing pads, target is the trap index
+	int trapCount;
+	int trapFrame; // stack position of the hl_jit_frame
+	int trapCurrent;
+	int trapExit;
+	jit_inline *inlines; // calls inlined in the function
+	int inlineCount;
+	int *inlinePos; // position of each opcode of the bytecode in the compiled function, NULL if nothing was inlined
+	jit_origin *inlineOrigins; // per compiled opcode
+	unsigned char *inlineOverrides; // per function index, set if a subclass overrides this method
 	void *static_functions[8];
 };
 
@@ -367,6 +450,45 @@ static preg *pconst64( preg *r, int_val c ) {
 #endif
 }
 
+#define JIT_REF	0xC064CAFE
+
+static preg *pref( preg *r, void *ptr, ref_kind kind, int index ) {
+	// an address, always emitted on 64 bits so that the cache can relocate it
+#ifdef HL_64
+	if( ptr == NULL )
+		return pconst(r,0);
+	r->kind = RCONST;
+	r->id = JIT_REF;
+	r->lock = kind | (index << 4);
+	r->holds = (vreg*)ptr;
+	return r;
+#else
+	return pconst64(r,(int_val)ptr);
+#endif
+}
+
+static preg *pptr( preg *r, void *ptr ) {
+	return pref(r,ptr,REF_PTR,0);
+}
+
+static void add_ref( jit_ctx *ctx, int kind, int index ) {
+	jref *r;
+	if( !ctx->m->jit_cache )
+		return;
+	r = (jref*)hl_malloc(&ctx->galloc,sizeof(jref));
+	r->pos = kind == REF_HASH ? -1 : BUF_POS();
+	r->kind = kind;
+	r->index = index;
+	r->next = ctx->refs;
+	ctx->refs = r;
+}
+
+static int field_hash( jit_ctx *ctx, int sindex ) {
+	// the name is registered for hl_field_name, which the cache has to do again
+	add_ref(ctx,REF_HASH,sindex);
+	return hl_hash_gen(hl_get_ustring(ctx->m->code,sindex),true);
+}
+
 #ifndef HL_64
 // it is not possible to access direct 64 bit address in x86-64
 static preg *paddr( preg *r, void *p ) {
@@ -397,8 +519,8 @@ static void restore_regs( jit_ctx *ctx ) {
 	}
 }
 
-static void jit_buf( jit_ctx *ctx ) {
-	if( BUF_POS() > ctx->bufSize - MAX_OP_SIZE ) {
+static void jit_buf_size( jit_ctx *ctx, int size ) {
+	if( BUF_POS() > ctx->bufSize - size ) {
 		int nsize = ctx->bufSize * 4 / 3;
 		unsigned char *nbuf;
 		int curpos;
@@ -408,7 +530,7 @@ static void jit_buf( jit_ctx *ctx ) {
 				nsize += ctx->m->code->functions[i].nops;
 			nsize *= 4;
 		}
-		if( nsize < ctx->bufSize + MAX_OP_SIZE * 4 ) nsize = ctx->bufSize + MAX_OP_SIZE * 4;
+		if( nsize < ctx->bufSize + size * 4 ) nsize = ctx->bufSize + size * 4;
 		curpos = BUF_POS();
 		nbuf = (unsigned char*)malloc(nsize);
 		if( nbuf == NULL ) ASSERT(nsize);
@@ -422,6 +544,19 @@ static void jit_buf( jit_ctx *ctx ) {
 	}
 }
 
+static void jit_buf( jit_ctx *ctx ) {
+	jit_buf_size(ctx, MAX_OP_SIZE);
+}
+
+static void *jit_module_alloc( jit_ctx *ctx, int size ) {
+	// the functions of a module might be compiled by several threads
+	void *p;
+	hl_global_lock(true);
+	p = hl_zalloc(&ctx->m->ctx.alloc,size);
+	hl_global_lock(false);
+	return p;
+}
+
 static const char *KNAMES[] = { "cpu","fpu","stack","const","addr","mem","unused" };
 #define ERRIF(c)	if( c ) { printf("%s(%s,%s)\n",f?f->name:"???",KNAMES[a->kind], KNAMES[b->kind]); ASSERT(0); }
 
@@ -492,6 +627,7 @@ static opform OP_FORMS[_CPU_LAST] = {
 	{ "MULSS", 0xF30F59 },
 	{ "DIVSS", 0xF30F5E },
 	{ "XORPD", 0x660F57 },
+	{ "MOVAPD", 0x660F28 },
 	{ "CVTSI2SD", 0xF20F2A },
 	{ "CVTSI2SS", 0xF30F2A },
 	{ "CVTSD2SI", 0xF20F2D },
@@ -615,11 +751,11 @@ static void op( jit_ctx *ctx, CpuOp o, preg *a, preg *b, bool mode64 ) {
 				if( (f->r_i8&FLAG_DUAL) && a->id > 7 ) r64 |= 4; 
 				OP(f->r_const&0xFF);
 				if( (f->r_i8&FLAG_DUAL) ) MOD_RM(3,a->id,a->id); else MOD_RM(3,GET_RM(f->r_const)-1,a->id);
-				if( mode64 && IS_64 && o == MOV ) W64(cval); else W((int)cval);
+				if( mode64 && IS_64 && o == MOV ) W64REF(b,cval); else W((int)cval);
 			} else {
 				ERRIF( f->r_const == 0);
 				OP((f->r_const&0xFF) + (a->id&7));
-				if( mode64 && IS_64 && o == MOV ) W64(cval); else W((int)cval);
+				if( mode64 && IS_64 && o == MOV ) W64REF(b,cval); else W((int)cval);
 			}
 		}
 		break;
@@ -819,6 +955,7 @@ static void op( jit_ctx *ctx, CpuOp o, preg *a, preg *b, bool mode64 ) {
 	default:
 		ERRIF(1);
 	}
+	if( o == CALL ) ctx->callRet = BUF_POS();
 	if( ctx->debug && ctx->f && o == CALL ) {
 		preg p;
 		op(ctx,MOV,pmem(&p,Esp,-HL_WSIZE),PEBP,true); // erase EIP (clean stack report)
@@ -1163,6 +1300,9 @@ static preg *copy( jit_ctx *ctx, preg *to, preg *from, int size ) {
 		}
 		return to->kind == RCPU ? to : from;
 	case ID2(RFPU,RFPU):
+		// copy the whole register : MOVSD would depend on the previous value of <to>
+		op64(ctx,MOVAPD,to,from);
+		return to;
 	case ID2(RMEM,RFPU):
 	case ID2(RSTACK,RFPU):
 	case ID2(RFPU,RMEM):
@@ -1501,6 +1641,44 @@ static int prepare_call_args( jit_ctx *ctx, int count, int *args, vreg *vregs, i
 	return paddedSize;
 }
 
+#ifdef HL_64
+static hl_stack_map *alloc_stack_map( jit_ctx *ctx ) {
+	if( ctx->stackMapsCount == ctx->stackMapsMax ) {
+		int nmax = ctx->stackMapsMax ? ctx->stackMapsMax << 1 : 256;
+		hl_stack_map *maps = (hl_stack_map*)malloc(sizeof(hl_stack_map) * nmax);
+		memcpy(maps,ctx->stackMaps,sizeof(hl_stack_map) * ctx->stackMapsCount);
+		free(ctx->stackMaps);
+		ctx->stackMaps = maps;
+		ctx->stackMapsMax = nmax;
+	}
+	return ctx->stackMaps + ctx->stackMapsCount++;
+}
+
+static void alloc_stack_bits( jit_ctx *ctx, int nbits ) {
+	int need = (ctx->stackBitsCount + nbits + 31) >> 5;
+	if( need > ctx->stackBitsMax ) {
+		int nmax = ctx->stackBitsMax ? ctx->stackBitsMax << 1 : 1024;
+		unsigned int *bits;
+		while( nmax < need ) nmax <<= 1;
+		bits = (unsigned int*)malloc(sizeof(int) * nmax);
+		memcpy(bits,ctx->stackBits,sizeof(int) * ctx->stackBitsMax);
+		memset(bits + ctx->stackBitsMax,0,sizeof(int) * (nmax - ctx->stackBitsMax));
+		free(ctx->stackBits);
+		ctx->stackBits = bits;
+		ctx->stackBitsMax = nmax;
+	}
+}
+
+static void register_stack_map( jit_ctx *ctx, int size ) {
+	// at the call, all vregs are in their stack slots and esp is at ebp - depth
+	hl_stack_map *m = alloc_stack_map(ctx);
+	m->ret = ctx->callRet;
+	m->depth = ctx->totalRegsSize + ctx->trapDepth * ((sizeof(hl_trap_ctx) + 15) & 0xFFF0) + size;
+	m->locals = ctx->totalRegsSize;
+	m->bits = ctx->frameBits;
+}
+#endif
+
 static void op_call( jit_ctx *ctx, preg *r, int size ) {
 	preg p;
 #	ifdef JIT_DEBUG
@@ -1518,6 +1696,9 @@ static void op_call( jit_ctx *ctx, preg *r, int size ) {
 		if( size >= 0 ) size += 32;
 	}
 	op32(ctx, CALL, r, UNUSED);
+#	ifdef HL_64
+	if( ctx->f && size >= 0 ) register_stack_map(ctx, size);
+#	endif
 	if( size > 0 ) op64(ctx,ADD,PESP,pconst(&p,size));
 }
 
@@ -1525,7 +1706,7 @@ static void call_native( jit_ctx *ctx, void *nativeFun, int size ) {
 	bool isExc = nativeFun == hl_assert || nativeFun == hl_throw || nativeFun == on_jit_error;
 	preg p;
 	// native function, already resolved
-	op64(ctx,MOV,PEAX,pconst64(&p,(int_val)nativeFun));
+	op64(ctx,MOV,PEAX,pptr(&p,nativeFun));
 	op_call(ctx,PEAX, isExc ? -1 : size);
 	if( isExc )
 		return;
@@ -1546,12 +1727,16 @@ static void op_call_fun( jit_ctx *ctx, vreg *dst, int findex, int count, int *ar
 #		ifdef JIT_DEBUG
 		if( IS_64 ) cpos += 13; // ESP CHECK
 #		endif
-		if( ctx->m->functions_ptrs[findex] ) {
-			// already compiled
-			op_call(ctx,pconst(&p,(int)(int_val)ctx->m->functions_ptrs[findex] - (cpos + 5)), size);
-		} else if( ctx->m->code->functions + fid == ctx->f ) {
+		if( fid == ctx->fid ) {
 			// our current function
 			op_call(ctx,pconst(&p, ctx->functionPos - (cpos + 5)), size);
+		} else if( ctx->m->jit_code ) {
+			// recompiling a hot function : the others already have their final address
+			op64(ctx,MOV,PEAX,pconst64(&p,(int_val)ctx->m->functions_ptrs[findex]));
+			op_call(ctx,PEAX,size);
+		} else if( ctx->m->functions_ptrs[findex] ) {
+			// already compiled
+			op_call(ctx,pconst(&p,(int)(int_val)ctx->m->functions_ptrs[findex] - (cpos + 5)), size);
 		} else {
 			// stage for later
 			jlist *j = (jlist*)hl_malloc(&ctx->galloc,sizeof(jlist));
@@ -1613,12 +1798,13 @@ static void op_ret( jit_ctx *ctx, vreg *r ) {
 }
 
 static void call_native_consts( jit_ctx *ctx, void *nativeFun, int_val *args, int nargs ) {
+	// the first argument is an address (type, message), the others are ints
 	int size = pad_before_call(ctx, IS_64 ? 0 : HL_WSIZE*nargs);
 	preg p;
 	int i;
 #	ifdef HL_64
 	for(i=0;i<nargs;i++)
-		op64(ctx, MOV, REG_AT(CALL_REGS[i]), pconst64(&p, args[i]));
+		op64(ctx, MOV, REG_AT(CALL_REGS[i]), i == 0 ? pptr(&p, (void*)args[i]) : pconst64(&p, args[i]));
 #	else
 	for(i=nargs-1;i>=0;i--)
 		op32(ctx, PUSH, pconst64(&p, args[i]), UNUSED);
@@ -1626,6 +1812,366 @@ static void call_native_consts( jit_ctx *ctx, void *nativeFun, int_val *args, in
 	call_native(ctx, nativeFun, size);
 }
 
+static void gc_write_barrier( jit_ctx *ctx, preg *addr, vreg *v ) {
+	// ASM for --> if( v ) hl_gc_write_barrier(addr)
+	int jnull, size;
+	if( !ctx->gc_barrier || !hl_is_ptr(v->t) )
+		return;
+	preg *r = alloc_cpu(ctx, v, true);
+	op64(ctx,TEST,r,r);
+	XJump_small(JZero,jnull);
+	size = begin_native_call(ctx, 1);
+	set_native_arg(ctx, addr);
+	call_native(ctx, hl_gc_write_barrier, size);
+	patch_jump(ctx,jnull);
+}
+
+static void reload_saved_regs( jit_ctx *ctx ) {
+	int i;
+	for(i=0;i<REG_COUNT;i++) {
+		vreg *v = ctx->savedRegs[i];
+		if( v ) copy(ctx, REG_AT(i), &v->stack, v->size);
+	}
+	restore_regs(ctx);
+}
+
+static void gc_safepoint( jit_ctx *ctx ) {
+	// ASM for --> if( *gc_poll ) hl_gc_safepoint()
+	// emitted at function entries and loop heads so a thread that doesn't allocate can't hold a collection
+	// the registers are kept : the slow path reloads them from the stack after the call
+	int jskip, size;
+	preg p, *r;
+	if( !ctx->gc_poll )
+		return;
+	r = alloc_reg(ctx, RCPU_8BITS);
+	op64(ctx,MOV,r,pptr(&p,ctx->gc_poll));
+	op32(ctx,MOV8,r,pmem(&p,r->id,0));
+	op32(ctx,TEST8,r,r);
+	XJump(JZero,jskip);
+	save_regs(ctx);
+	size = begin_native_call(ctx, 0);
+	call_native(ctx, hl_gc_safepoint, size);
+	reload_saved_regs(ctx);
+	patch_jump(ctx,jskip);
+	RUNLOCK(r);
+}
+
+#ifdef HL_64
+static void jit_thread( jit_ctx *ctx ) {
+	// mov r11, fs:[gc_thread]
+	scratch(REG_AT(R11));
+	B(0x64);
+	B(0x4C);
+	B(0x8B);
+	B(0x1C);
+	B(0x25);
+	W(ctx->gc_thread);
+}
+#endif
+
+static int gc_alloc_inline( jit_ctx *ctx, hl_type *t, int size, int kind, bool header ) {
+	// ASM for --> if( th && !th->gc_blocking && r->cur + size <= r->end ) { eax = r->cur; r->cur += size; zero(eax); eax->t = t } else <slow path>
+	// the region r = th->gc_regions[kind,size] is only refilled by the slow path, which also handles the black allocation
+	// returns the jump to patch after the slow path, 0 if the allocation must always call it
+#	ifdef HL_64
+	int jnull, jblock, jproto, jfull, jdone, k;
+	int region, roff;
+	preg p;
+	preg *th = REG_AT(R11), *tmp = REG_AT(R10), *cur = PEAX;
+	size = (size + HL_WSIZE - 1) & ~(HL_WSIZE - 1);
+	if( !ctx->gc_thread || size == 0 || size > HL_GC_REGION_WORDS * HL_WSIZE )
+		return 0;
+	region = kind * HL_GC_REGION_WORDS + size / HL_WSIZE - 1;
+	roff = (int)(int_val)&((hl_thread_info*)NULL)->gc_regions[region];
+	scratch(tmp);
+	scratch(cur);
+	jit_thread(ctx);
+	op64(ctx,TEST,th,th);
+	XJump(JZero,jnull);
+	op32(ctx,MOV,tmp,pmem(&p,th->id,(int)(int_val)&((hl_thread_info*)NULL)->gc_blocking));
+	op32(ctx,TEST,tmp,tmp);
+	XJump(JNotZero,jblock);
+	jproto = 0;
+	if( t->kind == HOBJ || t->kind == HSTRUCT ) {
+		// hl_alloc_obj builds the methods at the first allocation
+		op64(ctx,MOV,tmp,pptr(&p,t));
+		op64(ctx,MOV,tmp,pmem(&p,tmp->id,(int)(int_val)&((hl_type*)NULL)->vobj_proto));
+		op64(ctx,TEST,tmp,tmp);
+		XJump(JZero,jproto);
+	}
+	op64(ctx,MOV,cur,pmem(&p,th->id,roff));
+	op64(ctx,LEA,tmp,pmem(&p,cur->id,size));
+	op64(ctx,CMP,tmp,pmem(&p,th->id,roff + HL_WSIZE));
+	XJump(JUGt,jfull);
+	op64(ctx,MOV,pmem(&p,th->id,roff),tmp);
+	op64(ctx,XOR,tmp,tmp);
+	for(k=header?HL_WSIZE:0;k<size;k+=HL_WSIZE)
+		op64(ctx,MOV,pmem(&p,cur->id,k),tmp);
+	if( header ) {
+		op64(ctx,MOV,tmp,pptr(&p,t));
+		op64(ctx,MOV,pmem(&p,cur->id,0),tmp);
+	}
+	XJump(JAlways,jdone);
+	patch_jump(ctx,jnull);
+	patch_jump(ctx,jblock);
+	if( jproto ) patch_jump(ctx,jproto);
+	patch_jump(ctx,jfull);
+	return jdone;
+#	else
+	return 0;
+#	endif
+}
+
+/*
+	Zero-cost traps : a function having a try block registers a hl_jit_frame in its locals, and entering
+	or leaving a try only stores the address of its landing pad in the frame. hl_throw finds the innermost
+	frame having a handler and calls the pad with the frame, which restores the stack and jumps to the catch.
+	The C traps and the setjmp traps of the other functions are used if they are more recent.
+*/
+#ifdef HL_64
+static const CpuReg TRAP_SAVED_REGS[] = { Ebx, R12, R13, R14, R15 };
+#endif
+
+static void *trap_check( jit_ctx *ctx, int opCount ) {
+	/*
+		This is a bit hackshish : we want to detect the type of exception filtered by the catch so we check the following
+		sequence of HL opcodes:
+
+		trap E,@catch
+		...
+		@catch:
+		global R, _
+		call _, ???(R,E)
+
+		??? is expected to be hl.BaseType.check
+	*/
+	hl_module *m = ctx->m;
+	hl_opcode *o = ctx->f->ops + opCount;
+	hl_opcode *next = o + 1 + o->p2;
+	hl_opcode *next2 = o + 2 + o->p2;
+	if( next->op == OGetGlobal && next2->op == OCall2 && next2->p3 == next->p1 && o->p1 == (int)(int_val)next2->extra ) {
+		hl_type *gt = m->code->globals[next->p2];
+		while( gt->kind == HOBJ && gt->obj->super ) gt = gt->obj->super;
+		if( gt->kind == HOBJ && gt->obj->nfields && gt->obj->fields[0].t->kind == HTYPE )
+			return m->globals_data + m->globals_indexes[next->p2];
+	}
+	return NULL;
+}
+
+static void trap_prepare( jit_ctx *ctx, hl_function *f ) {
+	int i, count = 0;
+	ctx->traps = NULL;
+	ctx->trapRefs = NULL;
+	ctx->trapCount = 0;
+	ctx->trapCurrent = -1;
+	if( !IS_64 || !ctx->gc_thread )
+		return;
+	for(i=0;i<f->nops;i++)
+		switch( f->ops[i].op ) {
+		case OTrap:
+			count++;
+			break;
+		case OAsm:
+			return;
+		default:
+			break;
+		}
+	if( count )
+		ctx->traps = (jit_trap*)hl_zalloc(&ctx->falloc, sizeof(jit_trap) * count);
+}
+
+static void trap_set_handler( jit_ctx *ctx, int k ) {
+	// ASM for --> frame->handler = k < 0 ? NULL : pad[k]
+#	ifdef HL_64
+	preg p, *tmp = REG_AT(R10);
+	scratch(tmp);
+	if( k < 0 )
+		op64(ctx,XOR,tmp,tmp);
+	else {
+		jlist *j = (jlist*)hl_malloc(&ctx->falloc,sizeof(jlist));
+		op64(ctx,LEA,tmp,pcodeaddr(&p,0));
+		j->pos = BUF_POS() - 4;
+		j->target = k;
+		j->next = ctx->trapRefs;
+		ctx->trapRefs = j;
+	}
+	op64(ctx,MOV,pmem(&p,Ebp,ctx->trapFrame + HL_WSIZE),tmp);
+#	endif
+}
+
+static void trap_enter( jit_ctx *ctx ) {
+	// ASM for --> frame->prev = th->jit_frames; frame->handler = NULL; frame->regs = callee saved; th->jit_frames = frame
+#	ifdef HL_64
+	int i;
+	preg p, *tmp = REG_AT(R10);
+	int offset = (int)(int_val)&((hl_thread_info*)NULL)->jit_frames;
+	scratch(tmp);
+	jit_thread(ctx);
+	op64(ctx,MOV,tmp,pmem(&p,R11,offset));
+	op64(ctx,MOV,pmem(&p,Ebp,ctx->trapFrame),tmp);
+	trap_set_handler(ctx,-1);
+	for(i=0;i<5;i++)
+		op64(ctx,MOV,pmem(&p,Ebp,ctx->trapFrame + (2 + i) * HL_WSIZE),REG_AT(TRAP_SAVED_REGS[i]));
+	op64(ctx,LEA,tmp,pmem(&p,Ebp,ctx->trapFrame));
+	op64(ctx,MOV,pmem(&p,R11,offset),tmp);
+#	endif
+}
+
+static void trap_leave( jit_ctx *ctx ) {
+	// ASM for --> th->jit_frames = frame->prev
+#	ifdef HL_64
+	preg p, *tmp = REG_AT(R10);
+	scratch(tmp);
+	jit_thread(ctx);
+	op64(ctx,MOV,tmp,pmem(&p,Ebp,ctx->trapFrame));
+	op64(ctx,MOV,pmem(&p,R11,(int)(int_val)&((hl_thread_info*)NULL)->jit_frames),tmp);
+#	endif
+}
+
+static int dyn_box_cache( jit_ctx *ctx, vreg *ra ) {
+	// ASM for --> if( v >= min && v <= max ) eax = &boxes[v - min] else <allocation>
+	// returns the jump to patch after the allocation, 0 if the type has no preallocated boxes
+#	ifdef HL_64
+	int min, max, jmiss = 0, jdone;
+	preg p, *tmp = REG_AT(R10);
+	vdynamic *boxes = hl_dyn_boxes(ra->t,&min,&max);
+	if( !boxes )
+		return 0;
+	scratch(tmp);
+	scratch(PEAX);
+	copy(ctx,tmp,&ra->stack,ra->size);
+	if( IS_FLOAT(ra) ) {
+		// +0.0 only : all bits are zero
+		op(ctx,TEST,tmp,tmp,ra->size == 8);
+		XJump(JNotZero,jmiss);
+		op64(ctx,MOV,PEAX,pptr(&p,boxes));
+	} else {
+		if( min ) op32(ctx,SUB,tmp,pconst(&p,min));
+		if( ra->t->kind != HUI8 || max != 255 ) {
+			op32(ctx,CMP,tmp,pconst(&p,max - min));
+			XJump(JUGt,jmiss);
+		}
+		op64(ctx,SHL,tmp,pconst(&p,4)); // sizeof(vdynamic)
+		op64(ctx,MOV,PEAX,pptr(&p,boxes));
+		op64(ctx,ADD,PEAX,tmp);
+	}
+	XJump(JAlways,jdone);
+	if( jmiss ) patch_jump(ctx,jmiss);
+	return jdone;
+#	else
+	return 0;
+#	endif
+}
+
+static void tier_counter( jit_ctx *ctx ) {
+	// ASM for --> if( --profile->count == 0 ) hl_module_tier_up(m,fid)
+	// emitted with the safepoints : the hot function is recompiled by the optimizing tier
+	int jskip, size;
+	preg p, *r;
+	if( !ctx->baseline )
+		return;
+	r = alloc_reg(ctx, RCPU);
+	op64(ctx,MOV,r,pconst64(&p,(int_val)&ctx->profile->count));
+	// LOCK prefix : the threads running the same baseline code share the counter and only one reaches zero
+	B(0xF0);
+	op32(ctx,DEC,pmem(&p,r->id,0),UNUSED);
+	XJump(JNotZero,jskip);
+	save_regs(ctx);
+	size = begin_native_call(ctx, 2);
+	set_native_arg(ctx, pconst(&p,ctx->fid));
+	set_native_arg(ctx, pconst64(&p,(int_val)ctx->m));
+	call_native(ctx, hl_module_tier_up, size);
+	reload_saved_regs(ctx);
+	patch_jump(ctx,jskip);
+}
+
+#ifdef HL_64
+static void dyn_field_cache( jit_ctx *ctx, vreg *obj, int hfield, hl_type *t, bool set, int *jhit ) {
+	// ASM for --> addr = cache[o->t] ?: hl_dyn_cache_field(o,cache); if( addr ) goto hit with addr in EAX
+	// each site owns its cache : the runtime adds the receiver types on a miss, up to HL_FIELD_CACHE_SIZE
+	// the optimizing tier reuses the cache of the baseline site and checks first for its only object type
+	hl_field_cache *c = NULL;
+	int i, jnull, jmiss, jvirt, jnull2, jaddr, jnext, jmono = 0, jfound[HL_FIELD_CACHE_SIZE], size;
+	int op = ctx->currentPos - 1;
+	hl_jit_profile *prof = ctx->profile;
+	bool mono;
+	preg p;
+	preg *ro, *rt, *rc;
+	if( ctx->inlineOrigins ) {
+		// an inlined site uses the cache of the baseline code of its function
+		jit_origin *o = ctx->inlineOrigins + op;
+		op = o->pos;
+		if( prof && o->site >= 0 ) prof = ctx->m->jit_profile + ctx->inlines[o->site].fid;
+	}
+	if( prof && prof->sites ) c = (hl_field_cache*)prof->sites[op];
+	if( c == NULL ) {
+		c = (hl_field_cache*)jit_module_alloc(ctx,sizeof(hl_field_cache));
+		c->t = t;
+		c->hfield = hfield;
+		c->set = set;
+		if( ctx->baseline ) {
+			if( !ctx->profile->sites ) ctx->profile->sites = (void**)jit_module_alloc(ctx,sizeof(void*) * ctx->f->nops);
+			ctx->profile->sites[op] = c;
+		}
+	}
+	mono = !ctx->baseline && c->count == 1 && c->entries[0].t && c->entries[0].offset > 0;
+	ro = alloc_cpu(ctx, obj, true);
+	RLOCK(ro);
+	rt = alloc_reg(ctx, RCPU);
+	RLOCK(rt);
+	rc = alloc_reg(ctx, RCPU);
+	op64(ctx,TEST,ro,ro);
+	XJump_small(JZero,jnull);
+	op64(ctx,MOV,rt,pmem(&p,ro->id,0));
+	if( mono ) {
+		op64(ctx,MOV,rc,pconst64(&p,(int_val)c->entries[0].t));
+		op64(ctx,CMP,rt,rc);
+		XJump_small(JNeq,jnext);
+		op64(ctx,LEA,rc,pmem(&p,ro->id,(int)c->entries[0].offset));
+		XJump_small(JAlways,jmono);
+		patch_jump(ctx,jnext);
+	}
+	op64(ctx,MOV,rc,pref(&p,c,REF_CACHE,0));
+	for(i=0;i<HL_FIELD_CACHE_SIZE;i++) {
+		int pos = i * sizeof(hl_field_cache_entry);
+		op64(ctx,CMP,rt,pmem(&p,rc->id,pos));
+		XJump_small(JNeq,jnext);
+		op64(ctx,MOV,rc,pmem(&p,rc->id,pos + HL_WSIZE));
+		XJump_small(JAlways,jfound[i]);
+		patch_jump(ctx,jnext);
+	}
+	XJump_small(JAlways,jmiss);
+	for(i=0;i<HL_FIELD_CACHE_SIZE;i++)
+		patch_jump(ctx,jfound[i]);
+	// positive offset : field of the object, negative : field address stored in the virtual
+	op64(ctx,TEST,rc,rc);
+	XJump_small(JSLt,jvirt);
+	op64(ctx,ADD,rc,ro);
+	XJump_small(JAlways,jaddr);
+	patch_jump(ctx,jvirt);
+	op64(ctx,MOV,rt,ro);
+	op64(ctx,SUB,rt,rc);
+	op64(ctx,MOV,rc,pmem(&p,rt->id,0));
+	op64(ctx,TEST,rc,rc);
+	XJump_small(JZero,jnull2);
+	patch_jump(ctx,jaddr);
+	if( mono ) patch_jump(ctx,jmono);
+	op64(ctx,MOV,PEAX,rc);
+	XJump(JAlways,jhit[0]);
+	patch_jump(ctx,jnull);
+	patch_jump(ctx,jmiss);
+	patch_jump(ctx,jnull2);
+	RUNLOCK(ro);
+	RUNLOCK(rt);
+	size = begin_native_call(ctx, 2);
+	set_native_arg(ctx, pref(&p,c,REF_CACHE,0));
+	set_native_arg(ctx, fetch(obj));
+	call_native(ctx, hl_dyn_cache_field, size);
+	op64(ctx,TEST,PEAX,PEAX);
+	XJump(JNotZero,jhit[1]);
+}
+#endif
+
 static void on_jit_error( const char *msg, int_val line ) {
 	char buf[256];
 	int iline = (int)line;
@@ -1645,6 +2191,18 @@ static void _jit_error( jit_ctx *ctx, const char *msg, int line ) {
 }
 
 
+static preg *binop_reg( jit_ctx *ctx, vreg *dst, vreg *a, preg *pa, preg *pb ) {
+	// the op overwrites its first operand : work on a copy so <a> keeps its register
+	preg *r;
+	if( dst == NULL || dst == a )
+		return pa;
+	RLOCK(pa);
+	if( pb->kind == pa->kind ) RLOCK(pb);
+	r = alloc_reg(ctx, pa->kind);
+	copy(ctx, r, pa, a->size == 8 || IS_FLOAT(a) ? a->size : 4);
+	return r;
+}
+
 static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 	preg *pa = fetch(a), *pb = fetch(b), *out = NULL;
 	CpuOp o;
@@ -1793,8 +2351,9 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RCPU,RCPU):
 		case ID2(RCPU,RSTACK):
+			pa = binop_reg(ctx, dst, a, pa, pb);
 			op32(ctx, o, pa, pb);
-			scratch(pa);
+			if( dst ) scratch(pa); // a compare keeps its operand
 			out = pa;
 			break;
 		case ID2(RSTACK,RCPU):
@@ -1834,8 +2393,9 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RCPU,RCPU):
 		case ID2(RCPU,RSTACK):
+			pa = binop_reg(ctx, dst, a, pa, pb);
 			op64(ctx, o, pa, pb);
-			scratch(pa);
+			if( dst ) scratch(pa);
 			out = pa;
 			break;
 		case ID2(RSTACK,RCPU):
@@ -1864,6 +2424,7 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 		pb = alloc_fpu(ctx, b, true);
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RFPU,RFPU):
+			pa = binop_reg(ctx, dst, a, pa, pb);
 			op64(ctx,o,pa,pb);
 			if( o == COMISD && bop != OJSGt ) {
 				int jnotnan;
@@ -1901,7 +2462,7 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 				}
 				patch_jump(ctx,jnotnan);
 			}
-			scratch(pa);
+			if( dst ) scratch(pa);
 			out = pa;
 			break;
 		default:
@@ -1957,10 +2518,870 @@ static int do_jump( jit_ctx *ctx, hl_op op, bool isFloat ) {
 		printf("Unknown JUMP %d\n",op);
 		break;
 	}
-	return j;
+	return j;
+}
+
+/*
+	Registers are kept across basic blocks in functions without traps or refs. Since every store
+	also writes the stack, a register is only a cache of its vreg and can be dropped anywhere.
+	A forward jump target keeps the registers that are the same on all its incoming edges, a loop
+	head keeps the ones used by the loop and each back-edge reloads the ones it lost.
+	Conditional back-edges and the jumps emitted in the middle of complex ops discard them.
+*/
+static vreg *regs_unknown[1];
+#define REGS_UNKNOWN	regs_unknown
+
+static void regs_prepare( jit_ctx *ctx, hl_function *f ) {
+	int i, k;
+	ctx->labelRegs = NULL;
+	if( !IS_64 || ctx->baseline )
+		return;
+	for(i=0;i<f->nops;i++)
+		switch( f->ops[i].op ) {
+		case OTrap:
+		case OAsm:
+		case ORef:
+			return;
+		default:
+			break;
+		}
+	ctx->labelRegs = (vreg***)hl_zalloc(&ctx->falloc, sizeof(vreg**) * (f->nops + 1));
+	ctx->loopEnd = (int*)hl_zalloc(&ctx->falloc, sizeof(int) * (f->nops + 1));
+	ctx->loopRegs = (bool*)hl_malloc(&ctx->falloc, f->nregs);
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		int target;
+		switch( o->op ) {
+		case OJTrue:
+		case OJFalse:
+		case OJNull:
+		case OJNotNull:
+			target = i + 1 + o->p2;
+			break;
+		case OJSLt:
+		case OJSGte:
+		case OJSGt:
+		case OJSLte:
+		case OJULt:
+		case OJUGte:
+		case OJNotLt:
+		case OJNotGte:
+		case OJEq:
+		case OJNotEq:
+			target = i + 1 + o->p3;
+			break;
+		case OJAlways:
+			target = i + 1 + o->p1;
+			if( target <= i && i > ctx->loopEnd[target] ) ctx->loopEnd[target] = i;
+			continue;
+		case OSwitch:
+			for(k=0;k<o->p2;k++)
+				if( o->extra[k] < 0 ) ctx->labelRegs[i + 1 + o->extra[k]] = REGS_UNKNOWN;
+			continue;
+		default:
+			continue;
+		}
+		if( target <= i ) ctx->labelRegs[target] = REGS_UNKNOWN;
+	}
+}
+
+static void regs_branch( jit_ctx *ctx, int target, bool keep ) {
+	vreg **s = ctx->labelRegs[target];
+	int i;
+	if( target < ctx->currentPos || s == REGS_UNKNOWN )
+		return;
+	if( !keep ) {
+		ctx->labelRegs[target] = REGS_UNKNOWN;
+		return;
+	}
+	if( s == NULL ) {
+		s = (vreg**)hl_malloc(&ctx->falloc, sizeof(vreg*) * REG_COUNT);
+		for(i=0;i<REG_COUNT;i++)
+			s[i] = ctx->pregs[i].holds;
+		ctx->labelRegs[target] = s;
+		return;
+	}
+	for(i=0;i<REG_COUNT;i++)
+		if( s[i] != ctx->pregs[i].holds )
+			s[i] = NULL;
+}
+
+static void regs_land( jit_ctx *ctx, hl_opcode *prev, int pos ) {
+	vreg **s = ctx->labelRegs ? ctx->labelRegs[pos] : NULL;
+	bool falls;
+	int i;
+	if( s == NULL || s == REGS_UNKNOWN ) {
+		discard_regs(ctx, true);
+		return;
+	}
+	falls = prev->op != OJAlways && prev->op != ORet && prev->op != OThrow && prev->op != ORethrow;
+	for(i=0;i<REG_COUNT;i++) {
+		preg *p = ctx->pregs + i;
+		vreg *v = s[i];
+		if( falls && p->holds != v ) v = NULL;
+		if( p->holds == v ) continue;
+		scratch(p);
+		if( v ) {
+			scratch(v->current);
+			p->holds = v;
+			v->current = p;
+		}
+	}
+}
+
+static void regs_mark( jit_ctx *ctx, int r ) {
+	if( r >= 0 && r < ctx->f->nregs ) ctx->loopRegs[r] = true;
+}
+
+static void regs_loop( jit_ctx *ctx, int pos ) {
+	hl_function *f = ctx->f;
+	vreg **s;
+	int i, k, end;
+	if( !ctx->labelRegs || ctx->labelRegs[pos] == REGS_UNKNOWN ) {
+		discard_regs(ctx, false);
+		return;
+	}
+	end = ctx->loopEnd[pos];
+	if( end == 0 )
+		return;
+	// only keep the registers of the vregs used in the loop : the others would be reloaded for nothing
+	memset(ctx->loopRegs, 0, f->nregs);
+	for(i=pos;i<=end;i++) {
+		hl_opcode *o = f->ops + i;
+		regs_mark(ctx, o->p1);
+		regs_mark(ctx, o->p2);
+		regs_mark(ctx, o->p3);
+		switch( o->op ) {
+		case OCallN:
+		case OCallClosure:
+		case OCallMethod:
+		case OCallThis:
+		case OMakeEnum:
+			for(k=0;k<o->p3;k++) regs_mark(ctx, o->extra[k]);
+			break;
+		case OCall3:
+			regs_mark(ctx, o->extra[0]);
+			regs_mark(ctx, o->extra[1]);
+			break;
+		case OCall4:
+			for(k=0;k<3;k++) regs_mark(ctx, o->extra[k]);
+			break;
+		case OCall2:
+		case OEnumField:
+			regs_mark(ctx, (int)(int_val)o->extra);
+			break;
+		default:
+			break;
+		}
+	}
+	s = (vreg**)hl_malloc(&ctx->falloc, sizeof(vreg*) * REG_COUNT);
+	for(i=0;i<REG_COUNT;i++) {
+		preg *p = ctx->pregs + i;
+		if( p->holds && p->holds->stack.id < f->nregs && !ctx->loopRegs[p->holds->stack.id] ) scratch(p);
+		s[i] = p->holds;
+	}
+	ctx->labelRegs[pos] = s;
+}
+
+static void regs_back_edge( jit_ctx *ctx, int target ) {
+	vreg **s;
+	int i, k, pass;
+	if( !ctx->labelRegs || target >= ctx->currentPos )
+		return;
+	s = ctx->labelRegs[target];
+	if( s == NULL || s == REGS_UNKNOWN )
+		return;
+	// first move the values into the registers we don't need to read, then load the others from the stack
+	for(pass=0;pass<2;pass++) {
+		bool changed = true;
+		while( changed ) {
+			changed = false;
+			for(i=0;i<REG_COUNT;i++) {
+				preg *p = ctx->pregs + i;
+				preg *from;
+				vreg *v = s[i];
+				if( v == NULL || p->holds == v ) continue;
+				if( pass == 0 && p->holds ) {
+					for(k=0;k<REG_COUNT;k++)
+						if( s[k] == p->holds ) break;
+					if( k < REG_COUNT ) continue;
+				}
+				scratch(p);
+				from = fetch(v);
+				// a register copy of a small int keeps it whole : this way it doesn't need any temporary
+				copy(ctx, p, from, from->kind == RCPU && v->size < 4 ? 4 : v->size);
+				scratch(v->current);
+				p->holds = v;
+				v->current = p;
+				changed = true;
+			}
+			if( pass == 1 ) break;
+		}
+	}
+}
+
+#define SINK_ESCAPES	2
+#define SINK_MAX_FIELDS	16
+
+static bool sink_scalar( hl_type *t ) {
+	switch( t->kind ) {
+	case HUI8:
+	case HUI16:
+	case HI32:
+	case HI64:
+	case HF32:
+	case HF64:
+	case HBOOL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool sink_object( hl_type *t ) {
+	hl_runtime_obj *rt;
+	int i;
+	if( t->kind != HOBJ && t->kind != HSTRUCT )
+		return false;
+	rt = hl_get_obj_rt(t);
+	if( rt->nfields > SINK_MAX_FIELDS || rt->nbindings )
+		return false;
+	for(i=0;i<rt->nfields;i++) {
+		hl_type *ft = hl_obj_field_fetch(t,i)->t;
+		if( ft->kind == HVOID || ft->kind == HPACKED )
+			return false;
+	}
+	return true;
+}
+
+static void sink_mark( char *state, int r, int keep, int nregs ) {
+	if( r != keep && r >= 0 && r < nregs ) state[r] = SINK_ESCAPES;
+}
+
+static void sink_escape( char *state, hl_opcode *o, int keep, int nregs ) {
+	int k;
+	// like regs_loop, constants and offsets are taken as registers : this only makes more of them escape
+	sink_mark(state, o->p1, keep, nregs);
+	sink_mark(state, o->p2, keep, nregs);
+	sink_mark(state, o->p3, keep, nregs);
+	switch( o->op ) {
+	case OCallN:
+	case OCallClosure:
+	case OCallMethod:
+	case OCallThis:
+	case OMakeEnum:
+		for(k=0;k<o->p3;k++) sink_mark(state, o->extra[k], keep, nregs);
+		break;
+	case OCall3:
+		sink_mark(state, o->extra[0], keep, nregs);
+		sink_mark(state, o->extra[1], keep, nregs);
+		break;
+	case OCall4:
+		for(k=0;k<3;k++) sink_mark(state, o->extra[k], keep, nregs);
+		break;
+	case OCall2:
+	case OEnumField:
+		sink_mark(state, (int)(int_val)o->extra, keep, nregs);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+	Escape analysis : a register only written by ONew, OToDyn or OInstanceClosure and only read by
+	field accesses, unboxing casts, closure calls and null checks holds a value that never leaves the function.
+	Its allocation is removed and the fields, boxed value or closure context are kept in vregs of their own,
+	placed after the scratch vreg. Returns the number of these vregs.
+*/
+static int sink_prepare( jit_ctx *ctx, hl_function *f ) {
+	int i, k, count = 0;
+	int nargs = f->type->fun->nargs;
+	char *state;
+	hl_type **vt;
+	int *fid;
+	ctx->sink = NULL;
+	if( !IS_64 || ctx->baseline )
+		return 0;
+	state = (char*)hl_zalloc(&ctx->falloc, f->nregs);
+	vt = (hl_type**)hl_zalloc(&ctx->falloc, sizeof(hl_type*) * f->nregs);
+	fid = (int*)hl_zalloc(&ctx->falloc, sizeof(int) * f->nregs);
+	for(i=0;i<nargs;i++)
+		state[i] = SINK_ESCAPES;
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		hl_type **regs = f->regs;
+		int keep = -1;
+		bool alloc = false;
+		switch( o->op ) {
+		case OAsm:
+			return 0;
+		case ONew:
+			if( sink_object(regs[o->p1]) ) {
+				keep = o->p1;
+				alloc = true;
+			}
+			break;
+		case OToDyn:
+			if( o->p1 != o->p2 && (regs[o->p1]->kind == HDYN || regs[o->p1]->kind == HNULL) && sink_scalar(regs[o->p2]) && (!vt[o->p1] || vt[o->p1]->kind == regs[o->p2]->kind) ) {
+				keep = o->p1;
+				alloc = true;
+				vt[o->p1] = regs[o->p2];
+			}
+			break;
+		case OInstanceClosure:
+			if( o->p1 != o->p3 && regs[o->p1]->kind == HFUN && hl_is_ptr(regs[o->p3]) && (!vt[o->p1] || fid[o->p1] == o->p2) ) {
+				keep = o->p1;
+				alloc = true;
+				vt[o->p1] = regs[o->p3];
+				fid[o->p1] = o->p2;
+			}
+			break;
+		case OField:
+			if( o->p1 != o->p2 && (regs[o->p2]->kind == HOBJ || regs[o->p2]->kind == HSTRUCT) ) keep = o->p2;
+			break;
+		case OSetField:
+			if( o->p1 != o->p3 && (regs[o->p1]->kind == HOBJ || regs[o->p1]->kind == HSTRUCT) ) keep = o->p1;
+			break;
+		case OSafeCast:
+			// the kind of the boxed value is checked below
+			if( o->p1 != o->p2 && (regs[o->p2]->kind == HDYN || regs[o->p2]->kind == HNULL) ) keep = o->p2;
+			break;
+		case OCallClosure:
+			if( o->p1 != o->p2 && regs[o->p2]->kind == HFUN ) {
+				keep = o->p2;
+				for(k=0;k<o->p3;k++)
+					if( o->extra[k] == o->p2 ) keep = -1;
+			}
+			break;
+		case ONullCheck:
+		case OJNull:
+		case OJNotNull:
+			keep = o->p1;
+			break;
+		default:
+			break;
+		}
+		sink_escape(state, o, keep, f->nregs);
+		if( alloc && !state[keep] ) state[keep] = 1;
+	}
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		if( o->op == OSafeCast && state[o->p2] == 1 && vt[o->p2]->kind != f->regs[o->p1]->kind )
+			state[o->p2] = SINK_ESCAPES;
+	}
+	for(i=0;i<f->nregs;i++) {
+		if( state[i] != 1 ) continue;
+		if( !ctx->sink ) ctx->sink = (sink_reg*)hl_zalloc(&ctx->falloc, sizeof(sink_reg) * f->nregs);
+		ctx->sink[i].base = f->nregs + 1 + count;
+		ctx->sink[i].count = vt[i] ? 1 : hl_get_obj_rt(f->regs[i])->nfields;
+		ctx->sink[i].findex = fid[i];
+		count += ctx->sink[i].count;
+	}
+	if( !count )
+		return 0;
+	ctx->sinkTypes = (hl_type**)hl_malloc(&ctx->falloc, sizeof(hl_type*) * count);
+	for(i=0;i<f->nregs;i++) {
+		sink_reg *s = ctx->sink + i;
+		if( !s->base ) continue;
+		for(k=0;k<s->count;k++)
+			ctx->sinkTypes[s->base - (f->nregs + 1) + k] = vt[i] ? vt[i] : hl_obj_field_fetch(f->regs[i],k)->t;
+	}
+	return count;
+}
+
+static void sink_init( jit_ctx *ctx, sink_reg *s ) {
+	int k;
+	for(k=0;k<s->count;k++) {
+		vreg *v = R(s->base + k);
+		if( IS_FLOAT(v) ) {
+			preg *f = alloc_fpu(ctx,v,false);
+			op64(ctx,XORPD,f,f);
+			store(ctx,v,f,false);
+		} else
+			store_const(ctx,v,0);
+	}
+}
+
+/*
+	Inlining : a small function called directly, or by OCallMethod when no subclass overrides the method,
+	is copied in its caller with its registers placed after the caller ones. The arguments are moved there
+	first and each ORet moves the result then jumps to the end of the copy. Only one level is inlined.
+	The debug infos keep one position per opcode of the bytecode, the inlined call being at the position
+	of the call, and the offsets of the inlined opcodes are saved aside for the stack traces.
+*/
+static int inline_method( jit_ctx *ctx, hl_type *t, int pindex ) {
+	hl_code *c = ctx->m->code;
+	hl_type *s;
+	int i, k, findex = -1;
+	for(s=t;s && findex < 0;s=s->obj->super)
+		for(i=0;i<s->obj->nproto;i++)
+			if( s->obj->proto[i].pindex == pindex ) {
+				findex = s->obj->proto[i].findex;
+				break;
+			}
+	if( findex < 0 )
+		return -1;
+	if( !ctx->inlineOverrides ) {
+		// mark the methods replaced in the prototype of a subclass
+		ctx->inlineOverrides = (unsigned char*)hl_zalloc(&ctx->galloc, c->nfunctions + c->nnatives);
+		for(i=0;i<c->ntypes;i++) {
+			hl_type *ot = c->types + i;
+			if( ot->kind != HOBJ || !ot->obj->super ) continue;
+			for(k=0;k<ot->obj->nproto;k++) {
+				hl_obj_proto *p = ot->obj->proto + k;
+				bool found = false;
+				if( p->pindex < 0 ) continue;
+				for(s=ot->obj->super;s && !found;s=s->obj->super) {
+					int j;
+					for(j=0;j<s->obj->nproto;j++)
+						if( s->obj->proto[j].pindex == p->pindex ) {
+							ctx->inlineOverrides[s->obj->proto[j].findex] = 1;
+							found = true;
+							break;
+						}
+				}
+			}
+		}
+	}
+	return ctx->inlineOverrides[findex] ? -1 : findex;
+}
+
+static int inline_callee( jit_ctx *ctx, hl_function *f, hl_opcode *o, int *nargs, int *obj ) {
+	// the function called by o if it can be inlined, -1 otherwise
+	hl_module *m = ctx->m;
+	hl_function *fc;
+	int i, fid, findex = o->p2;
+	*obj = -1;
+	switch( o->op ) {
+	case OCall0:
+		*nargs = 0;
+		break;
+	case OCall1:
+		*nargs = 1;
+		break;
+	case OCall2:
+		*nargs = 2;
+		break;
+	case OCall3:
+		*nargs = 3;
+		break;
+	case OCall4:
+		*nargs = 4;
+		break;
+	case OCallN:
+		*nargs = o->p3;
+		break;
+	case OCallMethod:
+	case OCallThis:
+		*obj = o->op == OCallThis ? 0 : o->p3 ? o->extra[0] : -1;
+		if( *obj < 0 || f->regs[*obj]->kind != HOBJ )
+			return -1;
+		findex = inline_method(ctx, f->regs[*obj], o->p2);
+		*nargs = o->op == OCallThis ? o->p3 + 1 : o->p3;
+		break;
+	default:
+		return -1;
+	}
+	if( findex < 0 )
+		return -1;
+	fid = m->functions_indexes[findex];
+	if( fid < 0 || fid >= m->code->nfunctions || fid == ctx->fid )
+		return -1;
+	fc = m->code->functions + fid;
+	if( fc->nops > m->jit_inline || fc->type->fun->nargs != *nargs )
+		return -1;
+	for(i=0;i<fc->nops;i++)
+		switch( fc->ops[i].op ) {
+		case OTrap:
+		case OEndTrap:
+		case OAsm:
+		case ORef:
+			return -1;
+		default:
+			break;
+		}
+	return fid;
+}
+
+static int inline_arg( hl_opcode *o, int i ) {
+	switch( o->op ) {
+	case OCall1:
+		return o->p3;
+	case OCall2:
+		return i == 0 ? o->p3 : (int)(int_val)o->extra;
+	case OCall3:
+	case OCall4:
+		return i == 0 ? o->p3 : o->extra[i - 1];
+	case OCallThis:
+		return i == 0 ? 0 : o->extra[i - 1];
+	default:
+		return o->extra[i];
+	}
+}
+
+static int *inline_copy( jit_ctx *ctx, int *a, int count, int base ) {
+	int i;
+	int *b = (int*)hl_malloc(&ctx->falloc, sizeof(int) * count);
+	for(i=0;i<count;i++)
+		b[i] = a[i] + base;
+	return b;
+}
+
+static void inline_remap( jit_ctx *ctx, hl_opcode *o, int base ) {
+	// move the registers of an inlined opcode after the caller ones
+	switch( o->op ) {
+	case OAdd:
+	case OSub:
+	case OMul:
+	case OSDiv:
+	case OUDiv:
+	case OSMod:
+	case OUMod:
+	case OShl:
+	case OSShr:
+	case OUShr:
+	case OAnd:
+	case OOr:
+	case OXor:
+	case OGetI8:
+	case OGetI16:
+	case OGetMem:
+	case OGetArray:
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case OSetArray:
+	case ORefOffset:
+		o->p3 += base;
+		// fallthrough
+	case OMov:
+	case ONeg:
+	case ONot:
+	case OVirtualClosure:
+	case OField:
+	case ODynGet:
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+	case OToDyn:
+	case OToSFloat:
+	case OToUFloat:
+	case OToInt:
+	case OSafeCast:
+	case OUnsafeCast:
+	case OToVirtual:
+	case OArraySize:
+	case OGetType:
+	case OGetTID:
+	case OUnref:
+	case OSetref:
+	case OEnumIndex:
+	case OEnumField:
+	case ORefData:
+		o->p2 += base;
+		// fallthrough
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OIncr:
+	case ODecr:
+	case OCall0:
+	case OStaticClosure:
+	case OGetGlobal:
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case ONullCheck:
+	case ONew:
+	case OType:
+	case OEnumAlloc:
+	case OPrefetch:
+		o->p1 += base;
+		break;
+	case OCall1:
+	case OInstanceClosure:
+	case OSetField:
+	case ODynSet:
+	case OSetEnumField:
+		o->p1 += base;
+		o->p3 += base;
+		break;
+	case OCall2:
+		o->p1 += base;
+		o->p3 += base;
+		o->extra = (int*)(int_val)((int)(int_val)o->extra + base);
+		break;
+	case OCall3:
+	case OCall4:
+		o->p1 += base;
+		o->p3 += base;
+		o->extra = inline_copy(ctx, o->extra, o->op == OCall3 ? 2 : 3, base);
+		break;
+	case OCallClosure:
+		o->p2 += base;
+		// fallthrough
+	case OCallN:
+	case OCallMethod:
+	case OMakeEnum:
+		o->p1 += base;
+		o->extra = inline_copy(ctx, o->extra, o->p3, base);
+		break;
+	case OSwitch:
+		o->p1 += base;
+		o->extra = inline_copy(ctx, o->extra, o->p2, 0);
+		break;
+	case OSetGlobal:
+		o->p2 += base;
+		break;
+	case OGetThis:
+		// the implicit register 0 of the inlined function is now at base
+		o->op = OField;
+		o->p3 = o->p2;
+		o->p2 = base;
+		o->p1 += base;
+		break;
+	case OSetThis:
+		o->op = OSetField;
+		o->p3 = o->p2 + base;
+		o->p2 = o->p1;
+		o->p1 = base;
+		break;
+	case OCallThis:
+		{
+			int i;
+			int *extra = (int*)hl_malloc(&ctx->falloc, sizeof(int) * (o->p3 + 1));
+			extra[0] = base;
+			for(i=0;i<o->p3;i++)
+				extra[i + 1] = o->extra[i] + base;
+			o->op = OCallMethod;
+			o->p1 += base;
+			o->p3++;
+			o->extra = extra;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void inline_jumps( hl_opcode *o, int pos, int *map, int k ) {
+	// the opcode at pos in the bytecode of its function is now at k
+#	define RETARGET(off)	off = map[pos + 1 + (off)] - (k + 1)
+	int i;
+	switch( o->op ) {
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OTrap:
+		RETARGET(o->p2);
+		break;
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+		RETARGET(o->p3);
+		break;
+	case OJAlways:
+		RETARGET(o->p1);
+		break;
+	case OSwitch:
+		for(i=0;i<o->p2;i++)
+			RETARGET(o->extra[i]);
+		RETARGET(o->p3);
+		break;
+	default:
+		break;
+	}
+#	undef RETARGET
+}
+
+static hl_function *inline_prepare( jit_ctx *ctx, hl_function *f ) {
+	hl_module *m = ctx->m;
+	hl_function *fi;
+	int i, j, k, nargs, obj, nops = 0, nregs = f->nregs, count = 0;
+	int *targets, *bases;
+	ctx->inlines = NULL;
+	ctx->inlineCount = 0;
+	ctx->inlinePos = NULL;
+	ctx->inlineOrigins = NULL;
+	if( !m->jit_inline || ctx->baseline )
+		return f;
+	for(i=0;i<f->nops;i++)
+		if( f->ops[i].op == OAsm )
+			return f;
+	targets = (int*)hl_malloc(&ctx->falloc, sizeof(int) * f->nops);
+	bases = (int*)hl_malloc(&ctx->falloc, sizeof(int) * f->nops);
+	for(i=0;i<f->nops;i++) {
+		int fid = inline_callee(ctx, f, f->ops + i, &nargs, &obj);
+		targets[i] = fid;
+		if( fid < 0 ) {
+			nops++;
+			continue;
+		}
+		// the calls to the same function share its registers
+		for(j=0;j<i;j++)
+			if( targets[j] == fid ) break;
+		if( j < i )
+			bases[i] = bases[j];
+		else {
+			bases[i] = nregs;
+			nregs += m->code->functions[fid].nregs;
+		}
+		// ORet becomes a move and a jump
+		nops += nargs + 1 + m->code->functions[fid].nops * 2;
+		count++;
+	}
+	if( !count )
+		return f;
+	fi = (hl_function*)hl_malloc(&ctx->falloc, sizeof(hl_function));
+	*fi = *f;
+	fi->nregs = nregs;
+	fi->regs = (hl_type**)hl_malloc(&ctx->falloc, sizeof(hl_type*) * nregs);
+	fi->ops = (hl_opcode*)hl_malloc(&ctx->falloc, sizeof(hl_opcode) * nops);
+	memcpy(fi->regs, f->regs, sizeof(hl_type*) * f->nregs);
+	ctx->inlines = (jit_inline*)hl_malloc(&ctx->falloc, sizeof(jit_inline) * count);
+	ctx->inlinePos = (int*)hl_malloc(&ctx->falloc, sizeof(int) * (f->nops + 1));
+	ctx->inlineOrigins = (jit_origin*)hl_malloc(&ctx->falloc, sizeof(jit_origin) * nops);
+	k = 0;
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i, *out;
+		hl_function *fc;
+		jit_inline *s;
+		int site, base = bases[i];
+		ctx->inlinePos[i] = k;
+		if( targets[i] < 0 ) {
+			ctx->inlineOrigins[k].site = -1;
+			ctx->inlineOrigins[k].pos = i;
+			out = fi->ops + k++;
+			*out = *o;
+			if( o->op == OSwitch ) out->extra = inline_copy(ctx, o->extra, o->p2, 0);
+			continue;
+		}
+		fc = m->code->functions + targets[i];
+		memcpy(fi->regs + base, fc->regs, sizeof(hl_type*) * fc->nregs);
+		site = ctx->inlineCount++;
+		s = ctx->inlines + site;
+		s->fid = targets[i];
+		s->ops = (int*)hl_malloc(&ctx->falloc, sizeof(int) * (fc->nops + 1));
+		// the receiver and the arguments are set at the position of the call
+		inline_callee(ctx, f, o, &nargs, &obj);
+		if( obj >= 0 && o->op == OCallMethod ) {
+			ctx->inlineOrigins[k].site = -1;
+			ctx->inlineOrigins[k].pos = i;
+			out = fi->ops + k++;
+			memset(out, 0, sizeof(hl_opcode));
+			out->op = ONullCheck;
+			out->p1 = obj;
+		}
+		for(j=0;j<nargs;j++) {
+			if( fc->regs[j]->kind == HVOID ) continue;
+			ctx->inlineOrigins[k].site = -1;
+			ctx->inlineOrigins[k].pos = i;
+			out = fi->ops + k++;
+			memset(out, 0, sizeof(hl_opcode));
+			out->op = OMov;
+			out->p1 = base + j;
+			out->p2 = inline_arg(o, j);
+		}
+		for(j=0;j<fc->nops;j++) {
+			hl_opcode *c = fc->ops + j;
+			s->ops[j] = k;
+			if( c->op == ORet ) {
+				if( fc->regs[c->p1]->kind != HVOID && f->regs[o->p1]->kind != HVOID ) {
+					ctx->inlineOrigins[k].site = site;
+					ctx->inlineOrigins[k].pos = j;
+					out = fi->ops + k++;
+					memset(out, 0, sizeof(hl_opcode));
+					out->op = OMov;
+					out->p1 = o->p1;
+					out->p2 = base + c->p1;
+				}
+				if( j == fc->nops - 1 ) continue;
+				ctx->inlineOrigins[k].site = site;
+				ctx->inlineOrigins[k].pos = j;
+				out = fi->ops + k++;
+				memset(out, 0, sizeof(hl_opcode));
+				out->op = OJAlways;
+				out->p1 = fc->nops - (j + 1);
+				continue;
+			}
+			ctx->inlineOrigins[k].site = site;
+			ctx->inlineOrigins[k].pos = j;
+			out = fi->ops + k++;
+			*out = *c;
+			inline_remap(ctx, out, base);
+		}
+		s->ops[fc->nops] = k;
+	}
+	ctx->inlinePos[f->nops] = k;
+	fi->nops = k;
+	// the jumps were copied with their offset in the bytecode of their function
+	for(k=0;k<fi->nops;k++) {
+		jit_origin *org = ctx->inlineOrigins + k;
+		inline_jumps(fi->ops + k, org->pos, org->site < 0 ? ctx->inlinePos : ctx->inlines[org->site].ops, k);
+	}
+	return fi;
 }
 
-static void register_jump( jit_ctx *ctx, int pos, int target ) {
+static void inline_debug( jit_ctx *ctx, hl_debug_infos *d ) {
+	// the offsets are saved per opcode of the bytecode, the ones of the inlined functions aside
+	hl_code *c = ctx->m->code;
+	hl_function *f = c->functions + ctx->fid;
+	void *offsets = malloc((d->large ? sizeof(int) : sizeof(unsigned short)) * (f->nops + 1));
+	int i, j, size = 0;
+	int *table;
+#	define OFFSET(k)	(d->large ? ((int*)d->offsets)[k] : ((unsigned short*)d->offsets)[k])
+	for(i=0;i<=f->nops;i++) {
+		if( d->large )
+			((int*)offsets)[i] = OFFSET(ctx->inlinePos[i]);
+		else
+			((unsigned short*)offsets)[i] = (unsigned short)OFFSET(ctx->inlinePos[i]);
+	}
+	for(i=0;i<ctx->inlineCount;i++)
+		size += c->functions[ctx->inlines[i].fid].nops + 1;
+	d->ninlines = ctx->inlineCount;
+	d->inlines = (hl_debug_inline*)malloc(sizeof(hl_debug_inline) * ctx->inlineCount + sizeof(int) * size);
+	table = (int*)(d->inlines + d->ninlines);
+	size = 0;
+	for(i=0;i<ctx->inlineCount;i++) {
+		jit_inline *s = ctx->inlines + i;
+		hl_debug_inline *inl = d->inlines + i;
+		int nops = c->functions[s->fid].nops;
+		inl->fidx = s->fid;
+		inl->offsets = size;
+		for(j=0;j<=nops;j++)
+			table[size++] = OFFSET(s->ops[j]);
+		inl->start = table[inl->offsets];
+		inl->end = table[size - 1];
+	}
+#	undef OFFSET
+	free(d->offsets);
+	d->offsets = offsets;
+}
+
+static void add_jump( jit_ctx *ctx, int pos, int target, bool keepRegs ) {
 	jlist *j = (jlist*)hl_malloc(&ctx->falloc, sizeof(jlist));
 	j->pos = pos;
 	j->target = target;
@@ -1968,6 +3389,47 @@ static void register_jump( jit_ctx *ctx, int pos, int target ) {
 	ctx->jumps = j;
 	if( target != 0 && ctx->opsPos[target] == 0 )
 		ctx->opsPos[target] = -1;
+	if( ctx->labelRegs )
+		regs_branch(ctx, target, keepRegs);
+}
+
+static void register_jump( jit_ctx *ctx, int pos, int target ) {
+	add_jump(ctx, pos, target, false);
+}
+
+static void register_branch( jit_ctx *ctx, int pos, int target ) {
+	// the registers at the jump are the ones we have after the op
+	add_jump(ctx, pos, target, true);
+}
+
+static void trap_pads( jit_ctx *ctx ) {
+	// emit the landing pads after the function code, called by hl_throw with the frame
+#	ifdef HL_64
+	int k, i, j;
+	preg p;
+	jlist *r;
+	discard_regs(ctx, false);
+	for(k=0;k<ctx->trapCount;k++) {
+		jit_trap *t = ctx->traps + k;
+		hl_opcode *o = ctx->f->ops + t->op;
+		jit_buf(ctx);
+		W64REF(pptr(&p,t->check),(int_val)t->check);
+		t->pos = BUF_POS();
+		op64(ctx,LEA,PEBP,pmem(&p,CALL_REGS[0],-ctx->trapFrame));
+		op64(ctx,LEA,PESP,pmem(&p,Ebp,-ctx->totalRegsSize));
+		for(i=0;i<5;i++)
+			op64(ctx,MOV,REG_AT(TRAP_SAVED_REGS[i]),pmem(&p,Ebp,ctx->trapFrame + (2 + i) * HL_WSIZE));
+		trap_set_handler(ctx,t->prev);
+		jit_thread(ctx);
+		op64(ctx,MOV,PEAX,pmem(&p,R11,(int)(int_val)&((hl_thread_info*)NULL)->exc_value));
+		store(ctx,R(o->p1),PEAX,false);
+		XJump(JAlways,j);
+		register_jump(ctx,j,t->op + 1 + o->p2);
+	}
+	for(r=ctx->trapRefs;r;r=r->next)
+		*(int*)(ctx->startBuf + r->pos) = ctx->traps[r->target].pos - (r->pos + 4);
+	ctx->trapRefs = NULL;
+#	endif
 }
 
 #define HDYN_VALUE 8
@@ -2246,7 +3708,7 @@ static void op_jump( jit_ctx *ctx, vreg *a, vreg *b, hl_opcode *op, int targetPo
 		op_binop(ctx,NULL,a,b,op->op);
 		break;
 	}
-	register_jump(ctx,do_jump(ctx,op->op, IS_FLOAT(a)),targetPos);
+	register_branch(ctx,do_jump(ctx,op->op, IS_FLOAT(a)),targetPos);
 }
 
 jit_ctx *hl_jit_alloc() {
@@ -2282,7 +3744,16 @@ void hl_jit_free( jit_ctx *ctx, h_bool can_reset ) {
 	ctx->buf.b = NULL;
 	ctx->calls = NULL;
 	ctx->switchs = NULL;
+	ctx->coderefs = NULL;
+	ctx->refs = NULL;
 	ctx->closure_list = NULL;
+	free(ctx->stackMaps);
+	free(ctx->stackBits);
+	ctx->stackMaps = NULL;
+	ctx->stackMapsCount = ctx->stackMapsMax = 0;
+	ctx->stackBits = NULL;
+	ctx->stackBitsCount = ctx->stackBitsMax = 0;
+	ctx->inlineOverrides = NULL;
 	hl_free(&ctx->falloc);
 	hl_free(&ctx->galloc);
 	if( !can_reset ) free(ctx);
@@ -2684,16 +4155,61 @@ static int jit_build( jit_ctx *ctx, void (*fbuild)( jit_ctx *) ) {
 static void hl_jit_init_module( jit_ctx *ctx, hl_module *m ) {
 	int i;
 	ctx->m = m;
+	ctx->gc_barrier = hl_gc_use_write_barrier();
+	ctx->gc_thread = hl_gc_thread_offset();
+#	ifdef HL_THREADS
+	ctx->gc_poll = &hl_gc_threads_info()->stopping_world;
+#	else
+	ctx->gc_poll = NULL;
+#	endif
+	ctx->stackMapsCount = 0;
+	ctx->stackBitsCount = 0;
+	if( ctx->stackBits ) memset(ctx->stackBits,0,sizeof(int) * ctx->stackBitsMax);
 	if( m->code->hasdebug ) {
-		ctx->debug = (hl_debug_infos*)malloc(sizeof(hl_debug_infos) * m->code->nfunctions);
-		memset(ctx->debug, -1, sizeof(hl_debug_infos) * m->code->nfunctions);
+		if( m->jit_code && m->jit_reserved ) {
+			// lazy mode : the entry of the function we compile is updated in place
+			ctx->debug = m->jit_debug;
+		} else {
+			ctx->debug = (hl_debug_infos*)malloc(sizeof(hl_debug_infos) * m->code->nfunctions);
+			memset(ctx->debug, -1, sizeof(hl_debug_infos) * m->code->nfunctions);
+		}
 	}
+	// once the module runs, the code reads the floats at the start of its first chunk
+	if( m->jit_code )
+		return;
 	for(i=0;i<m->code->nfloats;i++) {
 		jit_buf(ctx);
 		*ctx->buf.d++ = m->code->floats[i];
 	}
 }
 
+#ifdef HL_64
+static void jit_lazy( jit_ctx *ctx ) {
+	// jumped to by the stub of a function that isn't compiled yet, with its index in EAX
+	// compile it then jump there, the arguments registers and the stack being untouched
+	preg p;
+	int i, size;
+	op64(ctx,PUSH,PEBP,UNUSED);
+	op64(ctx,MOV,PEBP,PESP);
+	op64(ctx,SUB,PESP,pconst(&p,CALL_NREGS*16));
+	for(i=0;i<CALL_NREGS;i++) {
+		op64(ctx,MOVSD,pmem(&p,Esp,i*8),REG_AT(XMM(i)));
+		op64(ctx,MOV,pmem(&p,Esp,(CALL_NREGS + i)*8),REG_AT(CALL_REGS[i]));
+	}
+	size = begin_native_call(ctx,2);
+	set_native_arg(ctx,PEAX);
+	set_native_arg(ctx,pconst64(&p,(int_val)ctx->m));
+	call_native(ctx,hl_module_compile,size);
+	for(i=0;i<CALL_NREGS;i++) {
+		op64(ctx,MOVSD,REG_AT(XMM(i)),pmem(&p,Esp,i*8));
+		op64(ctx,MOV,REG_AT(CALL_REGS[i]),pmem(&p,Esp,(CALL_NREGS + i)*8));
+	}
+	op64(ctx,MOV,PESP,PEBP);
+	op64(ctx,POP,PEBP,UNUSED);
+	op64(ctx,JMP,PEAX,UNUSED);
+}
+#endif
+
 void hl_jit_init( jit_ctx *ctx, hl_module *m ) {
 	hl_jit_init_module(ctx,m);
 	ctx->c2hl = jit_build(ctx, jit_c2hl);
@@ -2704,6 +4220,22 @@ void hl_jit_init( jit_ctx *ctx, hl_module *m ) {
 	ctx->static_functions[0] = (void*)(int_val)jit_build(ctx,jit_null_access);
 	ctx->static_functions[1] = (void*)(int_val)jit_build(ctx,jit_assert);
 	ctx->static_functions[2] = (void*)(int_val)jit_build(ctx,jit_null_field_access);
+#	ifdef HL_64
+	if( m->jit_reserved ) ctx->lazy = jit_build(ctx,jit_lazy);
+#	endif
+}
+
+int hl_jit_lazy_stub( jit_ctx *ctx, hl_module *m, hl_function *f ) {
+	// 16 bytes entry of a function compiled on its first call, patched by hl_jit_patch_method once it is
+	int pos, j;
+	preg p;
+	jit_buf(ctx);
+	pos = BUF_POS();
+	op32(ctx,MOV,PEAX,pconst(&p,(int)(f - m->code->functions)));
+	XJump(JAlways,j);
+	patch_jump_to(ctx,j,ctx->lazy);
+	jit_nops(ctx);
+	return pos;
 }
 
 void hl_jit_reset( jit_ctx *ctx, hl_module *m ) {
@@ -2711,6 +4243,79 @@ void hl_jit_reset( jit_ctx *ctx, hl_module *m ) {
 	hl_jit_init_module(ctx,m);
 }
 
+void hl_jit_init_part( jit_ctx *ctx, hl_module *m ) {
+	// compiles some functions of the module in its own buffer, see hl_jit_merge
+	hl_jit_init_module(ctx,m);
+	ctx->buf.b = ctx->startBuf; // the floats are emitted by the main context
+}
+
+static void merge_list( jit_ctx *ctx, jlist **dst, jlist *src, int base ) {
+	while( src ) {
+		jlist *j = (jlist*)hl_malloc(&ctx->galloc,sizeof(jlist));
+		j->pos = src->pos + base;
+		j->target = src->target;
+		j->next = *dst;
+		*dst = j;
+		src = src->next;
+	}
+}
+
+int hl_jit_merge( jit_ctx *ctx, jit_ctx *part ) {
+	// append the functions compiled by a part context : the code is the same as if we compiled them
+	// since our functions all start on 16 bytes, only what refers to the buffer start needs to be moved
+	int i, base, size = (int)(part->buf.b - part->startBuf);
+	jlist *c;
+	jref *r;
+	jit_buf_size(ctx, size);
+	base = BUF_POS();
+	if( size ) memcpy(ctx->buf.b, part->startBuf, size);
+	ctx->buf.b += size;
+	for(c=part->coderefs;c;c=c->next)
+		*(int*)(ctx->startBuf + base + c->pos) -= base;
+	merge_list(ctx, &ctx->coderefs, part->coderefs, base);
+	merge_list(ctx, &ctx->calls, part->calls, base);
+	merge_list(ctx, &ctx->switchs, part->switchs, base);
+	for(r=part->refs;r;r=r->next) {
+		jref *j = (jref*)hl_malloc(&ctx->galloc,sizeof(jref));
+		*j = *r;
+		if( j->pos >= 0 ) j->pos += base;
+		j->next = ctx->refs;
+		ctx->refs = j;
+	}
+	if( part->closure_list ) {
+		vclosure *cl = part->closure_list;
+		while( cl->value ) cl = (vclosure*)cl->value;
+		cl->value = ctx->closure_list;
+		ctx->closure_list = part->closure_list;
+		part->closure_list = NULL;
+	}
+#	ifdef HL_64
+	for(i=0;i<part->stackMapsCount;i++) {
+		hl_stack_map *m = alloc_stack_map(ctx);
+		*m = part->stackMaps[i];
+		m->ret += base;
+		m->bits += ctx->stackBitsCount;
+	}
+	alloc_stack_bits(ctx, part->stackBitsCount);
+	for(i=0;i<part->stackBitsCount;i++)
+		if( part->stackBits[i >> 5] & (1u << (i & 31)) ) {
+			int b = ctx->stackBitsCount + i;
+			ctx->stackBits[b >> 5] |= 1u << (b & 31);
+		}
+	ctx->stackBitsCount += part->stackBitsCount;
+#	endif
+	if( part->debug ) {
+		for(i=0;i<ctx->m->code->nfunctions;i++)
+			if( part->debug[i].start >= 0 ) {
+				ctx->debug[i] = part->debug[i];
+				ctx->debug[i].start += base;
+			}
+		free(part->debug);
+		part->debug = NULL;
+	}
+	return base;
+}
+
 static void *get_dyncast( hl_type *t ) {
 	switch( t->kind ) {
 	case HF32:
@@ -2771,7 +4376,7 @@ static double uint_to_double( unsigned int v ) {
 
 static vclosure *alloc_static_closure( jit_ctx *ctx, int fid ) {
 	hl_module *m = ctx->m;
-	vclosure *c = hl_malloc(&m->ctx.alloc,sizeof(vclosure));
+	vclosure *c = (vclosure*)jit_module_alloc(ctx,sizeof(vclosure));
 	int fidx = m->functions_indexes[fid];
 	c->hasValue = 0;
 	if( fidx >= m->code->nfunctions ) {
@@ -2833,12 +4438,12 @@ static void make_dyn_cast( jit_ctx *ctx, vreg *dst, vreg *v ) {
 	case HF64:
 	case HI64:
 		size = begin_native_call(ctx, 2);
-		set_native_arg(ctx, pconst64(&p,(int_val)v->t));
+		set_native_arg(ctx, pptr(&p,v->t));
 		break;
 	default:
 		size = begin_native_call(ctx, 3);
-		set_native_arg(ctx, pconst64(&p,(int_val)dst->t));
-		set_native_arg(ctx, pconst64(&p,(int_val)v->t));
+		set_native_arg(ctx, pptr(&p,dst->t));
+		set_native_arg(ctx, pptr(&p,v->t));
 		break;
 	}
 	tmp = alloc_native_arg(ctx);
@@ -2853,7 +4458,7 @@ static void make_dyn_cast( jit_ctx *ctx, vreg *dst, vreg *v ) {
 }
 
 int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
-	int i, size = 0, opCount;
+	int i, size = 0, opCount, nvregs;
 	int codePos = BUF_POS();
 	int nargs = f->type->fun->nargs;
 	unsigned short *debug16 = NULL;
@@ -2861,16 +4466,21 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 	call_regs cregs = {0};
 	hl_thread_info *tinf = NULL;
 	preg p;
-	ctx->f = f;
+	ctx->fid = (int)(f - m->code->functions);
 	ctx->allocOffset = 0;
-	if( f->nregs > ctx->maxRegs ) {
+	ctx->profile = m->jit_profile ? m->jit_profile + ctx->fid : NULL;
+	ctx->baseline = ctx->profile && !ctx->profile->tier;
+	f = inline_prepare(ctx, f);
+	ctx->f = f;
+	nvregs = f->nregs + 1 + sink_prepare(ctx, f);
+	if( nvregs > ctx->maxRegs ) {
 		free(ctx->vregs);
-		ctx->vregs = (vreg*)malloc(sizeof(vreg) * (f->nregs + 1));
+		ctx->vregs = (vreg*)malloc(sizeof(vreg) * nvregs);
 		if( ctx->vregs == NULL ) {
 			ctx->maxRegs = 0;
 			return -1;
 		}
-		ctx->maxRegs = f->nregs;
+		ctx->maxRegs = nvregs;
 	}
 	if( f->nops > ctx->maxOps ) {
 		free(ctx->opsPos);
@@ -2882,9 +4492,17 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		ctx->maxOps = f->nops;
 	}
 	memset(ctx->opsPos,0,(f->nops+1)*sizeof(int));
-	for(i=0;i<f->nregs;i++) {
+	regs_prepare(ctx, f);
+	trap_prepare(ctx, f);
+	ctx->currentPos = 1;
+	for(i=0;i<REG_COUNT;i++) {
+		ctx->pregs[i].holds = NULL;
+		ctx->pregs[i].lock = 0;
+	}
+	for(i=0;i<nvregs;i++) {
 		vreg *r = R(i);
-		r->t = f->regs[i];
+		if( i == f->nregs ) continue; // scratch
+		r->t = i < f->nregs ? f->regs[i] : ctx->sinkTypes[i - (f->nregs + 1)];
 		r->size = hl_type_size(r->t);
 		r->current = NULL;
 		r->stack.holds = NULL;
@@ -2907,18 +4525,42 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			r->stackPos = -size;
 		}
 	}
-	for(i=nargs;i<f->nregs;i++) {
+	for(i=nargs;i<nvregs;i++) {
 		vreg *r = R(i);
+		if( i == f->nregs ) continue;
 		size += r->size;
 		size += hl_pad_size(size,r->t); // align local vars
 		r->stackPos = -size;
 	}
+	if( ctx->traps ) {
+		size += hl_pad_size(size,&hlt_dyn);
+		size += sizeof(hl_jit_frame);
+		ctx->trapFrame = -size;
+	}
 #	ifdef HL_64
 	size += (-size) & 15; // align on 16 bytes
 #	else
 	size += hl_pad_size(size,&hlt_dyn); // align on word size
 #	endif
 	ctx->totalRegsSize = size;
+#	ifdef HL_64
+	{
+		// one bit per word of the locals : set if it holds a GC pointer
+		int nbits = size / HL_WSIZE;
+		alloc_stack_bits(ctx, nbits);
+		ctx->frameBits = ctx->stackBitsCount;
+		for(i=0;i<nvregs;i++) {
+			vreg *r = R(i);
+			if( i == f->nregs || (i < f->nregs && SUNK(i)) ) continue; // a sunk register is never written
+			if( r->stackPos < 0 && hl_is_ptr(r->t) ) {
+				int b = ctx->frameBits + (size + r->stackPos) / HL_WSIZE;
+				ctx->stackBits[b >> 5] |= 1u << (b & 31);
+			}
+		}
+		ctx->stackBitsCount += nbits;
+		ctx->trapDepth = 0;
+	}
+#	endif
 	jit_buf(ctx);
 	ctx->functionPos = BUF_POS();
 	op_enter(ctx);
@@ -2936,7 +4578,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			r->current = p;
 		}
 	}
+	if( ctx->traps ) trap_enter(ctx);
 #	endif
+	gc_safepoint(ctx);
+	tier_counter(ctx);
 	if( ctx->m->code->hasdebug ) {
 		debug16 = (unsigned short*)malloc(sizeof(unsigned short) * (f->nops + 1));
 		debug16[0] = (unsigned short)(BUF_POS() - codePos);
@@ -2975,7 +4620,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				void *addr = m->globals_data + m->globals_indexes[o->p2];
 #				ifdef HL_64
 				preg *tmp = alloc_reg(ctx, RCPU);
-				op64(ctx, MOV, tmp, pconst64(&p,(int_val)addr));
+				op64(ctx, MOV, tmp, pptr(&p,addr));
 				copy_to(ctx, dst, pmem(&p,tmp->id,0));
 #				else
 				copy_to(ctx, dst, paddr(&p,addr));
@@ -2987,7 +4632,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				void *addr = m->globals_data + m->globals_indexes[o->p1];
 #				ifdef HL_64
 				preg *tmp = alloc_reg(ctx, RCPU);
-				op64(ctx, MOV, tmp, pconst64(&p,(int_val)addr));
+				op64(ctx, MOV, tmp, pptr(&p,addr));
 				copy_from(ctx, pmem(&p,tmp->id,0), ra);
 #				else
 				copy_from(ctx, paddr(&p,addr), ra);
@@ -3074,11 +4719,19 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		case OJTrue:
 		case OJNotNull:
 		case OJNull:
+			if( (o->op == OJNull || o->op == OJNotNull) && SUNK(o->p1) ) {
+				// a sunk allocation is never null
+				if( o->op == OJNull ) break;
+				regs_back_edge(ctx,(opCount + 1) + o->p2);
+				jump = do_jump(ctx,OJAlways,false);
+				register_branch(ctx,jump,(opCount + 1) + o->p2);
+				break;
+			}
 			{
 				preg *r = dst->t->kind == HBOOL ? alloc_cpu8(ctx, dst, true) : alloc_cpu(ctx, dst, true);
 				op64(ctx, dst->t->kind == HBOOL ? TEST8 : TEST, r, r);
 				XJump( o->op == OJFalse || o->op == OJNull ? JZero : JNotZero,jump);
-				register_jump(ctx,jump,(opCount + 1) + o->p2);
+				register_branch(ctx,jump,(opCount + 1) + o->p2);
 			}
 			break;
 		case OJEq:
@@ -3094,18 +4747,21 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			op_jump(ctx,dst,ra,o,(opCount + 1) + o->p3);
 			break;
 		case OJAlways:
+			regs_back_edge(ctx,(opCount + 1) + o->p1);
 			jump = do_jump(ctx,o->op,false);
-			register_jump(ctx,jump,(opCount + 1) + o->p1);
+			register_branch(ctx,jump,(opCount + 1) + o->p1);
 			break;
 		case OToDyn:
-			if( ra->t->kind == HBOOL ) {
+			if( SUNK(o->p1) ) {
+				op_mov(ctx, R(ctx->sink[o->p1].base), ra);
+			} else if( ra->t->kind == HBOOL ) {
 				int size = begin_native_call(ctx, 1);
 				set_native_arg(ctx, fetch(ra));
 				call_native(ctx, hl_alloc_dynbool, size);
 				store(ctx, dst, PEAX, true);
 			} else {
 				int_val rt = (int_val)ra->t;
-				int jskip = 0;
+				int jskip = 0, jdone = 0, jbox = 0;
 				if( hl_is_ptr(ra->t) ) {
 					int jnz;
 					preg *a = alloc_cpu(ctx,ra,true);
@@ -3114,8 +4770,12 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					op64(ctx,XOR,PEAX,PEAX); // will replace the result of alloc_dynamic at jump land
 					XJump_small(JAlways,jskip);
 					patch_jump(ctx,jnz);
+				} else {
+					jbox = dyn_box_cache(ctx, ra);
+					jdone = gc_alloc_inline(ctx, ra->t, sizeof(vdynamic), MEM_KIND_NOPTR, true);
 				}
 				call_native_consts(ctx, hl_alloc_dynamic, &rt, 1);
+				if( jdone ) patch_jump(ctx,jdone);
 				// copy value to dynamic
 				if( (IS_FLOAT(ra) || ra->size == 8) && !IS_64 ) {
 					preg *tmp = REG_AT(RCPU_SCRATCH_REGS[1]);
@@ -3133,6 +4793,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					op64(ctx,MOV,pmem(&p,Eax,HDYN_VALUE),tmp);
 				}
 				if( hl_is_ptr(ra->t) ) patch_jump(ctx,jskip);
+				if( jbox ) {
+					patch_jump(ctx,jbox);
+					scratch(REG_AT(RCPU_SCRATCH_REGS[1]));
+				}
 				store(ctx, dst, PEAX, true);
 			}
 			break;
@@ -3215,6 +4879,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case ORet:
+			if( ctx->traps ) trap_leave(ctx);
 			op_ret(ctx, dst);
 			break;
 		case OIncr:
@@ -3248,7 +4913,19 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				case HF64:
 				case HF32:
 #					ifdef HL_64
-					op64(ctx,dst->t->kind == HF32 ? MOVSS : MOVSD,alloc_fpu(ctx,dst,false),pcodeaddr(&p,o->p2 * 8 + (dst->t->kind == HF32 ? 4 : 0)));
+					if( m->jit_code ) {
+						preg *tmp = alloc_reg(ctx,RCPU);
+						op64(ctx,MOV,tmp,pconst64(&p,(int_val)m->jit_code + o->p2 * 8 + (dst->t->kind == HF32 ? 4 : 0)));
+						op64(ctx,dst->t->kind == HF32 ? MOVSS : MOVSD,alloc_fpu(ctx,dst,false),pmem(&p,tmp->id,0));
+					} else {
+						jlist *j;
+						op64(ctx,dst->t->kind == HF32 ? MOVSS : MOVSD,alloc_fpu(ctx,dst,false),pcodeaddr(&p,o->p2 * 8 + (dst->t->kind == HF32 ? 4 : 0)));
+						j = (jlist*)hl_malloc(&ctx->galloc,sizeof(jlist));
+						j->pos = BUF_POS() - 4;
+						j->target = 0;
+						j->next = ctx->coderefs;
+						ctx->coderefs = j;
+					}
 #					else
 					op64(ctx,dst->t->kind == HF32 ? MOVSS : MOVSD,alloc_fpu(ctx,dst,false),paddr(&p,m->code->floats + o->p2));
 #					endif
@@ -3260,13 +4937,13 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OString:
-			op64(ctx,MOV,alloc_cpu(ctx, dst, false),pconst64(&p,(int_val)hl_get_ustring(m->code,o->p2)));
+			op64(ctx,MOV,alloc_cpu(ctx, dst, false),pref(&p,(void*)hl_get_ustring(m->code,o->p2),REF_STRING,o->p2));
 			store(ctx,dst,dst->current,false);
 			break;
 		case OBytes:
 			{
 				char *b = m->code->version >= 5 ? m->code->bytes + m->code->bytes_pos[o->p2] : m->code->strings[o->p2];
-				op64(ctx,MOV,alloc_cpu(ctx,dst,false),pconst64(&p,(int_val)b));
+				op64(ctx,MOV,alloc_cpu(ctx,dst,false),pref(&p,b,REF_BYTES,o->p2));
 				store(ctx,dst,dst->current,false);
 			}
 			break;
@@ -3277,6 +4954,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case ONew:
+			if( SUNK(o->p1) ) {
+				sink_init(ctx, ctx->sink + o->p1);
+				break;
+			}
 			{
 				int_val args[] = { (int_val)dst->t };
 				void *allocFun;
@@ -3296,11 +4977,22 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				default:
 					ASSERT(dst->t->kind);
 				}
+				int jdone = 0;
+				if( allocFun == hl_alloc_obj ) {
+					hl_runtime_obj *rt = hl_get_obj_rt(dst->t);
+					int kind = rt->hasPtr ? (dst->t->kind == HSTRUCT ? MEM_KIND_RAW : MEM_KIND_DYNAMIC) : MEM_KIND_NOPTR;
+					if( !rt->nbindings ) jdone = gc_alloc_inline(ctx, dst->t, rt->size, kind, dst->t->kind == HOBJ);
+				}
 				call_native_consts(ctx, allocFun, args, nargs);
+				if( jdone ) patch_jump(ctx,jdone);
 				store(ctx, dst, PEAX, true);
 			}
 			break;
 		case OInstanceClosure:
+			if( SUNK(o->p1) ) {
+				op_mov(ctx, R(ctx->sink[o->p1].base), rb);
+				break;
+			}
 			{
 				preg *r = alloc_cpu(ctx, rb, true);
 				jlist *j = (jlist*)hl_malloc(&ctx->galloc,sizeof(jlist));
@@ -3313,7 +5005,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				ctx->calls = j;
 
 				set_native_arg(ctx,pconst64(&p,RESERVE_ADDRESS));
-				set_native_arg(ctx,pconst64(&p,(int_val)m->code->functions[m->functions_indexes[o->p2]].type));				
+				set_native_arg(ctx,pptr(&p,m->code->functions[m->functions_indexes[o->p2]].type));				
 				call_native(ctx,hl_alloc_closure_ptr,size);
 				store(ctx,dst,PEAX,true);
 			}
@@ -3341,14 +5033,21 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				op64(ctx,MOV,r,pmem(&p,r->id,HL_WSIZE*2));
 				op64(ctx,MOV,r,pmem(&p,r->id,HL_WSIZE*o->p3));
 				set_native_arg(ctx,r);
-				op64(ctx,MOV,r,pconst64(&p,(int_val)t));
+				op64(ctx,MOV,r,pptr(&p,t));
 				set_native_arg(ctx,r);
 				call_native(ctx,hl_alloc_closure_ptr,size);
 				store(ctx,dst,PEAX,true);
 			}
 			break;
 		case OCallClosure:
-			if( ra->t->kind == HDYN ) {
+			if( SUNK(o->p2) ) {
+				// direct call with the closure context as first argument
+				sink_reg *s = ctx->sink + o->p2;
+				int *args = (int*)hl_malloc(&ctx->falloc,sizeof(int) * (o->p3 + 1));
+				args[0] = s->base;
+				memcpy(args + 1, o->extra, o->p3 * sizeof(int));
+				op_call_fun(ctx, dst, s->findex, o->p3 + 1, args);
+			} else if( ra->t->kind == HDYN ) {
 				// ASM for {
 				//	vdynamic *args[] = {args};
 				//  vdynamic *ret = hl_dyn_call(closure,args,nargs);
@@ -3431,7 +5130,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			{
 				vclosure *c = alloc_static_closure(ctx,o->p2);
 				preg *r = alloc_reg(ctx, RCPU);
-				op64(ctx, MOV, r, pconst64(&p,(int_val)c));
+				op64(ctx, MOV, r, pref(&p,c,REF_CLOSURE,0));
 				store(ctx,dst,r,true);
 			}
 			break;
@@ -3443,6 +5142,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					break;
 				}
 #				endif 
+				if( SUNK(o->p2) ) {
+					op_mov(ctx, dst, R(ctx->sink[o->p2].base + o->p3));
+					break;
+				}
 				switch( ra->t->kind ) {
 				case HOBJ:
 				case HSTRUCT:
@@ -3472,7 +5175,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 						op64(ctx,TEST,r,r);
 						XJump_small(JNotZero,jhasfield);
 						size = begin_native_call(ctx, need_type ? 3 : 2);
-						if( need_type ) set_native_arg(ctx,pconst64(&p,(int_val)dst->t));
+						if( need_type ) set_native_arg(ctx,pptr(&p,dst->t));
 						set_native_arg(ctx,pconst64(&p,(int_val)ra->t->virt->fields[o->p3].hashed_name));
 						set_native_arg(ctx,v);
 						call_native(ctx,get_dynget(dst->t),size);
@@ -3491,6 +5194,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OSetField:
+			if( SUNK(o->p1) ) {
+				op_mov(ctx, R(ctx->sink[o->p1].base + o->p2), rb);
+				break;
+			}
 			{
 				switch( dst->t->kind ) {
 				case HOBJ:
@@ -3499,6 +5206,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 						hl_runtime_obj *rt = hl_get_obj_rt(dst->t);
 						preg *rr = alloc_cpu(ctx, dst, true);
 						copy_from(ctx, pmem(&p, (CpuReg)rr->id, rt->fields_indexes[o->p2]), rb);
+						gc_write_barrier(ctx, rr, rb);
 					}
 					break;
 				case HVIRTUAL:
@@ -3524,7 +5232,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 						default:
 							size = begin_native_call(ctx, 4);
 							set_native_arg(ctx, fetch(rb));
-							set_native_arg(ctx, pconst64(&p,(int_val)rb->t));
+							set_native_arg(ctx, pptr(&p,rb->t));
 							break;
 						}
 						set_native_arg(ctx,pconst(&p,dst->t->virt->fields[o->p2].hashed_name));
@@ -3543,7 +5251,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 						default:
 							size = pad_before_call(ctx,HL_WSIZE*4);
 							op64(ctx,PUSH,fetch32(ctx,rb),UNUSED);
-							op64(ctx,MOV,r,pconst64(&p,(int_val)rb->t));
+							op64(ctx,MOV,r,pptr(&p,rb->t));
 							op64(ctx,PUSH,r,UNUSED);
 							break;
 						}
@@ -3555,6 +5263,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 						XJump_small(JAlways,jend);
 						patch_jump(ctx,jhasfield);
 						copy_from(ctx, pmem(&p,(CpuReg)r->id,0), rb);
+						gc_write_barrier(ctx, r, rb);
 						patch_jump(ctx,jend);
 						scratch(rb->current);
 					}
@@ -3588,6 +5297,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				hl_runtime_obj *rt = hl_get_obj_rt(r->t);
 				preg *rr = alloc_cpu(ctx, r, true);
 				copy_from(ctx, pmem(&p, (CpuReg)rr->id, rt->fields_indexes[o->p1]), ra);
+				gc_write_barrier(ctx, rr, ra);
 			}
 			break;
 		case OCallThis:
@@ -3678,7 +5388,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					}
 					set_native_arg(ctx,r);
 					set_native_arg(ctx,pconst(&p,obj->t->virt->fields[o->p2].hashed_name)); // fid
-					set_native_arg(ctx,pconst64(&p,(int_val)obj->t->virt->fields[o->p2].t)); // ftype
+					set_native_arg(ctx,pptr(&p,obj->t->virt->fields[o->p2].t)); // ftype
 					set_native_arg(ctx,pmem(&p,v->id,HL_WSIZE)); // o->value
 					call_native(ctx,hl_dyn_call_obj,size + paramsSize);
 					if( need_dyn ) {
@@ -3725,8 +5435,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OLabel:
-			// NOP for now
-			discard_regs(ctx,false);
+			// target of the loop back-edges
+			regs_loop(ctx,opCount);
+			gc_safepoint(ctx);
+			tier_counter(ctx);
 			break;
 		case OGetI8:
 		case OGetI16:
@@ -3792,7 +5504,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			break;
 		case OType:
 			{
-				op64(ctx,MOV,alloc_cpu(ctx, dst, false),pconst64(&p,(int_val)(m->code->types + o->p2)));
+				op64(ctx,MOV,alloc_cpu(ctx, dst, false),pptr(&p,m->code->types + o->p2));
 				store(ctx,dst,dst->current,false);
 			}
 			break;
@@ -3803,7 +5515,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				preg *tmp = alloc_reg(ctx, RCPU);
 				op64(ctx,TEST,r,r);
 				XJump_small(JNotZero,jnext);
-				op64(ctx,MOV, tmp, pconst64(&p,(int_val)&hlt_void));
+				op64(ctx,MOV, tmp, pptr(&p,&hlt_void));
 				XJump_small(JAlways,jend);
 				patch_jump(ctx,jnext);
 				op64(ctx, MOV, tmp, pmem(&p,r->id,0));
@@ -3844,6 +5556,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					copy(ctx, pmem2(&p,alloc_cpu(ctx,dst,true)->id,alloc_cpu64(ctx,ra,true)->id,sizeof(void*),0), rrb, rb->size);
 				} else
 					copy(ctx, pmem2(&p,alloc_cpu(ctx,dst,true)->id,alloc_cpu64(ctx,ra,true)->id,hl_type_size(rb->t),sizeof(varray)), rrb, rb->size);
+				gc_write_barrier(ctx, alloc_cpu(ctx,dst,true), rb);
 			}
 			break;
 		case OArraySize:
@@ -3868,6 +5581,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			break;
 		case OSetref:
 			copy_from(ctx,pmem(&p,alloc_cpu(ctx,dst,true)->id,0),ra);
+			gc_write_barrier(ctx, alloc_cpu(ctx,dst,true), ra);
 			break;
 		case ORefData:
 			switch( ra->t->kind ) {
@@ -3917,7 +5631,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 #				ifdef HL_64
 				int size = pad_before_call(ctx, 0);
 				op64(ctx,MOV,REG_AT(CALL_REGS[1]),fetch(ra));
-				op64(ctx,MOV,REG_AT(CALL_REGS[0]),pconst64(&p,(int_val)dst->t));
+				op64(ctx,MOV,REG_AT(CALL_REGS[0]),pptr(&p,dst->t));
 #				else
 				int size = pad_before_call(ctx, HL_WSIZE*2);
 				op32(ctx,PUSH,fetch(ra),UNUSED);
@@ -3971,11 +5685,13 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					}
 				default:
 					copy(ctx,pmem(&p,r->id,c->offsets[o->p2]),alloc_cpu(ctx,rb,true),hl_type_size(c->params[o->p2]));
+					gc_write_barrier(ctx, r, rb);
 					break;
 				}
 			}
 			break;
 		case ONullCheck:
+			if( SUNK(o->p1) ) break;
 			{
 				int jz;
 				preg *r = alloc_cpu(ctx,dst,true);
@@ -4013,17 +5729,23 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OSafeCast:
+			if( SUNK(o->p2) ) {
+				op_mov(ctx, dst, R(ctx->sink[o->p2].base));
+				break;
+			}
 			make_dyn_cast(ctx, dst, ra);
 			break;
 		case ODynGet:
 			{
 				int size;
 #				ifdef HL_64
+				int jhit[2], jend;
+				dyn_field_cache(ctx, ra, hl_hash_utf8(m->code->strings[o->p3]), dst->t, false, jhit);
 				if( IS_FLOAT(dst) || dst->t->kind == HI64 ) {
 					size = begin_native_call(ctx,2);
 				} else {
 					size = begin_native_call(ctx,3);
-					set_native_arg(ctx,pconst64(&p,(int_val)dst->t));
+					set_native_arg(ctx,pptr(&p,dst->t));
 				}
 				set_native_arg(ctx,pconst64(&p,(int_val)hl_hash_utf8(m->code->strings[o->p3])));
 				set_native_arg(ctx,fetch(ra));
@@ -4043,37 +5765,56 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 #				endif
 				call_native(ctx,get_dynget(dst->t),size);
 				store_result(ctx,dst);
+#				ifdef HL_64
+				XJump_small(JAlways,jend);
+				patch_jump(ctx,jhit[0]);
+				patch_jump(ctx,jhit[1]);
+				copy_to(ctx,dst,pmem(&p,Eax,0));
+				patch_jump(ctx,jend);
+				scratch(dst->current);
+#				endif
 			}
 			break;
 		case ODynSet:
 			{
 				int size;
 #				ifdef HL_64
+				int jhit[2], jend;
+				int hfield = field_hash(ctx,o->p2);
+				dyn_field_cache(ctx, dst, hfield, rb->t, true, jhit);
 				switch( rb->t->kind ) {
 				case HF32:
 				case HF64:
 					size = begin_native_call(ctx, 3);
 					set_native_arg_fpu(ctx,fetch(rb),rb->t->kind == HF32);
-					set_native_arg(ctx,pconst64(&p,hl_hash_gen(hl_get_ustring(m->code,o->p2),true)));
+					set_native_arg(ctx,pconst(&p,hfield));
 					set_native_arg(ctx,fetch(dst));
 					call_native(ctx,get_dynset(rb->t),size);
 					break;
 				case HI64:
 					size = begin_native_call(ctx, 3);
 					set_native_arg(ctx,fetch(rb));
-					set_native_arg(ctx,pconst64(&p,hl_hash_gen(hl_get_ustring(m->code,o->p2),true)));
+					set_native_arg(ctx,pconst(&p,hfield));
 					set_native_arg(ctx,fetch(dst));
 					call_native(ctx,get_dynset(rb->t),size);
 					break;
 				default:
 					size = begin_native_call(ctx,4);
 					set_native_arg(ctx,fetch(rb));
-					set_native_arg(ctx,pconst64(&p,(int_val)rb->t));
-					set_native_arg(ctx,pconst64(&p,hl_hash_gen(hl_get_ustring(m->code,o->p2),true)));
+					set_native_arg(ctx,pptr(&p,rb->t));
+					set_native_arg(ctx,pconst(&p,hfield));
 					set_native_arg(ctx,fetch(dst));
 					call_native(ctx,get_dynset(rb->t),size);
 					break;
 				}
+				XJump_small(JAlways,jend);
+				patch_jump(ctx,jhit[0]);
+				patch_jump(ctx,jhit[1]);
+				RLOCK(PEAX);
+				copy_from(ctx,pmem(&p,Eax,0),rb);
+				gc_write_barrier(ctx,PEAX,rb);
+				patch_jump(ctx,jend);
+				scratch(rb->current);
 #				else
 				switch( rb->t->kind ) {
 				case HF32:
@@ -4104,6 +5845,18 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OTrap:
+			if( ctx->traps ) {
+				jit_trap *t = ctx->traps + ctx->trapCount;
+				int target = opCount + 1 + o->p2;
+				t->op = opCount;
+				t->prev = ctx->trapCurrent;
+				t->check = trap_check(ctx,opCount);
+				ctx->trapCurrent = ctx->trapCount++;
+				// the catch is reached from the landing pad
+				if( ctx->opsPos[target] == 0 ) ctx->opsPos[target] = -1;
+				trap_set_handler(ctx,ctx->trapCurrent);
+				break;
+			}
 			{
 				int size, jenter, jtrap;
 				int offset = 0;
@@ -4127,41 +5880,23 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					offset = (int)(int_val)&tinf->trap_current;
 				} else {
 					offset = 0;
-					op64(ctx,MOV,treg,pconst64(&p,(int_val)&tinf->trap_current));
+					op64(ctx,MOV,treg,pptr(&p,&tinf->trap_current));
 				}
 				op64(ctx,MOV,trap,pmem(&p,treg->id,offset));
 				op64(ctx,SUB,PESP,pconst(&p,trap_size));
+				ctx->trapDepth++;
 				op64(ctx,MOV,pmem(&p,Esp,(int)(int_val)&t->prev),trap);
 				op64(ctx,MOV,trap,PESP);
 				op64(ctx,MOV,pmem(&p,treg->id,offset),trap);
 
-				/*
-					This is a bit hackshish : we want to detect the type of exception filtered by the catch so we check the following
-					sequence of HL opcodes:
-
-					trap E,@catch
-					...
-					@catch:
-					global R, _
-					call _, ???(R,E)
-
-					??? is expected to be hl.BaseType.check
-				*/
-				hl_opcode *next = f->ops + opCount + 1 + o->p2;
-				hl_opcode *next2 = f->ops + opCount + 2 + o->p2;
-				if( next->op == OGetGlobal && next2->op == OCall2 && next2->p3 == next->p1 && dst->stack.id == (int)(int_val)next2->extra ) {
-					hl_type *gt = m->code->globals[next->p2];
-					while( gt->kind == HOBJ && gt->obj->super ) gt = gt->obj->super;
-					if( gt->kind == HOBJ && gt->obj->nfields && gt->obj->fields[0].t->kind == HTYPE ) {
-						void *addr = m->globals_data + m->globals_indexes[next->p2];
-#						ifdef HL_64
-						op64(ctx,MOV,treg,pconst64(&p,(int_val)addr));
-						op64(ctx,MOV,treg,pmem(&p,treg->id,0));
-#						else
-						op64(ctx,MOV,treg,paddr(&p,addr));
-#						endif
-					} else
-						op64(ctx,MOV,treg,pconst(&p,0));
+				void *addr = trap_check(ctx,opCount);
+				if( addr ) {
+#					ifdef HL_64
+					op64(ctx,MOV,treg,pptr(&p,addr));
+					op64(ctx,MOV,treg,pmem(&p,treg->id,0));
+#					else
+					op64(ctx,MOV,treg,paddr(&p,addr));
+#					endif
 				} else {
 					op64(ctx,MOV,treg,pconst(&p,0));
 				}
@@ -4177,7 +5912,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					call_native(ctx, hl_get_thread, 0);
 					op64(ctx,MOV,PEAX,pmem(&p, Eax, (int)(int_val)&tinf->exc_value));
 				} else {
-					op64(ctx,MOV,PEAX,pconst64(&p,(int_val)&tinf->exc_value));
+					op64(ctx,MOV,PEAX,pptr(&p,&tinf->exc_value));
 					op64(ctx,MOV,PEAX,pmem(&p, Eax, 0));
 				}
 				store(ctx,dst,PEAX,false);
@@ -4188,6 +5923,18 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OEndTrap:
+			if( ctx->traps ) {
+				// an early exit (break, return) restores the enclosing try only for the exit path
+				int k = ctx->trapCurrent;
+				if( !o->p1 && opCount > 0 && o[-1].op == OEndTrap && !o[-1].p1 )
+					k = ctx->trapExit < 0 ? -1 : ctx->traps[ctx->trapExit].prev;
+				if( o->p1 )
+					ctx->trapCurrent = k < 0 ? -1 : ctx->traps[k].prev;
+				else
+					ctx->trapExit = k;
+				trap_set_handler(ctx,k < 0 ? -1 : ctx->traps[k].prev);
+				break;
+			}
 			{
 				int trap_size = (sizeof(hl_trap_ctx) + 15) & 0xFFF0;
 				hl_trap_ctx *tmp = NULL;
@@ -4201,7 +5948,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				} else {
 					offset = 0;
 					addr = alloc_reg(ctx, RCPU);
-					op64(ctx, MOV, addr, pconst64(&p, (int_val)&tinf->trap_current));
+					op64(ctx, MOV, addr, pptr(&p,&tinf->trap_current));
 				}
 				r = alloc_reg(ctx, RCPU);
 				op64(ctx, MOV, r, pmem(&p,addr->id,offset));
@@ -4219,6 +5966,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				}
 #				endif
 				op64(ctx,ADD,PESP,pconst(&p,trap_size));
+				ctx->trapDepth--;
 			}
 			break;
 		case OEnumIndex:
@@ -4363,9 +6111,9 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			jit_error(hl_op_name(o->op));
 			break;
 		}
-		// we are landing at this position, assume we have lost our registers
+		// we are landing at this position, only keep the registers valid on all paths
 		if( ctx->opsPos[opCount+1] == -1 )
-			discard_regs(ctx,true);
+			regs_land(ctx,o,opCount+1);
 		ctx->opsPos[opCount+1] = BUF_POS();
 
 		// write debug infos
@@ -4380,6 +6128,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		if( debug16 ) debug16[ctx->currentPos] = (unsigned short)size; else if( debug32 ) debug32[ctx->currentPos] = size;
 
 	}
+	if( ctx->traps ) trap_pads(ctx);
 	// patch jumps
 	{
 		jlist *j = ctx->jumps;
@@ -4399,10 +6148,13 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 	}
 	// save debug infos
 	{
-		int fid = (int)(f - m->code->functions);
-		ctx->debug[fid].start = codePos;
-		ctx->debug[fid].offsets = debug32 ? (void*)debug32 : (void*)debug16;
-		ctx->debug[fid].large = debug32 != NULL;
+		hl_debug_infos *d = ctx->debug + ctx->fid;
+		d->start = codePos;
+		d->offsets = debug32 ? (void*)debug32 : (void*)debug16;
+		d->large = debug32 != NULL;
+		d->ninlines = 0;
+		d->inlines = NULL;
+		if( ctx->inlinePos && d->offsets ) inline_debug(ctx, d);
 	}
 	// reset tmp allocator
 	hl_free(&ctx->falloc);
@@ -4448,11 +6200,26 @@ void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **d
 	jlist *c;
 	int size = BUF_POS();
 	unsigned char *code;
-	if( size & 4095 ) size += 4096 - (size&4095);
-	code = (unsigned char*)hl_alloc_executable_memory(size);
-	if( code == NULL ) return NULL;
+	// compiling a function of a running module : its functions already have their final address
+	bool linked = m->jit_code != NULL;
+	if( linked && m->jit_reserved && ((m->codesize + 15) & ~15) + size <= m->jit_reserved ) {
+		// lazy mode : append to the module code (once it is full, the functions get their own chunk)
+		int pos = (m->codesize + 15) & ~15;
+		code = (unsigned char*)m->jit_code + pos;
+		*codesize = pos + size;
+	} else if( !linked && m->jit_reserved ) {
+		// lazy mode : the code region is allocated once
+		code = (unsigned char*)hl_alloc_executable_memory(m->jit_reserved);
+		if( code == NULL ) return NULL;
+		*codesize = size;
+	} else {
+		if( size & 4095 ) size += 4096 - (size&4095);
+		code = (unsigned char*)hl_alloc_executable_memory(size);
+		if( code == NULL ) return NULL;
+		*codesize = size;
+	}
 	memcpy(code,ctx->startBuf,BUF_POS());
-	*codesize = size;
+	hl_gc_add_stack_maps(code,BUF_POS(),ctx->stackMaps,ctx->stackMapsCount,ctx->stackBits,ctx->stackBitsCount);
 	*debug = ctx->debug;
 	if( !call_jit_c2hl ) {
 		call_jit_c2hl = code + ctx->c2hl;
@@ -4479,7 +6246,7 @@ void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **d
 				if( old_idx < 0 )
 					return NULL;
 				fabs = previous->functions_ptrs[(previous->code->functions + old_idx)->findex];
-			} else {
+			} else if( !linked ) {
 				// relative
 				fabs = (unsigned char*)code + (int)(int_val)fabs;
 			}
@@ -4517,7 +6284,7 @@ void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **d
 					fabs = missing_closure;
 				else
 					fabs = previous->functions_ptrs[(previous->code->functions + old_idx)->findex];
-			} else {
+			} else if( !linked ) {
 				// relative
 				fabs = (unsigned char*)code + (int)(int_val)fabs;
 			}
@@ -4530,3 +6297,625 @@ void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **d
 	return code;
 }
 
+#if defined(HL_64) && !defined(HL_WIN)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// JIT cache : the code of a module saved with the addresses it contains, relocated when loaded again
+// it is only valid for the same bytecode and the same native images, everything else falls back to compiling
+
+#define CACHE_MAGIC		0x434A4C48
+#define CACHE_VERSION	2
+#define CACHE_MAX_IMAGES	64
+
+typedef struct {
+	int pos;
+	int kind;
+	int index;
+	int_val offset;
+} cache_ref;
+
+typedef struct {
+	cache_ref t;
+	int hfield;
+	int set;
+} cache_field;
+
+typedef struct {
+	void *base;
+	const char *name;
+	int anchor;
+	int64 size;
+	int64 mtime;
+	int64 inode;
+} cache_image;
+
+typedef struct {
+	unsigned char *b;
+	int pos;
+	int size;
+} cache_buf;
+
+typedef struct {
+	hl_module *m;
+	unsigned char *code;
+	int size;
+	cache_image images[CACHE_MAX_IMAGES];
+	int nimages;
+	cache_buf refs;
+	cache_buf closures;
+	cache_buf fields;
+} cache_saver;
+
+static void *cache_anchor( hl_module *m, int i ) {
+	// addresses which locate the native images : the executable, libhl, the C library, then the libraries of the natives
+	if( i == 0 ) return (void*)hl_jit_code;
+	if( i == 1 ) return (void*)hl_alloc_obj;
+	if( i == 2 ) return (void*)setjmp;
+	i -= 3;
+	return i >= 0 && i < m->code->nnatives ? m->functions_ptrs[m->code->natives[i].findex] : NULL;
+}
+
+static int cache_inlines_size( hl_code *c, hl_debug_inline *inl, int count ) {
+	// the inlined calls of a function followed by the offsets of their opcodes
+	int i, size = sizeof(hl_debug_inline) * count;
+	for(i=0;i<count;i++)
+		size += sizeof(int) * (c->functions[inl[i].fidx].nops + 1);
+	return size;
+}
+
+static int cache_flags( hl_module *m ) {
+	// what changes the code besides the bytecode and the images
+	int flags = hl_gc_use_write_barrier() ? 1 : 0;
+#	ifdef HL_THREADS
+	flags |= 2;
+#	endif
+	if( m->code->hasdebug ) flags |= 4;
+	flags |= -hl_gc_thread_offset() << 3; // inline allocations
+	return flags;
+}
+
+static bool cache_image_id( void *addr, cache_image *img ) {
+	Dl_info inf;
+	struct stat st;
+	if( addr == NULL || !dladdr(addr,&inf) || !inf.dli_fname )
+		return false;
+	img->base = inf.dli_fbase;
+	img->name = inf.dli_fname;
+#	ifdef HL_LINUX
+	{
+		// the executable name is the one it was started with
+		Dl_info exe;
+		if( dladdr((void*)hl_jit_code,&exe) && exe.dli_fbase == inf.dli_fbase )
+			img->name = "/proc/self/exe";
+	}
+#	endif
+	if( stat(img->name,&st) != 0 )
+		return false;
+	img->size = st.st_size;
+	img->mtime = st.st_mtime;
+	img->inode = st.st_ino;
+	return true;
+}
+
+static uint64 cache_check( const unsigned char *b, int64 size ) {
+	// detects a damaged file, before we run what it contains
+	uint64 h = 0xCBF29CE484222325ULL;
+	while( size >= 8 ) {
+		uint64 w;
+		memcpy(&w,b,8);
+		h = (h ^ w) * 0x100000001B3ULL;
+		b += 8;
+		size -= 8;
+	}
+	while( size-- > 0 )
+		h = (h ^ *b++) * 0x100000001B3ULL;
+	return h;
+}
+
+static void cache_write( cache_buf *b, const void *data, int size ) {
+	if( size == 0 )
+		return;
+	if( b->pos + size > b->size ) {
+		int nsize = b->size ? b->size : 4096;
+		unsigned char *nb;
+		while( nsize < b->pos + size ) nsize <<= 1;
+		nb = (unsigned char*)malloc(nsize);
+		memcpy(nb,b->b,b->pos);
+		free(b->b);
+		b->b = nb;
+		b->size = nsize;
+	}
+	memcpy(b->b + b->pos,data,size);
+	b->pos += size;
+}
+
+static bool cache_image_ref( cache_saver *s, void *ptr, cache_ref *r ) {
+	Dl_info inf;
+	int i;
+	if( !dladdr(ptr,&inf) )
+		return false;
+	for(i=0;i<s->nimages;i++)
+		if( s->images[i].base == inf.dli_fbase )
+			break;
+	if( i == s->nimages ) {
+		cache_image *img = s->images + i;
+		int a, nanchors = 3 + s->m->code->nnatives;
+		if( i == CACHE_MAX_IMAGES )
+			return false;
+		for(a=0;a<nanchors;a++) {
+			Dl_info ainf;
+			void *p = cache_anchor(s->m,a);
+			if( p && dladdr(p,&ainf) && ainf.dli_fbase == inf.dli_fbase )
+				break;
+		}
+		if( a == nanchors || !cache_image_id(cache_anchor(s->m,a),img) )
+			return false;
+		img->anchor = a;
+		s->nimages++;
+	}
+	r->kind = REF_IMAGE;
+	r->index = i;
+	r->offset = (unsigned char*)ptr - (unsigned char*)cache_anchor(s->m,s->images[i].anchor);
+	return true;
+}
+
+static bool cache_value( cache_saver *s, void *ptr, cache_ref *r ) {
+	hl_module *m = s->m;
+	unsigned char *p = (unsigned char*)ptr;
+	unsigned char *types = (unsigned char*)m->code->types;
+	r->index = 0;
+	r->offset = 0;
+	if( p == NULL )
+		r->kind = REF_PTR;
+	else if( p >= s->code && p < s->code + s->size ) {
+		r->kind = REF_CODE;
+		r->offset = p - s->code;
+	} else if( p >= types && p < types + sizeof(hl_type) * m->code->ntypes ) {
+		r->kind = REF_TYPE;
+		r->offset = p - types;
+	} else if( p >= m->globals_data && p < m->globals_data + m->globals_size ) {
+		r->kind = REF_GLOBAL;
+		r->offset = p - m->globals_data;
+	} else if( ptr == m )
+		r->kind = REF_MODULE;
+	else
+		return cache_image_ref(s,ptr,r);
+	return true;
+}
+
+static bool cache_code_ref( cache_saver *s, int pos ) {
+	cache_ref r;
+	if( !cache_value(s,*(void**)(s->code + pos),&r) )
+		return false;
+	r.pos = pos;
+	cache_write(&s->refs,&r,sizeof(r));
+	return true;
+}
+
+static bool cache_collect( cache_saver *s, jit_ctx *ctx ) {
+	jref *r;
+	jlist *c;
+	hl_field_cache *last = NULL;
+	int nfields = 0;
+	for(r=ctx->refs;r;r=r->next) {
+		cache_ref cr;
+		void *v = r->pos < 0 ? NULL : *(void**)(s->code + r->pos);
+		cr.pos = r->pos;
+		cr.kind = r->kind;
+		cr.index = r->index;
+		cr.offset = 0;
+		switch( r->kind ) {
+		case REF_PTR:
+			if( !cache_code_ref(s,r->pos) )
+				return false;
+			continue;
+		case REF_CLOSURE:
+			{
+				vclosure *cl = (vclosure*)v;
+				cache_ref ct, cf;
+				if( !cache_value(s,cl->t,&ct) || !cache_value(s,cl->fun,&cf) )
+					return false;
+				cr.index = s->closures.pos / (sizeof(cache_ref) * 2);
+				cache_write(&s->closures,&ct,sizeof(ct));
+				cache_write(&s->closures,&cf,sizeof(cf));
+			}
+			break;
+		case REF_CACHE:
+			{
+				// the two references of a site follow each other
+				hl_field_cache *fc = (hl_field_cache*)v;
+				cache_field f;
+				if( fc != last ) {
+					if( !cache_value(s,fc->t,&f.t) )
+						return false;
+					f.hfield = fc->hfield;
+					f.set = fc->set;
+					cache_write(&s->fields,&f,sizeof(f));
+					last = fc;
+					nfields++;
+				}
+				cr.index = nfields - 1;
+			}
+			break;
+		default:
+			break;
+		}
+		cache_write(&s->refs,&cr,sizeof(cr));
+	}
+	// absolute addresses in the code : calls through a register and switch tables
+	for(c=ctx->calls;c;c=c->next)
+		if( (s->code[c->pos]&~3) == 0x48 && !cache_code_ref(s,c->pos + 2) )
+			return false;
+	for(c=ctx->switchs;c;c=c->next)
+		if( !cache_code_ref(s,c->pos) )
+			return false;
+	return true;
+}
+
+void hl_jit_save( jit_ctx *ctx, hl_module *m ) {
+	cache_saver s;
+	cache_buf out;
+	char *tmp;
+	FILE *f;
+	int i, count;
+	bool ok;
+	memset(&s,0,sizeof(s));
+	memset(&out,0,sizeof(out));
+	s.m = m;
+	s.code = (unsigned char*)m->jit_code;
+	s.size = BUF_POS();
+	ok = cache_collect(&s,ctx);
+	if( ok ) {
+		int header[] = { CACHE_MAGIC, CACHE_VERSION, HL_VERSION, cache_flags(m), m->code->nfunctions, m->globals_size, s.size, ctx->c2hl, ctx->hl2c, s.nimages, m->jit_inline };
+		cache_write(&out,header,sizeof(header));
+		uint64 check = 0;
+		int check_pos;
+		cache_write(&out,&m->code->digest,sizeof(uint64));
+		check_pos = out.pos;
+		cache_write(&out,&check,sizeof(uint64));
+		for(i=0;i<s.nimages;i++) {
+			cache_image *img = s.images + i;
+			int len = (int)strlen(img->name);
+			cache_write(&out,&img->anchor,sizeof(int));
+			cache_write(&out,&img->size,sizeof(int64));
+			cache_write(&out,&img->mtime,sizeof(int64));
+			cache_write(&out,&img->inode,sizeof(int64));
+			cache_write(&out,&len,sizeof(int));
+			cache_write(&out,img->name,len);
+		}
+		cache_write(&out,s.code,s.size);
+		for(i=0;i<m->code->nfunctions;i++) {
+			int pos = (int)((unsigned char*)m->functions_ptrs[m->code->functions[i].findex] - s.code);
+			cache_write(&out,&pos,sizeof(int));
+		}
+		count = s.refs.pos / sizeof(cache_ref);
+		cache_write(&out,&count,sizeof(int));
+		cache_write(&out,s.refs.b,s.refs.pos);
+		count = s.closures.pos / (sizeof(cache_ref) * 2);
+		cache_write(&out,&count,sizeof(int));
+		cache_write(&out,s.closures.b,s.closures.pos);
+		count = s.fields.pos / sizeof(cache_field);
+		cache_write(&out,&count,sizeof(int));
+		cache_write(&out,s.fields.b,s.fields.pos);
+		cache_write(&out,&ctx->stackMapsCount,sizeof(int));
+		cache_write(&out,ctx->stackMaps,sizeof(hl_stack_map) * ctx->stackMapsCount);
+		cache_write(&out,&ctx->stackBitsCount,sizeof(int));
+		cache_write(&out,ctx->stackBits,sizeof(int) * ((ctx->stackBitsCount + 31) >> 5));
+		if( m->code->hasdebug ) {
+			for(i=0;i<m->code->nfunctions;i++) {
+				hl_debug_infos *d = m->jit_debug + i;
+				int large = d->large;
+				cache_write(&out,&d->start,sizeof(int));
+				cache_write(&out,&large,sizeof(int));
+				cache_write(&out,d->offsets,(large ? sizeof(int) : sizeof(unsigned short)) * (m->code->functions[i].nops + 1));
+				cache_write(&out,&d->ninlines,sizeof(int));
+				if( d->ninlines ) cache_write(&out,d->inlines,cache_inlines_size(m->code,d->inlines,d->ninlines));
+			}
+		}
+		check = cache_check(out.b + check_pos + sizeof(uint64),out.pos - check_pos - sizeof(uint64));
+		memcpy(out.b + check_pos,&check,sizeof(uint64));
+		// several processes might start at the same time : the file is replaced once complete
+		tmp = (char*)malloc(strlen(m->jit_cache) + 16);
+		sprintf(tmp,"%s.%d",m->jit_cache,(int)getpid());
+		f = fopen(tmp,"wb");
+		if( f ) {
+			ok = fwrite(out.b,1,out.pos,f) == (size_t)out.pos;
+			fclose(f);
+			if( !ok || rename(tmp,m->jit_cache) != 0 )
+				unlink(tmp);
+		}
+		free(tmp);
+	}
+	free(s.refs.b);
+	free(s.closures.b);
+	free(s.fields.b);
+	free(out.b);
+}
+
+typedef struct {
+	unsigned char *b;
+	unsigned char *end;
+} cache_reader;
+
+static void *cache_read( cache_reader *r, int64 size ) {
+	unsigned char *p = r->b;
+	if( size < 0 || size > r->end - r->b )
+		return NULL;
+	r->b += size;
+	return p;
+}
+
+static bool cache_read_int( cache_reader *r, int *v ) {
+	void *p = cache_read(r,sizeof(int));
+	if( p == NULL ) return false;
+	memcpy(v,p,sizeof(int));
+	return true;
+}
+
+static void *cache_resolve( hl_module *m, unsigned char *code, int size, void **images, int nimages, cache_ref *r, bool *ok ) {
+	switch( r->kind ) {
+	case REF_PTR:
+		return NULL;
+	case REF_CODE:
+		if( r->offset < 0 || r->offset >= size ) break;
+		return code + r->offset;
+	case REF_TYPE:
+		if( r->offset < 0 || r->offset >= (int_val)sizeof(hl_type) * m->code->ntypes ) break;
+		return (unsigned char*)m->code->types + r->offset;
+	case REF_GLOBAL:
+		if( r->offset < 0 || r->offset >= m->globals_size ) break;
+		return m->globals_data + r->offset;
+	case REF_MODULE:
+		return m;
+	case REF_IMAGE:
+		if( r->index < 0 || r->index >= nimages ) break;
+		return (unsigned char*)images[r->index] + r->offset;
+	default:
+		break;
+	}
+	*ok = false;
+	return NULL;
+}
+
+static bool cache_load( hl_module *m, cache_reader *r ) {
+	int *header, i, count, nclosures, nfields, nmaps, nbits, size, alloc_size;
+	void *images[CACHE_MAX_IMAGES];
+	unsigned char *code, *src, *fpos, *refs;
+	cache_ref *closures_data;
+	cache_field *fields_data;
+	vclosure **closures = NULL;
+	hl_field_cache **fields = NULL;
+	hl_debug_infos *debug = NULL;
+	hl_stack_map *maps = NULL;
+	unsigned int *bits = NULL;
+	uint64 digest;
+	bool ok = true;
+	header = (int*)cache_read(r,sizeof(int) * 11);
+	if( header == NULL || header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION || header[2] != HL_VERSION )
+		return false;
+	if( header[3] != cache_flags(m) || header[4] != m->code->nfunctions || header[5] != m->globals_size || header[9] < 0 || header[9] > CACHE_MAX_IMAGES || header[10] != m->jit_inline )
+		return false;
+	src = cache_read(r,sizeof(uint64));
+	if( src == NULL ) return false;
+	memcpy(&digest,src,sizeof(uint64));
+	if( digest != m->code->digest )
+		return false;
+	src = cache_read(r,sizeof(uint64));
+	if( src == NULL ) return false;
+	memcpy(&digest,src,sizeof(uint64));
+	if( digest != cache_check(r->b,r->end - r->b) )
+		return false;
+	for(i=0;i<header[9];i++) {
+		int anchor, len;
+		int64 id[3];
+		char *name;
+		cache_image img;
+		if( !cache_read_int(r,&anchor) || (src = cache_read(r,sizeof(id))) == NULL || !cache_read_int(r,&len) || (name = (char*)cache_read(r,len)) == NULL )
+			return false;
+		memcpy(id,src,sizeof(id));
+		images[i] = cache_anchor(m,anchor);
+		if( !cache_image_id(images[i],&img) || img.size != id[0] || img.mtime != id[1] || img.inode != id[2] || (int)strlen(img.name) != len || memcmp(img.name,name,len) != 0 )
+			return false;
+	}
+	size = header[6];
+	src = cache_read(r,size);
+	fpos = cache_read(r,sizeof(int) * (int64)m->code->nfunctions);
+	if( src == NULL || fpos == NULL || !cache_read_int(r,&count) || (refs = cache_read(r,sizeof(cache_ref) * (int64)count)) == NULL )
+		return false;
+	if( !cache_read_int(r,&nclosures) || (closures_data = (cache_ref*)cache_read(r,sizeof(cache_ref) * 2 * (int64)nclosures)) == NULL )
+		return false;
+	if( !cache_read_int(r,&nfields) || (fields_data = (cache_field*)cache_read(r,sizeof(cache_field) * (int64)nfields)) == NULL )
+		return false;
+	if( !cache_read_int(r,&nmaps) || (maps = (hl_stack_map*)cache_read(r,sizeof(hl_stack_map) * (int64)nmaps)) == NULL )
+		return false;
+	if( !cache_read_int(r,&nbits) || (bits = (unsigned int*)cache_read(r,sizeof(int) * (((int64)nbits + 31) >> 5))) == NULL )
+		return false;
+	// relocate the code
+	alloc_size = size;
+	if( alloc_size & 4095 ) alloc_size += 4096 - (alloc_size&4095);
+	code = (unsigned char*)hl_alloc_executable_memory(alloc_size);
+	if( code == NULL )
+		return false;
+	memcpy(code,src,size);
+	closures = (vclosure**)malloc(sizeof(vclosure*) * (nclosures + 1));
+	for(i=0;i<nclosures;i++) {
+		cache_ref cr[2];
+		vclosure *c = (vclosure*)hl_zalloc(&m->ctx.alloc,sizeof(vclosure));
+		memcpy(cr,closures_data + i * 2,sizeof(cr));
+		c->t = (hl_type*)cache_resolve(m,code,size,images,header[9],cr,&ok);
+		c->fun = cache_resolve(m,code,size,images,header[9],cr + 1,&ok);
+		closures[i] = c;
+	}
+	fields = (hl_field_cache**)malloc(sizeof(hl_field_cache*) * (nfields + 1));
+	for(i=0;i<nfields;i++) {
+		cache_field cf;
+		hl_field_cache *c = (hl_field_cache*)hl_zalloc(&m->ctx.alloc,sizeof(hl_field_cache));
+		memcpy(&cf,fields_data + i,sizeof(cf));
+		c->t = (hl_type*)cache_resolve(m,code,size,images,header[9],&cf.t,&ok);
+		c->hfield = cf.hfield;
+		c->set = cf.set != 0;
+		fields[i] = c;
+	}
+	for(i=0;i<count && ok;i++) {
+		cache_ref cr;
+		void *v = NULL;
+		memcpy(&cr,refs + i * sizeof(cache_ref),sizeof(cr));
+		switch( cr.kind ) {
+		case REF_STRING:
+			if( cr.index < 0 || cr.index >= m->code->nstrings ) { ok = false; break; }
+			v = (void*)hl_get_ustring(m->code,cr.index);
+			break;
+		case REF_BYTES:
+			if( cr.index < 0 || cr.index >= (m->code->version >= 5 ? m->code->nbytes : m->code->nstrings) ) { ok = false; break; }
+			v = m->code->version >= 5 ? m->code->bytes + m->code->bytes_pos[cr.index] : m->code->strings[cr.index];
+			break;
+		case REF_CLOSURE:
+			if( cr.index < 0 || cr.index >= nclosures ) { ok = false; break; }
+			v = closures[cr.index];
+			break;
+		case REF_CACHE:
+			if( cr.index < 0 || cr.index >= nfields ) { ok = false; break; }
+			v = fields[cr.index];
+			break;
+		case REF_HASH:
+			if( cr.index < 0 || cr.index >= m->code->nstrings ) { ok = false; break; }
+			hl_hash_gen(hl_get_ustring(m->code,cr.index),true);
+			continue;
+		default:
+			v = cache_resolve(m,code,size,images,header[9],&cr,&ok);
+			break;
+		}
+		if( cr.pos < 0 || cr.pos > size - (int)sizeof(void*) )
+			ok = false;
+		if( ok )
+			*(void**)(code + cr.pos) = v;
+	}
+	free(closures);
+	free(fields);
+	for(i=0;i<m->code->nfunctions && ok;i++) {
+		int pos;
+		memcpy(&pos,fpos + i * sizeof(int),sizeof(int));
+		if( pos < 0 || pos >= size ) ok = false;
+	}
+	if( ok && m->code->hasdebug ) {
+		debug = (hl_debug_infos*)calloc(m->code->nfunctions,sizeof(hl_debug_infos));
+		for(i=0;i<m->code->nfunctions && ok;i++) {
+			int large, start, osize;
+			if( !cache_read_int(r,&start) || !cache_read_int(r,&large) ) {
+				ok = false;
+				break;
+			}
+			osize = (large ? sizeof(int) : sizeof(unsigned short)) * (m->code->functions[i].nops + 1);
+			src = cache_read(r,osize);
+			if( src == NULL ) {
+				ok = false;
+				break;
+			}
+			debug[i].start = start;
+			debug[i].large = large != 0;
+			debug[i].offsets = malloc(osize);
+			memcpy(debug[i].offsets,src,osize);
+			if( !cache_read_int(r,&debug[i].ninlines) || debug[i].ninlines < 0 || debug[i].ninlines > m->code->functions[i].nops ) {
+				ok = false;
+				break;
+			}
+			if( debug[i].ninlines ) {
+				hl_debug_inline *inl = (hl_debug_inline*)cache_read(r,sizeof(hl_debug_inline) * (int64)debug[i].ninlines);
+				int k, tsize = 0;
+				if( inl == NULL ) {
+					ok = false;
+					break;
+				}
+				for(k=0;k<debug[i].ninlines;k++) {
+					hl_debug_inline cur;
+					memcpy(&cur,inl + k,sizeof(cur));
+					if( cur.fidx < 0 || cur.fidx >= m->code->nfunctions || cur.offsets != tsize ) {
+						ok = false;
+						break;
+					}
+					tsize += m->code->functions[cur.fidx].nops + 1;
+				}
+				if( !ok || cache_read(r,sizeof(int) * (int64)tsize) == NULL ) {
+					ok = false;
+					break;
+				}
+				osize = cache_inlines_size(m->code,inl,debug[i].ninlines);
+				debug[i].inlines = (hl_debug_inline*)malloc(osize);
+				memcpy(debug[i].inlines,inl,osize);
+			}
+		}
+		if( !ok ) {
+			for(i=0;i<m->code->nfunctions;i++) {
+				free(debug[i].offsets);
+				free(debug[i].inlines);
+			}
+			free(debug);
+		}
+	}
+	if( !ok ) {
+		hl_free_executable_memory(code,alloc_size);
+		return false;
+	}
+	// the module now uses this code as if it was compiled
+	for(i=0;i<m->code->nfunctions;i++) {
+		int pos;
+		memcpy(&pos,fpos + i * sizeof(int),sizeof(int));
+		m->functions_ptrs[m->code->functions[i].findex] = code + pos;
+	}
+	if( nmaps ) {
+		hl_stack_map *mcopy = (hl_stack_map*)malloc(sizeof(hl_stack_map) * nmaps);
+		unsigned int *bcopy = (unsigned int*)malloc(sizeof(int) * ((nbits + 31) >> 5) + 1);
+		memcpy(mcopy,maps,sizeof(hl_stack_map) * nmaps);
+		memcpy(bcopy,bits,sizeof(int) * ((nbits + 31) >> 5));
+		hl_gc_add_stack_maps(code,size,mcopy,nmaps,bcopy,nbits);
+		free(mcopy);
+		free(bcopy);
+	}
+	m->jit_code = code;
+	m->codesize = alloc_size;
+	m->jit_debug = debug;
+	if( !call_jit_c2hl ) {
+		call_jit_c2hl = code + header[7];
+		call_jit_hl2c = code + header[8];
+		hl_setup_callbacks2(callback_c2hl, get_wrapper, 1);
+	}
+	return true;
+}
+
+h_bool hl_jit_load( hl_module *m ) {
+	struct stat st;
+	cache_reader r;
+	void *data;
+	bool ok;
+	int fd = open(m->jit_cache,O_RDONLY);
+	if( fd < 0 )
+		return false;
+	if( fstat(fd,&st) != 0 || st.st_size == 0 ) {
+		close(fd);
+		return false;
+	}
+	data = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if( data == MAP_FAILED )
+		return false;
+	r.b = (unsigned char*)data;
+	r.end = r.b + st.st_size;
+	ok = cache_load(m,&r);
+	munmap(data,st.st_size);
+	return ok;
+}
+
+#else
+
+void hl_jit_save( jit_ctx *ctx, hl_module *m ) {
+}
+
+h_bool hl_jit_load( hl_module *m ) {
+	return false;
+}
+
+#endif
@@ -220,7 +220,8 @@ int main(int argc, pchar *argv[]) {
 		ctx.file_time = pfiletime(ctx.file);
 		hl_setup_reload_check(check_reload,&ctx);
 	}
-	hl_code_free(ctx.code);
+	// the tiered and lazy JIT need the opcodes to compile the functions later
+	if( !ctx.m->jit_profile && !ctx.m->jit_reserved ) hl_code_free(ctx.code);
 	if( debug_port > 0 && !hl_module_debug(ctx.m,debug_port,debug_wait) ) {
 		fprintf(stderr,"Could not start debugger on port %d\n",debug_port);
 		return 4;
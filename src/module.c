@@ -37,33 +37,85 @@ HL_API void hl_prim_not_loaded( const uchar *err );
 
 static hl_module **cur_modules = NULL;
 static int modules_count = 0;
+static hl_mutex *jit_lock = NULL;
+#ifdef HL_THREADS
+static hl_semaphore *jit_parts_done = NULL;
+#endif
 
-static bool module_resolve_pos( hl_module *m, void *addr, int *fidx, int *fpos ) {
-	int code_pos = ((int)(int_val)((unsigned char*)addr - (unsigned char*)m->jit_code));
-	int min, max;
-	hl_debug_infos *dbg;
-	hl_function *fdebug;
-	if( m->jit_debug == NULL )
-		return false;
-	// lookup function from code pos
-	min = 0;
-	max = m->code->nfunctions;
+// the inlined function running at this position of its caller : returns its opcode in the offsets table
+static int *module_resolve_inline( hl_module *m, hl_debug_infos *dbg, int code_pos ) {
+	hl_debug_inline *inl;
+	int *offsets;
+	int min = 0, max = dbg->ninlines;
 	while( min < max ) {
 		int mid = (min + max) >> 1;
-		hl_debug_infos *p = m->jit_debug + mid;
-		if( p->start <= code_pos )
+		if( dbg->inlines[mid].start <= code_pos )
 			min = mid + 1;
 		else
 			max = mid;
 	}
 	if( min == 0 )
-		return false; // hl_callback
-	do {
-		min--;
-		*fidx = min;
-		dbg = m->jit_debug + min;
-		fdebug = m->code->functions + min;
-	} while( !dbg->offsets );
+		return NULL;
+	inl = dbg->inlines + min - 1;
+	if( code_pos >= inl->end )
+		return NULL;
+	offsets = (int*)(dbg->inlines + dbg->ninlines) + inl->offsets;
+	min = 0;
+	max = m->code->functions[inl->fidx].nops;
+	while( min < max ) {
+		int mid = (min + max) >> 1;
+		if( offsets[mid] <= code_pos )
+			min = mid + 1;
+		else
+			max = mid;
+	}
+	return min == 0 ? NULL : offsets + min - 1;
+}
+
+static bool module_resolve_pos( hl_module *m, void *addr, int *fidx, int *fpos, int **inlined ) {
+	int code_pos = ((int)(int_val)((unsigned char*)addr - (unsigned char*)m->jit_code));
+	int min, max;
+	hl_debug_infos *dbg;
+	hl_function *fdebug;
+	if( m->jit_debug == NULL )
+		return false;
+	if( m->jit_blocks ) {
+		// lazy mode : the functions are in their compilation order
+		min = 0;
+		max = m->jit_blocks_count;
+		while( min < max ) {
+			int mid = (min + max) >> 1;
+			if( m->jit_blocks[mid].debug.start <= code_pos )
+				min = mid + 1;
+			else
+				max = mid;
+		}
+		if( min == 0 )
+			return false; // hl_callback or stub
+		*fidx = m->jit_blocks[min - 1].fidx;
+		dbg = &m->jit_blocks[min - 1].debug;
+		fdebug = m->code->functions + *fidx;
+	} else {
+		// lookup function from code pos
+		min = 0;
+		max = m->code->nfunctions;
+		while( min < max ) {
+			int mid = (min + max) >> 1;
+			hl_debug_infos *p = m->jit_debug + mid;
+			if( p->start <= code_pos )
+				min = mid + 1;
+			else
+				max = mid;
+		}
+		if( min == 0 )
+			return false; // hl_callback
+		do {
+			min--;
+			*fidx = min;
+			dbg = m->jit_debug + min;
+			fdebug = m->code->functions + min;
+		} while( !dbg->offsets );
+	}
 	// lookup inside function
 	min = 0;
 	max = fdebug->nops;
@@ -79,9 +131,44 @@ static bool module_resolve_pos( hl_module *m, void *addr, int *fidx, int *fpos )
 	if( min == 0 )
 		return false; // ???
 	*fpos = min - 1;
+	if( inlined ) *inlined = dbg->ninlines > 0 ? module_resolve_inline(m,dbg,code_pos) : NULL;
 	return true;
 }
 
+// the frame of an inlined function is reported with the address of its opcode in the offsets table
+static bool module_resolve_inline_frame( void *addr, hl_module **rm, int *fidx, int *fpos ) {
+	int i, k, j;
+	for(i=0;i<modules_count;i++) {
+		hl_module *m = cur_modules[i];
+		int count = m->jit_blocks ? m->jit_blocks_count : m->code->nfunctions;
+		if( !m->jit_inline || !m->jit_debug ) continue;
+		for(k=0;k<count;k++) {
+			hl_debug_infos *dbg = m->jit_blocks ? &m->jit_blocks[k].debug : m->jit_debug + k;
+			if( !dbg->offsets || dbg->ninlines <= 0 ) continue;
+			for(j=0;j<dbg->ninlines;j++) {
+				hl_debug_inline *inl = dbg->inlines + j;
+				int *offsets = (int*)(dbg->inlines + dbg->ninlines) + inl->offsets;
+				if( (int*)addr >= offsets && (int*)addr < offsets + m->code->functions[inl->fidx].nops ) {
+					*rm = m;
+					*fidx = inl->fidx;
+					*fpos = (int)((int*)addr - offsets);
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// a frame in an inlined function is preceded by the one of this function
+static int *module_inline_frame( hl_module *m, void *addr ) {
+	int fidx, fpos;
+	int *inlined = NULL;
+	if( !m->jit_inline || !module_resolve_pos(m,addr,&fidx,&fpos,&inlined) )
+		return NULL;
+	return inlined;
+}
+
 uchar *hl_module_resolve_symbol_full( void *addr, uchar *out, int *outSize, int **r_debug_addr ) {
 	int *debug_addr;
 	int file, line;
@@ -94,9 +181,10 @@ uchar *hl_module_resolve_symbol_full( void *addr, uchar *out, int *outSize, int
 		m = cur_modules[i];
 		if( addr >= m->jit_code && addr <= (void*)((char*)m->jit_code + m->codesize) ) break;
 	}
-	if( i == modules_count )
-		return NULL;
-	if( !module_resolve_pos(m,addr,&fidx,&fpos) )
+	if( i == modules_count ) {
+		if( !module_resolve_inline_frame(addr,&m,&fidx,&fpos) )
+			return NULL;
+	} else if( !module_resolve_pos(m,addr,&fidx,&fpos,NULL) )
 		return NULL;
 	// extract debug info
 	fdebug = m->code->functions + fidx;
@@ -126,6 +214,13 @@ static uchar *module_resolve_symbol( void *addr, uchar *out, int *outSize ) {
 	return hl_module_resolve_symbol_full(addr,out,outSize,NULL);
 }
 
+// skip the callbacks (and stubs) emitted before the functions
+static int module_code_start( hl_module *m ) {
+	if( m->jit_reserved )
+		return m->jit_stubs;
+	return m->jit_debug ? m->jit_debug[0].start : 0;
+}
+
 int hl_module_capture_stack_range( void *stack_top, void **stack_ptr, void **out, int size ) {
 #if defined(HL_64) && defined(HL_WIN)
 #else
@@ -134,33 +229,33 @@ int hl_module_capture_stack_range( void *stack_top, void **stack_ptr, void **out
 	int count = 0;
 	if( modules_count == 1 ) {
 		hl_module *m = cur_modules[0];
-		unsigned char *code = m->jit_code;
-		int code_size = m->codesize;
-		if( m->jit_debug ) {
-			int s = m->jit_debug[0].start;
-			code += s;
-			code_size -= s;
-		}
+		int s = module_code_start(m);
+		unsigned char *code = (unsigned char*)m->jit_code + s;
+		int code_size = m->codesize - s;
 		while( stack_ptr < (void**)stack_top ) {
 #if defined(HL_64) && defined(HL_WIN)
 			void *module_addr = *stack_ptr++; // EIP
 			if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
+				int *inlined = module_inline_frame(m,module_addr);
 				if( out ) {
-					if( count == size ) break;
+					if( count + (inlined ? 2 : 1) > size ) break;
+					if( inlined ) out[count++] = inlined;
 					out[count++] = module_addr;
 				} else
-					count++;
+					count += inlined ? 2 : 1;
 			}
 #else
 			void *stack_addr = *stack_ptr++; // EBP
 			if( stack_addr > stack_bottom && stack_addr < stack_top ) {
 				void *module_addr = *stack_ptr; // EIP
 				if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
+					int *inlined = module_inline_frame(m,module_addr);
 					if( out ) {
-						if( count == size ) break;
+						if( count + (inlined ? 2 : 1) > size ) break;
+						if( inlined ) out[count++] = inlined;
 						out[count++] = module_addr;
 					} else {
-						count++;
+						count += inlined ? 2 : 1;
 					}
 				}
 			}
@@ -181,21 +276,30 @@ int hl_module_capture_stack_range( void *stack_top, void **stack_ptr, void **out
 					hl_module *m = cur_modules[i];
 					unsigned char *code = m->jit_code;
 					int code_size = m->codesize;
+					int *inlined;
 					if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
 						if( out && count == size ) {
 							stack_ptr = stack_top;
 							break;
 						}
-						if( m->jit_debug ) {
-							int s = m->jit_debug[0].start;
+						if( m->jit_debug || m->jit_reserved ) {
+							int s = module_code_start(m);
 							code += s;
 							code_size -= s;
 							if( module_addr < (void*)code || module_addr >= (void*)(code + code_size) ) continue;
 						}
-						if( out )
+						inlined = module_inline_frame(m,module_addr);
+						if( out ) {
+							if( inlined ) {
+								if( count + 2 > size ) {
+									stack_ptr = stack_top;
+									break;
+								}
+								out[count++] = inlined;
+							}
 							out[count++] = module_addr;
-						else
-							count++;
+						} else
+							count += inlined ? 2 : 1;
 						break;
 					}
 				}
@@ -629,6 +733,95 @@ static void hl_module_add( hl_module *m ) {
 	free(old_modules);
 }
 
+#ifdef HL_THREADS
+typedef struct {
+	hl_module *m;
+	jit_ctx *ctx;
+	int start;
+	int end;
+	int *fpos;
+	bool ok;
+} jit_part;
+
+static void module_jit_part( jit_part *p ) {
+	int i;
+	p->ok = true;
+	for(i=p->start;i<p->end;i++) {
+		int fpos = hl_jit_function(p->ctx, p->m, p->m->code->functions + i);
+		if( fpos < 0 ) {
+			p->ok = false;
+			break;
+		}
+		p->fpos[i] = fpos;
+	}
+}
+
+static void module_jit_thread( void *param ) {
+	module_jit_part((jit_part*)param);
+	hl_semaphore_release(jit_parts_done);
+}
+
+// compile ranges of functions in separate threads then append them in order : the code is the same as the serial one
+static bool module_jit_parallel( hl_module *m, jit_ctx *ctx, int nparts ) {
+	int nfunctions = m->code->nfunctions;
+	jit_part *parts = (jit_part*)malloc(sizeof(jit_part) * nparts);
+	int *fpos = (int*)malloc(sizeof(int) * nfunctions);
+	int i, k, start = 0, started = 0;
+	int64 total = 0, count = 0;
+	bool ok = true;
+	// shared data lazily initialized by the JIT
+	for(i=0;i<m->code->nstrings;i++)
+		hl_get_ustring(m->code,i);
+	if( !jit_parts_done ) {
+		hl_add_root(&jit_parts_done);
+		jit_parts_done = hl_semaphore_alloc(0);
+	}
+	for(i=0;i<nfunctions;i++)
+		total += m->code->functions[i].nops;
+	for(k=0;k<nparts;k++) {
+		jit_part *p = parts + k;
+		p->m = m;
+		p->fpos = fpos;
+		p->start = start;
+		while( start < nfunctions && (count < total * (k + 1) / nparts || k == nparts - 1) )
+			count += m->code->functions[start++].nops;
+		p->end = start;
+		if( k == 0 ) {
+			// ours, compiled after the main context callbacks
+			p->ctx = ctx;
+			continue;
+		}
+		p->ctx = hl_jit_alloc();
+		if( p->ctx == NULL ) {
+			p->ok = false;
+			continue;
+		}
+		hl_jit_init_part(p->ctx, m);
+		if( hl_thread_start(module_jit_thread, p, false) )
+			started++;
+		else
+			module_jit_part(p);
+	}
+	module_jit_part(parts);
+	while( started-- )
+		hl_semaphore_acquire(jit_parts_done);
+	for(k=0;k<nparts;k++) {
+		jit_part *p = parts + k;
+		int base = 0;
+		if( !p->ok ) ok = false;
+		if( k > 0 && p->ctx ) {
+			if( ok ) base = hl_jit_merge(ctx, p->ctx);
+			hl_jit_free(p->ctx, false);
+		}
+		for(i=p->start;ok && i<p->end;i++)
+			m->functions_ptrs[m->code->functions[i].findex] = (void*)(int_val)(base + fpos[i]);
+	}
+	free(fpos);
+	free(parts);
+	return ok;
+}
+#endif
+
 int hl_module_init( hl_module *m, h_bool hot_reload ) {
 	int i;
 	jit_ctx *ctx;
@@ -660,20 +853,83 @@ int hl_module_init( hl_module *m, h_bool hot_reload ) {
 	ctx = hl_jit_alloc();
 	if( ctx == NULL )
 		return 0;
-	hl_jit_init(ctx, m);
-	for(i=0;i<m->code->nfunctions;i++) {
-		hl_function *f = m->code->functions + i;
-		int fpos = hl_jit_function(ctx, m, f);
-		if( fpos < 0 ) {
-			hl_jit_free(ctx, false);
-			return 0;
+#	ifdef HL_64
+	char *tier = getenv("HL_JIT_TIER");
+	if( tier && !hot_reload && atoi(tier) > 0 ) {
+		// compile a baseline first, the hot functions are compiled again by the optimizing tier
+		m->jit_threshold = atoi(tier);
+		m->jit_profile = (hl_jit_profile*)hl_zalloc(&m->ctx.alloc,sizeof(hl_jit_profile) * m->code->nfunctions);
+		for(i=0;i<m->code->nfunctions;i++)
+			m->jit_profile[i].count = m->jit_threshold;
+	}
+	char *lazy = getenv("HL_JIT_LAZY");
+	if( lazy && !hot_reload && atoi(lazy) > 0 ) {
+		// only emit a stub per function, they are compiled on their first call and appended to a single code region
+		int64 size = 1 << 20;
+		for(i=0;i<m->code->nfunctions;i++)
+			size += (int64)m->code->functions[i].nops * 64 + 16;
+		if( m->jit_profile ) size <<= 1;
+		if( size < (1 << 30) ) {
+			m->jit_reserved = (int)((size + 4095) & ~4095);
+			if( m->code->hasdebug )
+				m->jit_blocks = (hl_jit_block*)malloc(sizeof(hl_jit_block) * m->code->nfunctions * 2);
 		}
-		m->functions_ptrs[f->findex] = (void*)(int_val)fpos;
 	}
-	m->jit_code = hl_jit_code(ctx, m, &m->codesize, &m->jit_debug, NULL);
-	for(i=0;i<m->code->nfunctions;i++) {
-		hl_function *f = m->code->functions + i;
-		m->functions_ptrs[f->findex] = ((unsigned char*)m->jit_code) + ((int_val)m->functions_ptrs[f->findex]);
+	if( (m->jit_profile || m->jit_reserved) && !jit_lock ) {
+		hl_add_root(&jit_lock);
+		jit_lock = hl_mutex_alloc(false);
+	}
+	char *inl = getenv("HL_JIT_INLINE");
+	if( inl && !hot_reload && atoi(inl) > 0 ) {
+		// the functions of at most this number of opcodes are copied in their callers
+		m->jit_inline = atoi(inl);
+	}
+	char *cache = getenv("HL_JIT_CACHE");
+	if( cache && *cache && !hot_reload && !m->jit_profile && !m->jit_reserved ) {
+		// the code is saved in the cache directory, in a file named after the bytecode hash
+		m->jit_cache = (char*)malloc(strlen(cache) + 32);
+		sprintf(m->jit_cache, "%s/%016llx.hljit", cache, (unsigned long long)m->code->digest);
+	}
+#	endif
+	if( !m->jit_cache || !hl_jit_load(m) ) {
+		hl_jit_init(ctx, m);
+#		ifdef HL_THREADS
+		char *threads = getenv("HL_JIT_THREADS");
+		int nthreads = threads && !m->jit_reserved ? atoi(threads) : 1;
+		if( nthreads > m->code->nfunctions ) nthreads = m->code->nfunctions;
+		if( nthreads > 1 ) {
+			if( !module_jit_parallel(m, ctx, nthreads) ) {
+				hl_jit_free(ctx, false);
+				return 0;
+			}
+		} else
+#		endif
+		for(i=0;i<m->code->nfunctions;i++) {
+			hl_function *f = m->code->functions + i;
+			int fpos = m->jit_reserved ? hl_jit_lazy_stub(ctx, m, f) : hl_jit_function(ctx, m, f);
+			if( fpos < 0 ) {
+				hl_jit_free(ctx, false);
+				return 0;
+			}
+			m->functions_ptrs[f->findex] = (void*)(int_val)fpos;
+		}
+		m->jit_code = hl_jit_code(ctx, m, &m->codesize, &m->jit_debug, NULL);
+		for(i=0;i<m->code->nfunctions;i++) {
+			hl_function *f = m->code->functions + i;
+			m->functions_ptrs[f->findex] = ((unsigned char*)m->jit_code) + ((int_val)m->functions_ptrs[f->findex]);
+		}
+		if( m->jit_cache ) hl_jit_save(ctx, m);
+	}
+	if( m->jit_reserved ) {
+		m->jit_stubs = m->codesize;
+		if( m->jit_debug ) {
+			for(i=0;i<m->code->nfunctions;i++) {
+				m->jit_debug[i].start = -1;
+				m->jit_debug[i].offsets = NULL;
+				m->jit_debug[i].ninlines = 0;
+				m->jit_debug[i].inlines = NULL;
+			}
+		}
 	}
 	// INIT constants
 	for(i=0;i<m->code->nconstants;i++) {
@@ -682,19 +938,120 @@ int hl_module_init( hl_module *m, h_bool hot_reload ) {
 	}
 
 #	ifdef HL_VTUNE
-	hl_module_init_vtune(m);
+	if( !m->jit_reserved ) hl_module_init_vtune(m);
 #	endif
 	hl_module_add(m);
 	hl_setup_exception(module_resolve_symbol, module_capture_stack);
 	hl_gc_set_dump_types(hl_module_types_dump);
-	hl_jit_free(ctx, hot_reload);
-	if( hot_reload ) {
-		hl_code_hash_finalize(m->hash);
-		m->jit_ctx = ctx;
-	}
+	hl_jit_free(ctx, hot_reload || m->jit_profile || m->jit_reserved);
+	if( hot_reload ) hl_code_hash_finalize(m->hash);
+	if( hot_reload || m->jit_profile || m->jit_reserved ) m->jit_ctx = ctx;
 	return 1;
 }
 
+// compile a function of the running module then redirect its previous entry there, as the hot reload does
+static void *module_link_function( hl_module *m, int fid ) {
+	hl_function *f = m->code->functions + fid;
+	jit_ctx *ctx = m->jit_ctx;
+	hl_debug_infos *debug = NULL;
+	hl_module *m2 = NULL;
+	unsigned char *code = NULL;
+	int i, fpos, size;
+	hl_jit_reset(ctx, m);
+	fpos = hl_jit_function(ctx, m, f);
+	if( fpos >= 0 )
+		code = (unsigned char*)hl_jit_code(ctx, m, &size, &debug, NULL);
+	hl_jit_free(ctx, true);
+	if( code == NULL ) {
+		if( debug != m->jit_debug ) free(debug);
+		return NULL;
+	}
+	if( m->jit_reserved && code >= (unsigned char*)m->jit_code && code < (unsigned char*)m->jit_code + m->jit_reserved ) {
+		// appended to the module code, the debug infos of the function were updated in place
+		if( debug ) debug[fid].start += (int)(code - (unsigned char*)m->jit_code);
+	} else {
+		if( debug && debug == m->jit_debug ) {
+			// lazy mode with a full code region : move the function debug infos out of the module ones
+			hl_debug_infos *d = (hl_debug_infos*)malloc(sizeof(hl_debug_infos) * m->code->nfunctions);
+			memset(d, -1, sizeof(hl_debug_infos) * m->code->nfunctions);
+			d[fid] = debug[fid];
+			debug[fid].start = -1;
+			debug[fid].offsets = NULL;
+			debug[fid].ninlines = 0;
+			debug[fid].inlines = NULL;
+			debug = d;
+		}
+		// the code gets its own chunk, registered as a module sharing our code for the stack traces
+		m2 = (hl_module*)malloc(sizeof(hl_module));
+		memcpy(m2,m,sizeof(hl_module));
+		m2->jit_code = code;
+		m2->codesize = size;
+		m2->jit_debug = debug;
+		m2->jit_ctx = NULL;
+		m2->jit_reserved = 0;
+		m2->jit_blocks = NULL;
+		m2->jit_blocks_count = 0;
+		if( debug ) {
+			int start = -1;
+			for(i=0;i<m->code->nfunctions;i++) {
+				if( debug[i].start < 0 ) {
+					debug[i].start = start;
+					debug[i].offsets = NULL;
+					debug[i].ninlines = 0;
+					debug[i].inlines = NULL;
+				} else
+					start = debug[i].start;
+			}
+		}
+	}
+	// other threads might be running the entry we overwrite
+	hl_gc_stop_world(true);
+	if( m2 )
+		hl_module_add(m2);
+	else {
+		m->codesize = size;
+		if( m->jit_blocks ) {
+			hl_jit_block *b = m->jit_blocks + m->jit_blocks_count++;
+			b->debug = debug[fid];
+			b->fidx = fid;
+		}
+	}
+	hl_jit_patch_method(m->functions_ptrs[f->findex], m->functions_ptrs + f->findex);
+	m->functions_ptrs[f->findex] = code + fpos;
+	hl_gc_stop_world(false);
+	return code + fpos;
+}
+
+// called by the baseline code of a hot function : compile it again and jump there
+void hl_module_tier_up( hl_module *m, int fid ) {
+	hl_jit_profile *p = m->jit_profile + fid;
+	hl_blocking(true);
+	hl_mutex_acquire(jit_lock);
+	hl_blocking(false);
+	if( !p->tier && m->jit_threshold ) {
+		p->tier = 1;
+		module_link_function(m, fid);
+	}
+	hl_mutex_release(jit_lock);
+}
+
+// called by the stub of a function on its first call : compile it and return its address
+void *hl_module_compile( hl_module *m, int fid ) {
+	hl_function *f = m->code->functions + fid;
+	void *addr;
+	hl_blocking(true);
+	hl_mutex_acquire(jit_lock);
+	hl_blocking(false);
+	addr = m->functions_ptrs[f->findex];
+	// another thread might have compiled it while we were waiting
+	if( (unsigned char*)addr < (unsigned char*)m->jit_code + m->jit_stubs ) {
+		addr = module_link_function(m, fid);
+		if( addr == NULL ) hl_fatal("Failed to compile function");
+	}
+	hl_mutex_release(jit_lock);
+	return addr;
+}
+
 h_bool hl_module_patch( hl_module *m1, hl_code *c ) {
 	int i,i1,i2;
 	bool has_changes = false;
@@ -853,6 +1210,8 @@ h_bool hl_module_patch( hl_module *m1, hl_code *c ) {
 			if( m2->jit_debug[i].start < 0 ) {
 				m2->jit_debug[i].start = start;
 				m2->jit_debug[i].offsets = NULL;
+				m2->jit_debug[i].ninlines = 0;
+				m2->jit_debug[i].inlines = NULL;
 			} else {
 				start = m2->jit_debug[i].start;
 			}
@@ -915,12 +1274,22 @@ void hl_module_free( hl_module *m ) {
 	free(m->ctx.functions_types);
 	free(m->globals_indexes);
 	free(m->globals_data);
-	if( m->jit_debug ) {
+	if( m->jit_blocks ) {
 		int i;
-		for(i=0;i<m->code->nfunctions;i++)
+		for(i=0;i<m->jit_blocks_count;i++) {
+			free(m->jit_blocks[i].debug.offsets);
+			free(m->jit_blocks[i].debug.inlines);
+		}
+		free(m->jit_blocks);
+	} else if( m->jit_debug ) {
+		int i;
+		for(i=0;i<m->code->nfunctions;i++) {
 			free(m->jit_debug[i].offsets);
-		free(m->jit_debug);
+			free(m->jit_debug[i].inlines);
+		}
 	}
+	free(m->jit_debug);
+	free(m->jit_cache);
 	if( m->jit_ctx )
 		hl_jit_free(m->jit_ctx,false);
 	free(m);
@@ -39,6 +39,7 @@ HL_PRIM varray *hl_alloc_array( hl_type *at, int size ) {
 HL_PRIM void hl_array_blit( varray *dst, int dpos, varray *src, int spos, int len ) {
 	int size = hl_type_size(dst->at); 
 	memmove( hl_aptr(dst,vbyte) + dpos * size, hl_aptr(src,vbyte) + spos * size, len * size); 
+	if( hl_is_ptr(dst->at) ) hl_gc_write_barrier(dst);
 }
 
 HL_PRIM hl_type *hl_array_type( varray *a ) {
@@ -32,31 +32,24 @@ HL_PRIM vdynamic *hl_make_dyn( void *data, hl_type *t ) {
 	vdynamic *v;
 	switch( t->kind ) {
 	case HUI8:
-		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
-		v->t = t;
-		v->v.i = *(unsigned char*)data;
-		return v;
+		return hl_alloc_dynint(t,*(unsigned char*)data);
 	case HUI16:
-		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
-		v->t = t;
-		v->v.i = *(unsigned short*)data;
-		return v;
+		return hl_alloc_dynint(t,*(unsigned short*)data);
 	case HI32:
-		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
-		v->t = t;
-		v->v.i = *(int*)data;
-		return v;
+		return hl_alloc_dynint(t,*(int*)data);
 	case HI64:
 		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
 		v->t = t;
 		v->v.i64 = *(int64*)data;
 		return v;
 	case HF32:
+		if( *(int*)data == 0 ) return hl_alloc_dynint(t,0); // +0.0
 		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
 		v->t = t;
 		v->v.f = *(float*)data;
 		return v;
 	case HF64:
+		if( *(int64*)data == 0 ) return hl_alloc_dynint(t,0);
 		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
 		v->t = t;
 		v->v.d = *(double*)data;
@@ -516,15 +509,11 @@ HL_PRIM bool hl_type_safe_cast( hl_type *a, hl_type *b ) {
 #define OP_XOR 10
 
 static vdynamic *hl_dynf64( double v ) {
-	vdynamic *d = hl_alloc_dynamic(&hlt_f64);
-	d->v.d = v;
-	return d;
+	return hl_make_dyn(&v,&hlt_f64);
 }
 
 static vdynamic *hl_dyni32( int v ) {
-	vdynamic *d = hl_alloc_dynamic(&hlt_i32);
-	d->v.i = v;
-	return d;
+	return hl_alloc_dynint(&hlt_i32,v);
 }
 
 static bool is_number( hl_type *t ) {
@@ -77,13 +77,29 @@ HL_PRIM void hl_set_error_handler( vclosure *d ) {
 	t->exc_handler = d;
 }
 
-static bool break_on_trap( hl_thread_info *t, hl_trap_ctx *trap, vdynamic *v ) {
+static hl_jit_frame *jit_handler( hl_jit_frame *f, hl_trap_ctx *trap ) {
+	// the innermost JIT frame in a try block, unless the trap is more recent (the stack grows down)
+	while( f && !f->handler ) f = f->prev;
+	if( f && trap && (void*)trap < (void*)f ) return NULL;
+	return f;
+}
+
+static bool break_on_trap( hl_thread_info *t, hl_jit_frame *f, hl_trap_ctx *trap, vdynamic *v ) {
 	while( true ) {
-		if( trap == NULL || trap == t->trap_uncaught || t->trap_current == NULL || trap->prev == NULL ) return true;
-		if( !trap->tcheck || !v ) return false;
-		hl_type *ot = ((hl_type**)trap->tcheck)[1]; // it's an obj with first field is a hl_type
+		vdynamic *tcheck;
+		f = jit_handler(f,trap);
+		if( f ) {
+			vdynamic **check = ((vdynamic***)f->handler)[-1];
+			tcheck = check ? *check : NULL;
+			f = f->prev;
+		} else {
+			if( trap == NULL || trap == t->trap_uncaught || trap->prev == NULL ) return true;
+			tcheck = trap->tcheck;
+			trap = trap->prev;
+		}
+		if( !tcheck || !v ) return false;
+		hl_type *ot = ((hl_type**)tcheck)[1]; // it's an obj with first field is a hl_type
 		if( !ot || hl_safe_cast(v->t,ot) ) return false;
-		trap = trap->prev;
 	}
 	return false;
 }
@@ -91,22 +107,32 @@ static bool break_on_trap( hl_thread_info *t, hl_trap_ctx *trap, vdynamic *v ) {
 HL_PRIM void hl_throw( vdynamic *v ) {
 	hl_thread_info *t = hl_get_thread();
 	hl_trap_ctx *trap = t->trap_current;
+	hl_jit_frame *f = jit_handler(t->jit_frames,trap);
 	bool call_handler = false;
 	if( t->flags & HL_EXC_KILL )
 		hl_fatal("Exception Occured");
 	if( !(t->flags & HL_EXC_RETHROW) )
 		t->exc_stack_count = capture_stack_func(t->exc_stack_trace, HL_EXC_MAX_STACK);
 	t->exc_value = v;
-	t->trap_current = trap->prev;
-	call_handler = trap == t->trap_uncaught || t->trap_current == NULL;
-	if( (t->flags&HL_EXC_CATCH_ALL) || break_on_trap(t,trap,v) ) {
-		if( trap == t->trap_uncaught ) t->trap_uncaught = NULL;
+	if( !f ) {
+		t->trap_current = trap->prev;
+		call_handler = trap == t->trap_uncaught || t->trap_current == NULL;
+	}
+	if( (t->flags&HL_EXC_CATCH_ALL) || break_on_trap(t,t->jit_frames,trap,v) ) {
+		if( !f && trap == t->trap_uncaught ) t->trap_uncaught = NULL;
 		t->flags |= HL_EXC_IS_THROW;
 		hl_debug_break();
 		t->flags &= ~HL_EXC_IS_THROW;
 	}
 	t->flags &= ~HL_EXC_RETHROW;
 	if( t->exc_handler && call_handler ) hl_dyn_call_safe(t->exc_handler,&v,1,&call_handler);
+	if( f ) {
+		// the landing pad restores the stack of the function, we don't return
+		t->jit_frames = f;
+		((void(*)(hl_jit_frame*))f->handler)(f);
+	}
+	// drop the JIT frames more recent than the trap
+	while( t->jit_frames && (void*)t->jit_frames < (void*)trap ) t->jit_frames = t->jit_frames->prev;
 	if( throw_jump == NULL ) throw_jump = longjmp;
 	throw_jump(trap->buf,1);
 	HL_UNREACHABLE;
@@ -203,6 +203,12 @@ HL_PRIM vdynamic* hl_call_method( vdynamic *c, varray *args ) {
 			return NULL;
 		case HBOOL:
 			return hl_alloc_dynbool(out.v.b);
+		case HUI8:
+		case HUI16:
+		case HI32:
+		case HF32:
+		case HF64:
+			return hl_make_dyn(&out.v,tret);
 		default:
 			r = hl_alloc_dynamic(tret);
 			r->t = tret;
@@ -63,6 +63,7 @@ _MSTATIC void _MNAME(set_impl)( t_map *m, t_key key, _MVAL_TYPE value ) {
 		while( c >= 0 ) {
 			if( _MMATCH(c) ) {
 				m->values[c].value = value;
+				hl_gc_write_barrier(m->values + c);
 				return;
 			}
 			c = _MNEXT(m,c);
@@ -84,6 +85,7 @@ _MSTATIC void _MNAME(set_impl)( t_map *m, t_key key, _MVAL_TYPE value ) {
 	}
 	m->values[c].value = value;
 	m->nentries++;
+	hl_gc_write_barrier(m->values + c);
 }
 
 static void _MNAME(resize)( t_map *m ) {
@@ -102,7 +104,9 @@ static void _MNAME(resize)( t_map *m ) {
 
 	int ksize = nentries < _MLIMIT ? 1 : sizeof(int);
 	m->entries = (t_entry*)hl_gc_alloc_noptr(nentries * sizeof(t_entry));
+	hl_gc_write_barrier(m);
 	m->values = (t_value*)hl_gc_alloc_raw(nentries * sizeof(t_value));
+	hl_gc_write_barrier(m);
 	m->maxentries = nentries;
 
 	if( old.ncells == ncells && (nentries < _MLIMIT || old.maxentries >= _MLIMIT) ) {
@@ -131,6 +135,7 @@ static void _MNAME(resize)( t_map *m ) {
 			}
 		}
 	}
+	hl_gc_write_barrier(m);
 }
 
 #ifndef _MNO_EXPORTS
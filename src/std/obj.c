@@ -553,6 +553,7 @@ vdynamic *hl_virtual_make_value( vvirtual *v ) {
 	memset(hl_vfields(v) + nfields, 0, v->t->virt->dataSize);
 	o->virtuals = v;
 	v->value = (vdynamic*)o;
+	hl_gc_write_barrier(v);
 	return v->value;
 }
 
@@ -623,8 +624,10 @@ vvirtual *hl_to_virtual( hl_type *vt, vdynamic *obj ) {
 				} else
 					hl_vfields(v)[i] = f == NULL || !hl_same_type(f->t,vt->virt->fields[i].t) ? NULL : (char*)obj + f->field_index;
 			}
-			if( interface_address )
+			if( interface_address ) {
 				*interface_address = v;
+				hl_gc_write_barrier(interface_address);
+			}
 		}
 		break;
 	case HDYNOBJ:
@@ -655,6 +658,7 @@ vvirtual *hl_to_virtual( hl_type *vt, vdynamic *obj ) {
 			// add it to the list
 			v->next = o->virtuals;
 			o->virtuals = v;
+			hl_gc_write_barrier(o);
 			// recast
 			if( need_recast ) {
 				bool extra_check = vt->virt->nfields > 63;
@@ -761,6 +765,7 @@ static hl_field_lookup *hl_dynobj_add_field( vdynobj *o, int hfield, hl_type *t
 		address_offset = (char*)nvalues - (char*)o->values;
 		o->values = nvalues;
 		o->nvalues++;
+		hl_gc_write_barrier(o);
 	} else {
 		int raw_size = 0;
 		int i;
@@ -797,6 +802,7 @@ static hl_field_lookup *hl_dynobj_add_field( vdynobj *o, int hfield, hl_type *t
 		}
 		address_offset = newData - o->raw_data;
 		o->raw_data = newData;
+		hl_gc_write_barrier(o);
 		o->raw_size += pad;
 		index = o->raw_size;
 		o->raw_size += size;
@@ -813,6 +819,7 @@ static hl_field_lookup *hl_dynobj_add_field( vdynobj *o, int hfield, hl_type *t
 	memcpy(new_lookup + (field_pos + 1),o->lookup + field_pos, (o->nfields - field_pos) * sizeof(hl_field_lookup));
 	o->nfields++;
 	o->lookup = new_lookup;
+	hl_gc_write_barrier(o);
 
 	hl_dynobj_remap_virtuals(o, f, address_offset);
 	return f;
@@ -1072,6 +1079,7 @@ HL_PRIM void hl_dyn_seti( vdynamic *d, int hfield, hl_type *t, int value ) {
 			tmp.t = t;
 			tmp.v.i = value;
 			hl_write_dyn(addr,ft,&tmp,true);
+			hl_gc_write_barrier(addr);
 		}
 		break;
 	}
@@ -1109,6 +1117,7 @@ HL_PRIM void hl_dyn_seti64( vdynamic *d, int hfield, int64 value ) {
 			tmp.t = &hlt_i64;
 			tmp.v.i64 = value;
 			hl_write_dyn(addr,ft,&tmp,true);
+			hl_gc_write_barrier(addr);
 		}
 		break;
 	}
@@ -1125,6 +1134,7 @@ HL_PRIM void hl_dyn_setf( vdynamic *d, int hfield, float value ) {
 		tmp.t = &hlt_f32;
 		tmp.v.f = value;
 		hl_write_dyn(addr,t,&tmp,true);
+		hl_gc_write_barrier(addr);
 	}
 }
 
@@ -1139,6 +1149,7 @@ HL_PRIM void hl_dyn_setd( vdynamic *d, int hfield, double value ) {
 		tmp.t = &hlt_f64;
 		tmp.v.d = value;
 		hl_write_dyn(addr,t,&tmp,true);
+		hl_gc_write_barrier(addr);
 	}
 }
 
@@ -1156,6 +1167,70 @@ HL_PRIM void hl_dyn_setp( vdynamic *d, int hfield, hl_type *t, void *value ) {
 		tmp.v.ptr = value;
 		hl_write_dyn(addr,ft,&tmp, true);
 	}
+	hl_gc_write_barrier(addr);
+}
+
+// -------------------- INLINE CACHES ------------------------------------
+
+HL_PRIM int hl_atomic_add32( int *a, int b );
+HL_PRIM void *hl_atomic_compare_exchange_ptr( void **a, void *expected, void *replacement );
+
+static bool hl_cache_same_type( hl_type *t, hl_type *ft ) {
+	return hl_is_ptr(t) ? hl_same_type(t,ft) : t->kind == ft->kind;
+}
+
+static void hl_cache_add( hl_field_cache *c, hl_type *t, int_val offset ) {
+	int i;
+	if( c->count >= HL_FIELD_CACHE_SIZE || hl_is_tracking(HL_TRACK_DYNFIELD) ) return;
+	i = hl_atomic_add32(&c->count,1);
+	if( i >= HL_FIELD_CACHE_SIZE ) return;
+	// the JIT code compares the type first : publish it last
+	c->entries[i].offset = offset;
+	hl_atomic_compare_exchange_ptr((void**)&c->entries[i].t,NULL,t);
+}
+
+/**
+	Called by the JIT code when the receiver type of a dynamic field access is not in the cache of the site.
+	Returns the address of the field if it can be read or written as-is with the site type, NULL if the
+	access needs the generic hl_dyn_get/hl_dyn_set.
+**/
+HL_PRIM void *hl_dyn_cache_field( vdynamic *d, hl_field_cache *c ) {
+	hl_field_lookup *f;
+	if( d == NULL ) return NULL;
+	switch( d->t->kind ) {
+	case HOBJ:
+		f = obj_resolve_field(d->t->obj,c->hfield);
+		if( f == NULL || f->field_index < 0 || !hl_cache_same_type(c->t,f->t) ) return NULL;
+		hl_cache_add(c, d->t, f->field_index);
+		break;
+	case HVIRTUAL:
+		{
+			vvirtual *v = (vvirtual*)d;
+			void **addr;
+			f = hl_lookup_find(v->t->virt->lookup,v->t->virt->nfields,c->hfield);
+			// methods of the value are stored directly in the virtual
+			if( f == NULL || f->t->kind == HFUN || !hl_cache_same_type(c->t,f->t) ) return NULL;
+			// a NULL address means the field is missing or has another type in the value
+			addr = hl_vfields(v) + f->field_index;
+			if( *addr == NULL ) return NULL;
+			hl_cache_add(c, d->t, -(int_val)((char*)addr - (char*)v));
+			hl_track_call(HL_TRACK_DYNFIELD, on_dynfield(d,c->hfield));
+			return *addr;
+		}
+	case HDYNOBJ:
+		{
+			// the layout belongs to each object, only skip the dispatch
+			vdynobj *o = (vdynobj*)d;
+			f = hl_lookup_find(o->lookup,o->nfields,c->hfield);
+			if( f == NULL || !hl_cache_same_type(c->t,f->t) ) return NULL;
+			hl_track_call(HL_TRACK_DYNFIELD, on_dynfield(d,c->hfield));
+			return hl_dynobj_field(o,f);
+		}
+	default:
+		return NULL;
+	}
+	hl_track_call(HL_TRACK_DYNFIELD, on_dynfield(d,c->hfield));
+	return (char*)d + f->field_index;
 }
 
 // -------------------- HAXE API ------------------------------------
@@ -1185,6 +1260,7 @@ HL_PRIM void hl_obj_set_field( vdynamic *obj, int hfield, vdynamic *v ) {
 	hl_type *ft = NULL;
 	void *addr = hl_obj_lookup_set(obj,hfield,v->t,&ft);
 	hl_write_dyn(addr,ft,v,false);
+	hl_gc_write_barrier(addr);
 }
 
 HL_PRIM bool hl_obj_has_field( vdynamic *obj, int hfield ) {
@@ -520,6 +520,7 @@ HL_PRIM void hl_tls_free( hl_tls *l ) {
 HL_PRIM void hl_tls_set( hl_tls *l, void *v ) {
 #	if !defined(HL_THREADS)
 	l->value = v;
+	hl_gc_write_barrier(l);
 #	else
 	if( l->gc ) {
 		void **store = _tls_get(l);
@@ -633,8 +634,10 @@ HL_PRIM void hl_deque_add( hl_deque *q, vdynamic *msg ) {
 	LOCK(q->lock);
 	if( q->last == NULL )
 		q->first = t;
-	else
+	else {
 		q->last->next = t;
+		hl_gc_write_barrier(q->last);
+	}
 	q->last = t;
 	SIGNAL(q->wait);
 	UNLOCK(q->lock);
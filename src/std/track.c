@@ -200,6 +200,8 @@ HL_PRIM void hl_track_init() {
 	char *env = getenv("HL_TRACK");
 	if( env )
 		hl_track.flags = atoi(env);
+	if( hl_track.flags & HL_TRACK_ALLOC )
+		hl_gc_release_regions();
 	hl_track.on_alloc = on_alloc;
 	hl_track.on_cast = on_cast;
 	hl_track.on_dynfield = on_dynfield;
@@ -274,12 +276,18 @@ HL_PRIM void hl_track_set_depth( int d ) {
 
 HL_PRIM void hl_track_set_bits( int flags, bool thread ) {
 #	ifdef HL_TRACK_ENABLE
+	bool start_alloc;
 	if( thread ) {
 		hl_thread_info *t = hl_get_thread();
-		if( t ) t->flags = (t->flags & ~(HL_TRACK_MASK<<HL_TREAD_TRACK_SHIFT)) | ((flags & HL_TRACK_MASK) << HL_TREAD_TRACK_SHIFT);	
+		if( !t ) return;
+		start_alloc = (hl_track.flags & HL_TRACK_ALLOC) && !(t->flags & (HL_TRACK_ALLOC << HL_TREAD_TRACK_SHIFT)) && (flags & HL_TRACK_ALLOC);
+		t->flags = (t->flags & ~(HL_TRACK_MASK<<HL_TREAD_TRACK_SHIFT)) | ((flags & HL_TRACK_MASK) << HL_TREAD_TRACK_SHIFT);	
 	} else {
+		start_alloc = !(hl_track.flags & HL_TRACK_ALLOC) && (flags & HL_TRACK_ALLOC);
 		hl_track.flags = (hl_track.flags & ~HL_TRACK_MASK) | (flags & HL_TRACK_MASK);
 	}
+	if( start_alloc )
+		hl_gc_release_regions();
 #	endif
 }
 